@@ -1,22 +1,158 @@
 #include "edimcoder.h"
 
+size_t undoBudget = UNDO_DEFAULT_BUDGET;
+
+internal uint32_t lastUndoId(Buffer *buffer);
+
 void buffer_initEmptyBuffer(Buffer *buffer) {
-    Line emptyLine;
-    emptyLine.chars = NULL;
-    
-    Operation emptyOperation;
-    emptyOperation.kind = Undo;
-    emptyOperation.lines = NULL;
-    emptyOperation.original = emptyLine;
-    
     buffer->openedFilename = NULL;
     buffer->fileType = FT_UNKNOWN;
     buffer->lines = NULL;
-    buffer->lastOperation = emptyOperation;
+    buffer->linePool = (LinePool) {0};
+    buffer->nextLineId = 1;
+    buffer->lineIndex = (Map) {0};
+    buffer->lineShifts = NULL;
+    buffer->lexFileType = FT_UNKNOWN;
+    buffer->lexedUpTo = 0;
+    buffer->lexHighWater = 0;
+    buffer->lexDirtyMax = -1;
+    buffer->undoHistory = NULL;
+    buffer->undoPosition = 0;
+    buffer->undoBytes = 0;
+    buffer->nextUndoId = 1;
+    buffer->undoBaseId = 0;
+    buffer->savedUndoId = UNDO_NOT_SAVED;
+    buffer->checkpoints = NULL;
+    buffer->undoLog = NULL;
+    buffer->undoLogPending = false;
+    buffer->undoLogHash = 0;
     buffer->modified = false;
-    buffer->outline.nodes = NULL;
+    buffer->outline = NULL;
+    buffer->changedStart = -1;
+    buffer->changedEnd = -1;
+    buffer->changedLineDelta = 0;
+    swissmap_init(&buffer->symbolIndex, sizeof(const char *), sizeof(int), NULL, NULL);
+    buffer->symbolNext = NULL;
+    buffer->symbolIndexStale = true;
+    buffer->braceDeltas = NULL;
+    buffer->braceTree = NULL;
+    buffer->braceTreeStale = true;
+    buffer->braceFileType = FT_UNKNOWN;
 
     buffer->bookmarks = NULL;
+    swissmap_init(&buffer->bookmarkIndex, sizeof(const char *), sizeof(int), NULL, NULL);
+    buffer->bookmarkEndpoints = NULL;
+    buffer->bookmarkShifts = NULL;
+    buffer->bookmarkEndpointsStale = true;
+}
+
+// -- Line storage --
+
+// Smallest size class that has room for length chars, or -1 if they're too long for the pool
+internal int lineCharsClass(size_t length) {
+    size_t blockSize = LINE_POOL_MIN_BLOCK;
+    for (int i = 0; i < LINE_POOL_CLASSES; i++, blockSize *= 2) {
+        if (offsetof(BufHdr, buf) + length <= blockSize)
+            return i;
+    }
+    return -1;
+}
+
+// Returns empty chars with room for length chars, from the pool if they fit in it. charsClass is set to the Line.charsClass for them.
+internal char *allocLineChars(Buffer *buffer, size_t length, uint8_t *charsClass) {
+    int sizeClass = lineCharsClass(length);
+    if (sizeClass == -1) {
+        *charsClass = LINE_CHARS_HEAP;
+        char *chars = NULL;
+        buf__fit(chars, length);
+        return chars;
+    }
+    
+    size_t blockSize = (size_t) LINE_POOL_MIN_BLOCK << sizeClass;
+    BufHdr *header = buffer->linePool.freeBlocks[sizeClass];
+    if (header != NULL) {
+        buffer->linePool.freeBlocks[sizeClass] = *(void **) header;
+        buffer->linePool.freeBytes -= blockSize;
+    } else header = arena_alloc(&buffer->linePool.slabs, blockSize);
+    header->len = 0;
+    header->cap = blockSize - offsetof(BufHdr, buf);
+    *charsClass = (uint8_t) (sizeClass + 1);
+    return header->buf;
+}
+
+internal void freeLineChars(Buffer *buffer, Line *line) {
+    if (line_isInline(line))
+        return;
+    if (line->charsClass == LINE_CHARS_HEAP) {
+        buf_free(line->text.chars);
+        return;
+    }
+    BufHdr *header = buf__hdr(line->text.chars);
+    *(void **) header = buffer->linePool.freeBlocks[line->charsClass - 1];
+    buffer->linePool.freeBlocks[line->charsClass - 1] = header;
+    buffer->linePool.freeBytes += (size_t) LINE_POOL_MIN_BLOCK << (line->charsClass - 1);
+}
+
+// Gives a line that doesn't have any chars yet a copy of chars, inline if it's short enough
+internal void setLineChars(Buffer *buffer, Line *line, const char *chars, size_t length) {
+    if (length <= LINE_INLINE_CAPACITY) {
+        memcpy(line->text.inlineChars, chars, length);
+        line->charsClass = (uint8_t) (LINE_CHARS_INLINE | length);
+        return;
+    }
+    line->text.chars = allocLineChars(buffer, length, &line->charsClass);
+    memcpy(buf_add(line->text.chars, length), chars, length);
+}
+
+// Changes the length of the line, keeping the chars that are still in it. New chars are left uninitialized.
+// The line moves in and out of its inline chars, or to a bigger pool block, as needed.
+internal void resizeLine(Buffer *buffer, Line *line, size_t length) {
+    size_t oldLength = line_length(line);
+    size_t keep = (length < oldLength) ? length : oldLength;
+    if (length <= LINE_INLINE_CAPACITY) {
+        if (!line_isInline(line)) {
+            // The chars pointer and the inline chars overlap
+            char kept[LINE_INLINE_CAPACITY];
+            memcpy(kept, line->text.chars, keep);
+            freeLineChars(buffer, line);
+            memcpy(line->text.inlineChars, kept, keep);
+        }
+        line->charsClass = (uint8_t) (LINE_CHARS_INLINE | length);
+        return;
+    }
+    
+    if (line->charsClass == LINE_CHARS_HEAP) {
+        if (length > oldLength)
+            buf__fit(line->text.chars, length - oldLength);
+    } else if (line_isInline(line) || length > buf_cap(line->text.chars)) {
+        uint8_t charsClass;
+        char *chars = allocLineChars(buffer, length, &charsClass);
+        memcpy(chars, line_chars(line), keep);
+        freeLineChars(buffer, line);
+        line->text.chars = chars;
+        line->charsClass = charsClass;
+    }
+    buf__hdr(line->text.chars)->len = length;
+}
+
+// Moves chars that were allocated outside of the buffer (typed lines, for example) into the line or the pool if they fit
+internal void adoptLineChars(Buffer *buffer, Line *line) {
+    if (line->charsClass != LINE_CHARS_HEAP || line->text.chars == NULL)
+        return;
+    size_t length = buf_len(line->text.chars);
+    if (length > LINE_INLINE_CAPACITY && lineCharsClass(length) == -1)
+        return;
+    char *chars = line->text.chars;
+    setLineChars(buffer, line, chars, length);
+    buf_free(chars);
+}
+
+// Heap copy of the line's chars
+internal char *copyLine(Line *line) {
+    char *copy = NULL;
+    if (line_length(line) > 0)
+        memcpy(buf_add(copy, line_length(line)), line_chars(line), line_length(line));
+    return copy;
 }
 
 // filename should be zero-terminated
@@ -25,57 +161,7 @@ int buffer_openFile(Buffer *buffer, char *filename) {
     FILE *fp;
     fp = fopen(filename, "r");
     
-    // Find last occurance of '.' in filename
-    int dotIndex;
-    /*for (int i = strlen(filename) - 1; i >= 0; i++) {
-        if (filename[i] == '.') {
-            dotIndex = i;
-            break;
-        }
-    }*/
-    for (int i = 0; i < strlen(filename); i++) {
-        if (filename[i] == '.') {
-            dotIndex = i;
-        }
-    }
-    
-    // Determine filetype based on extension
-    // TODO: Doesn't handle CPP files yet.
-    FileType ft;
-    switch (filename[dotIndex + 1]) {
-        case 't':
-        ft = FT_TEXT;
-        break;
-        case 'm':
-        ft = FT_MARKDOWN;
-        break;
-        case 'c':
-        ft = FT_C;
-        break;
-        case 'h':
-        ft = FT_C_HEADER;
-        break;
-        default:
-        ft = FT_UNKNOWN;
-        break;
-    }
-    if (ft != FT_UNKNOWN) {
-        int isType = true;
-        char *ftExt;
-        getFileTypeExtension(ft, &ftExt);
-        for (int i = dotIndex + 1; i < strlen(filename); i++) {
-            if (filename[i] != ftExt[i - dotIndex - 1]) {
-                isType = false;
-                break;
-            }
-        }
-        
-        if (isType)
-            buffer->fileType = ft;
-        else buffer->fileType = FT_UNKNOWN;
-        
-        free(ftExt);
-    }
+    buffer->fileType = buffer_fileTypeFromFilename(filename);
     
     buffer->openedFilename = NULL;
     for (int i = 0; i < strlen(filename) + 1; i++) {
@@ -84,9 +170,6 @@ int buffer_openFile(Buffer *buffer, char *filename) {
     
     // Make sure the filename ends with '\0'
     assert(buffer->openedFilename[buf_len(buffer->openedFilename) - 1] == '\0');
-    char *chars = NULL;
-    int line = 1;
-    char c;
     
     // If fp is NULL, file doesn't exist. Return false after having set the fileType.
     if (fp == NULL) {
@@ -94,55 +177,935 @@ int buffer_openFile(Buffer *buffer, char *filename) {
         return false;
     }
     
-    while ((c = fgetc(fp)) != EOF) {
-        buf_push(chars, c);
-        if (c == '\n') {
-            buf_push(buffer->lines, ((Line) { chars }));
-            ++line;
-            chars = NULL; // Create new char Stretchy Buffer for next line.
-        }
-    }
-    
+    buffer_readLines(buffer, fp);
     fclose(fp);
     
+    // Load the undo history the file had the last time it was edited
+    undoLog_open(buffer);
+    
     // Set modified to false and current line to last line in file.
     buffer->modified = false;
+    buffer->savedUndoId = lastUndoId(buffer);
     buffer->currentLine = buf_len(buffer->lines);
     
+    // Bookmarks and current line from the last time the file was closed
+    fileState_restore(buffer);
+    
     // Create the outline
     createOutline();
     
     return true;
 }
 
+// Reads the rest of the file into the buffer's lines. Each line keeps its '\n'.
+// Doesn't touch the outline or anything else, so it can be used for buffers that aren't open in the editor.
+void buffer_readLines(Buffer *buffer, FILE *fp) {
+    char chunk[4096];
+    char *pending = NULL; // Start of a line that goes on into the next chunk
+    size_t read;
+    
+    while ((read = fread(chunk, 1, sizeof(chunk), fp)) > 0) {
+        char *start = chunk;
+        char *end = chunk + read;
+        while (start < end) {
+            char *newline = memchr(start, '\n', end - start);
+            char *stop = newline ? newline + 1 : end;
+            if (newline && buf_len(pending) == 0) {
+                // The whole line is in the chunk, copy it straight into the line or the pool
+                Line line = { .id = buffer->nextLineId++ };
+                setLineChars(buffer, &line, start, stop - start);
+                buf_push(buffer->lines, line);
+            } else {
+                memcpy(buf_add(pending, stop - start), start, stop - start);
+                if (newline) {
+                    Line line = { .id = buffer->nextLineId++ };
+                    setLineChars(buffer, &line, pending, buf_len(pending));
+                    buf_push(buffer->lines, line);
+                    buf_pop_all(pending);
+                }
+            }
+            start = stop;
+        }
+    }
+    
+    // Last line of the file doesn't end with a '\n'
+    if (buf_len(pending) > 0) {
+        Line line = { .id = buffer->nextLineId++ };
+        setLineChars(buffer, &line, pending, buf_len(pending));
+        buf_push(buffer->lines, line);
+    }
+    buf_free(pending);
+    // The lines were pushed one at a time, so up to half of the array could be unused
+    buf_shrink(buffer->lines);
+    
+    // Keep the brace depth index in sync with the lines. The lexer fills in the counts of the lines it lexes,
+    // the filetypes it doesn't support are counted here.
+    bool countBraces = !lexer_isSupported(buffer->fileType);
+    buf_reserve(buffer->braceDeltas, buf_len(buffer->lines) - buf_len(buffer->braceDeltas), BUF_GROW_EXACT);
+    for (int i = buf_len(buffer->braceDeltas); i < buf_len(buffer->lines); i++) {
+        Line *line = &(buffer->lines[i]);
+        buf_push(buffer->braceDeltas, countBraces ? lexer_countBraces(line_chars(line), line_length(line), NULL) : 0);
+    }
+    buffer->braceTreeStale = true;
+    buffer->braceFileType = buffer->fileType;
+}
+
 void buffer_close(Buffer *buffer) {
+    // Keep the bookmarks and current line for the next time the file is opened
+    fileState_save(buffer);
+    
     // Clear openedFilename and the file information
     buf_free(buffer->openedFilename);
     
+    // Pooled chars are freed all at once with the pool, below
     for (int i = 0; i < buf_len(buffer->lines); i++) {
-        buf_free(buffer->lines[i].chars);
+        if (buffer->lines[i].charsClass == LINE_CHARS_HEAP)
+            buf_free(buffer->lines[i].text.chars);
+        buf_free(buffer->lines[i].tokens);
     }
 
-    // Clear the bookmarks (and names)
-    for (int i = 0; i < buf_len(buffer->bookmarks); i++) {
-        buf_free(buffer->bookmarks[i].name);
-    }
+    // Clear the bookmarks (the names are interned, so they stay)
     buf_free(buffer->bookmarks);
+    swissmap_free(&buffer->bookmarkIndex);
+    buf_free(buffer->bookmarkEndpoints);
+    buf_free(buffer->bookmarkShifts);
     
-    // Clear the outline
-    switch (buffer->fileType) {
-        case FT_MARKDOWN:
-        {
-            buf_free(buffer->outline.markdown_nodes);
-        } break;
-        case FT_C:
-        {
-            buf_free(buffer->outline.c_nodes);
-        } break;;
-    }
+    // Clear the outline and symbol index
+    buf_free(buffer->outline);
+    swissmap_free(&buffer->symbolIndex);
+    buf_free(buffer->symbolNext);
+    
+    buf_free(buffer->braceDeltas);
+    buf_free(buffer->braceTree);
+    
+    undoLog_close(buffer);
+    buffer_clearUndoHistory(buffer);
     
     // Free the buffer
     buf_free(buffer->lines);
+    arena_free(&buffer->linePool.slabs);
+    buffer->linePool = (LinePool) {0};
+    
+    xfree(buffer->lineIndex.keys);
+    xfree(buffer->lineIndex.vals);
+    buffer->lineIndex = (Map) {0};
+    buf_free(buffer->lineShifts);
+}
+
+internal struct {
+    const char *extension; // Interned by buffer_internExtensions
+    FileType fileType;
+} fileTypeExtensions[] = {
+    { "txt", FT_TEXT },
+    { "md", FT_MARKDOWN },
+    { "c", FT_C },
+    { "h", FT_C_HEADER },
+    { "cpp", FT_CPP }, { "cc", FT_CPP }, { "cxx", FT_CPP }, { "hpp", FT_CPP }, { "hh", FT_CPP }, { "hxx", FT_CPP },
+    { "sh", FT_SHELL }, { "bash", FT_SHELL },
+};
+
+// Has to be called before any file types are looked up. The symbol database looks them up from its worker threads,
+// which can only read the intern table.
+void buffer_internExtensions(void) {
+    for (int i = 0; i < sizeof(fileTypeExtensions) / sizeof(fileTypeExtensions[0]); i++) {
+        fileTypeExtensions[i].extension = str_intern(fileTypeExtensions[i].extension);
+    }
+}
+
+// filename should be zero-terminated
+// Determines the filetype based on the extension (the characters after the last '.')
+FileType buffer_fileTypeFromFilename(char *filename) {
+    char *extension = strrchr(filename, '.');
+    if (extension == NULL || strchr(extension, '/') || strchr(extension, '\\'))
+        return FT_UNKNOWN;
+    ++extension;
+    
+    const char *interned = str_intern_find(extension, extension + strlen(extension));
+    if (interned == NULL)
+        return FT_UNKNOWN;
+    for (int i = 0; i < sizeof(fileTypeExtensions) / sizeof(fileTypeExtensions[0]); i++) {
+        if (fileTypeExtensions[i].extension == interned)
+            return fileTypeExtensions[i].fileType;
+    }
+    return FT_UNKNOWN;
+}
+
+// Adds the lines first to last (indices, inclusive) to the range of lines the outline has to look at again
+void buffer_markChanged(Buffer *buffer, int first, int last) {
+    if (buffer->changedStart == -1 || first < buffer->changedStart)
+        buffer->changedStart = first;
+    if (last > buffer->changedEnd)
+        buffer->changedEnd = last;
+}
+
+// -- Brace depth index --
+// Each line's net number of opened braces (ignoring the ones in strings, chars, and comments) is kept in
+// braceDeltas, by line index. The depth at the start of a line is the sum of the counts of the lines before
+// it, which braceTree (a Fenwick tree over braceDeltas) gives in O(log n). The counts of the filetypes the
+// lexer supports are set by the lexer as it lexes each line, so they're only valid up to where it has lexed.
+// Changing a line is an O(log n) update of the tree. Inserting or removing lines shifts braceDeltas along
+// with the lines, and the tree is rebuilt from it in O(n) (without recounting anything) the next time it's used.
+
+// Sets the brace count of the line at index (starting at 0)
+void buffer_setBraceDelta(Buffer *buffer, int index, int delta) {
+    if (index < 0 || index >= buf_len(buffer->braceDeltas))
+        return;
+    int difference = delta - buffer->braceDeltas[index];
+    if (difference == 0)
+        return;
+    buffer->braceDeltas[index] = delta;
+    if (buffer->braceTreeStale)
+        return;
+    for (int i = index + 1; i < buf_len(buffer->braceTree); i += i & -i) {
+        buffer->braceTree[i] += difference;
+    }
+}
+
+internal void countBracesOfLines(Buffer *buffer, int index, int count) {
+    if (lexer_isSupported(buffer->fileType))
+        return; // Counted by the lexer
+    for (int i = index; i < index + count && i < buf_len(buffer->lines); i++) {
+        Line *line = &(buffer->lines[i]);
+        buffer_setBraceDelta(buffer, i, lexer_countBraces(line_chars(line), line_length(line), NULL));
+    }
+}
+
+// Recounts everything if the filetype changed since the braces were counted
+internal void checkBraceFileType(Buffer *buffer) {
+    if (buffer->braceFileType == buffer->fileType && buf_len(buffer->braceDeltas) == buf_len(buffer->lines))
+        return;
+    
+    if (buffer->braceDeltas)
+        buf_pop_all(buffer->braceDeltas);
+    if (buf_len(buffer->lines) > 0) {
+        buf_reserve(buffer->braceDeltas, buf_len(buffer->lines), BUF_GROW_EXACT);
+        memset(buf_add(buffer->braceDeltas, buf_len(buffer->lines)), 0, buf_len(buffer->lines) * sizeof(int));
+    }
+    buffer->braceTreeStale = true;
+    buffer->braceFileType = buffer->fileType;
+    
+    if (lexer_isSupported(buffer->fileType))
+        lexer_reset(buffer); // So every line's count gets set again as it's lexed
+    else countBracesOfLines(buffer, 0, buf_len(buffer->lines));
+}
+
+internal void rebuildBraceTree(Buffer *buffer) {
+    int count = buf_len(buffer->braceDeltas);
+    if (buffer->braceTree)
+        buf_pop_all(buffer->braceTree);
+    buf_reserve(buffer->braceTree, count + 1, BUF_GROW_HALF);
+    buf_add(buffer->braceTree, count + 1);
+    buffer->braceTree[0] = 0;
+    for (int i = 1; i <= count; i++) {
+        buffer->braceTree[i] = buffer->braceDeltas[i - 1];
+    }
+    for (int i = 1; i <= count; i++) {
+        int parent = i + (i & -i);
+        if (parent <= count)
+            buffer->braceTree[parent] += buffer->braceTree[i];
+    }
+    buffer->braceTreeStale = false;
+}
+
+// Returns the brace depth at the start of the line at index (starting at 0). Can be negative if there are more closing braces than opening ones.
+int buffer_braceDepth(Buffer *buffer, int index) {
+    checkBraceFileType(buffer);
+    if (index > buf_len(buffer->lines))
+        index = buf_len(buffer->lines);
+    if (index <= 0)
+        return 0;
+    
+    lexer_ensureLexed(buffer, index - 1);
+    if (buffer->braceTreeStale)
+        rebuildBraceTree(buffer);
+    
+    int depth = 0;
+    for (int i = index; i > 0; i -= i & -i) {
+        depth += buffer->braceTree[i];
+    }
+    return depth;
+}
+
+internal int braceDeltaOfLine(Buffer *buffer, int index) {
+    if (index >= buffer->lexedUpTo)
+        lexer_ensureLexed(buffer, index);
+    return buffer->braceDeltas[index];
+}
+
+// If the line at index (starting at 0) opens a block, returns the index of the line that closes it. If it
+// closes a block, returns the index of the line that opened it. Returns -1 if there's no match.
+// Only the lines of the block are looked at.
+int buffer_findMatchingBrace(Buffer *buffer, int index) {
+    if (index < 0 || index >= buf_len(buffer->lines))
+        return -1;
+    int depth = buffer_braceDepth(buffer, index);
+    int delta = braceDeltaOfLine(buffer, index);
+    
+    if (delta > 0) {
+        // The block is closed on the first line that gets the depth back down to what it was before it
+        int current = depth + delta;
+        for (int i = index + 1; i < buf_len(buffer->lines); i++) {
+            current += braceDeltaOfLine(buffer, i);
+            if (current <= depth)
+                return i;
+        }
+    } else if (delta < 0) {
+        // The block was opened on the last line that started at (or under) the depth this line ends at
+        int target = depth + delta;
+        int current = depth;
+        for (int i = index - 1; i >= 0; i--) {
+            current -= buffer->braceDeltas[i];
+            if (current <= target)
+                return i;
+        }
+    }
+    return -1;
+}
+
+// Returns the index of the last line of the block that starts at index (starting at 0). The block's opening
+// brace can be on a later line, like for a function whose '{' is on the line after its name.
+// Returns index if the line doesn't start a block.
+int buffer_blockEnd(Buffer *buffer, int index) {
+    if (index < 0 || index >= buf_len(buffer->lines))
+        return index;
+    int depth = buffer_braceDepth(buffer, index);
+    int current = depth;
+    bool opened = false;
+    for (int i = index; i < buf_len(buffer->lines); i++) {
+        current += braceDeltaOfLine(buffer, i);
+        if (current > depth)
+            opened = true;
+        else if (opened)
+            return i;
+        else if (current < depth)
+            break; // Closed the block the line is in
+    }
+    return index;
+}
+
+// -- Line id index --
+// lineIndex maps a line id to the index the line was at, and to how many of lineShifts had happened then. To find
+// a line now, the shifts after that are applied to its index, and the result is put back so the next lookup
+// doesn't have to. Inserted and moved lines are put in as they move, so an edit costs as much as the lines it
+// touches, never a rebuild of the whole index.
+
+#define LINE_INDEX_REMOVED 0xffffffffu
+
+internal uint64_t lineIndex_entry(int shifts, uint32_t indexPlusOne) {
+    return ((uint64_t) shifts << 32) | indexPlusOne;
+}
+
+internal void lineIndex_drop(Buffer *buffer) {
+    xfree(buffer->lineIndex.keys);
+    xfree(buffer->lineIndex.vals);
+    buffer->lineIndex = (Map) {0};
+    buf_free(buffer->lineShifts);
+}
+
+// Puts in where the count lines at index are now
+internal void lineIndex_put(Buffer *buffer, int index, int count) {
+    for (int i = index; i < index + count; i++) {
+        map_put_uint64_from_uint64(&buffer->lineIndex, buffer->lines[i].id, lineIndex_entry(buf_len(buffer->lineShifts), (uint32_t) i + 1));
+    }
+}
+
+internal void lineIndex_shift(Buffer *buffer, int index, int count) {
+    if (buffer->lineIndex.cap == 0)
+        return;
+    if (buf_len(buffer->lineShifts) >= LINE_SHIFTS_MAX) {
+        // Lookups of lines that haven't been looked up in a long time would have too many shifts to go through
+        lineIndex_drop(buffer);
+        return;
+    }
+    buf_push(buffer->lineShifts, ((LineShift) { index, count }));
+    if (count > 0)
+        lineIndex_put(buffer, index, count);
+}
+
+// The count lines at index moved around among themselves
+internal void lineIndex_moved(Buffer *buffer, int index, int count) {
+    if (buffer->lineIndex.cap != 0)
+        lineIndex_put(buffer, index, count);
+}
+
+// Returns the index of the line with the id, or -1 if it isn't in the buffer
+internal int lineIndex_find(Buffer *buffer, uint32_t id) {
+    uint64_t entry = map_get_uint64_from_uint64(&buffer->lineIndex, id);
+    if (entry == 0 || (uint32_t) entry == LINE_INDEX_REMOVED)
+        return -1;
+    int shifts = buf_len(buffer->lineShifts);
+    int index = (int) (uint32_t) entry - 1;
+    for (int i = (int) (entry >> 32); i < shifts && index >= 0; i++) {
+        LineShift shift = buffer->lineShifts[i];
+        if (shift.count > 0) {
+            if (index >= shift.index)
+                index += shift.count;
+        } else if (index >= shift.index - shift.count) {
+            index += shift.count;
+        } else if (index >= shift.index) {
+            index = -1;
+        }
+    }
+    // Lines that were put back (by an undo) after being removed were put in again, so a removed line stays removed
+    map_put_uint64_from_uint64(&buffer->lineIndex, id, lineIndex_entry(shifts, index < 0 ? LINE_INDEX_REMOVED : (uint32_t) index + 1));
+    assert(index < 0 || buffer->lines[index].id == id);
+    return index;
+}
+
+// The contents of count lines starting at index changed
+internal void linesChanged(Buffer *buffer, int index, int count) {
+    lexer_linesChanged(buffer, index, count);
+    countBracesOfLines(buffer, index, count);
+    buffer_markChanged(buffer, index, index + count - 1);
+}
+
+// count lines were inserted at index
+internal void linesInserted(Buffer *buffer, int index, int count) {
+    lineIndex_shift(buffer, index, count);
+    lexer_linesInserted(buffer, index, count);
+    bookmarks_linesInserted(buffer, index, count);
+    if (buf_len(buffer->braceDeltas) == buf_len(buffer->lines) - count) {
+        int amtToMove = buf_len(buffer->braceDeltas) - index;
+        buf_reserve(buffer->braceDeltas, count, BUF_GROW_HALF);
+        buf_add(buffer->braceDeltas, count);
+        memmove(&(buffer->braceDeltas[index + count]), &(buffer->braceDeltas[index]), amtToMove * sizeof(int));
+        memset(&(buffer->braceDeltas[index]), 0, count * sizeof(int));
+        buffer->braceTreeStale = true;
+        countBracesOfLines(buffer, index, count);
+    }
+    if (buffer->changedStart >= index)
+        buffer->changedStart += count;
+    if (buffer->changedEnd >= index)
+        buffer->changedEnd += count;
+    buffer->changedLineDelta += count;
+    buffer_markChanged(buffer, index, index + count - 1);
+}
+
+// count lines were removed starting at index
+internal void linesRemoved(Buffer *buffer, int index, int count) {
+    lineIndex_shift(buffer, index, -count);
+    lexer_linesRemoved(buffer, index, count);
+    bookmarks_linesRemoved(buffer, index, count);
+    if (buf_len(buffer->braceDeltas) == buf_len(buffer->lines) + count) {
+        int amtToMove = buf_len(buffer->braceDeltas) - (index + count);
+        memmove(&(buffer->braceDeltas[index]), &(buffer->braceDeltas[index + count]), amtToMove * sizeof(int));
+        buf__hdr(buffer->braceDeltas)->len -= count;
+        buffer->braceTreeStale = true;
+    }
+    if (buffer->changedStart >= index + count)
+        buffer->changedStart -= count;
+    else if (buffer->changedStart >= index)
+        buffer->changedStart = index;
+    if (buffer->changedEnd >= index + count)
+        buffer->changedEnd -= count;
+    else if (buffer->changedEnd >= index)
+        buffer->changedEnd = index;
+    buffer->changedLineDelta -= count;
+    // The line now at index (if any) has a different line before it
+    buffer_markChanged(buffer, index, index);
+}
+
+// -- Undo history --
+// Every change made through the buffer_* functions below is pushed onto the buffer's undo history as an
+// UndoRecord. Inserting and deleting lines only moves their Line structs between the buffer and the record
+// (the chars stay where they are), so undoing a big paste doesn't copy any text. Changes within a line keep
+// just the bytes between the common prefix and suffix of the old and new contents.
+// Each record's size counts the memory it owns, and when the history goes over undoBudget the oldest records
+// are forgotten.
+
+internal void freeUndoRecord(Buffer *buffer, UndoRecord *record) {
+    for (int i = 0; i < buf_len(record->lines); i++) {
+        freeLineChars(buffer, &(record->lines[i]));
+        buf_free(record->lines[i].tokens);
+    }
+    buf_free(record->lines);
+    xfree(record->bytes);
+    record->bytes = NULL;
+}
+
+internal size_t undoRecordSize(UndoRecord *record) {
+    size_t size = sizeof(UndoRecord) + (size_t) record->removedLength + (size_t) record->insertedLength;
+    if (record->lines != NULL)
+        size += buf_len(record->lines) * sizeof(Line) + record->charsSize;
+    return size;
+}
+
+internal void updateUndoRecordSize(Buffer *buffer, UndoRecord *record) {
+    buffer->undoBytes -= record->size;
+    record->size = undoRecordSize(record);
+    buffer->undoBytes += record->size;
+}
+
+// Also forgets the checkpoints, since they're places in the history
+void buffer_clearUndoHistory(Buffer *buffer) {
+    for (int i = 0; i < buf_len(buffer->undoHistory); i++) {
+        freeUndoRecord(buffer, &(buffer->undoHistory[i]));
+    }
+    buf_free(buffer->undoHistory);
+    buffer->undoPosition = 0;
+    buffer->undoBytes = 0;
+    buffer->undoBaseId = 0;
+    
+    for (int i = 0; i < buf_len(buffer->checkpoints); i++) {
+        buf_free(buffer->checkpoints[i].name);
+    }
+    buf_free(buffer->checkpoints);
+}
+
+// Forgets the oldest records until the history fits in the budget. The records that can be redone, and the
+// ones needed to get back to a checkpoint, are kept.
+internal void trimUndoHistory(Buffer *buffer) {
+    if (buffer->undoBytes <= undoBudget)
+        return;
+    
+    int keepFrom = buffer->undoPosition;
+    for (int i = 0; i < buf_len(buffer->checkpoints); i++) {
+        int position = buffer_checkpointPosition(buffer, &(buffer->checkpoints[i]));
+        if (position >= 0 && position < keepFrom)
+            keepFrom = position;
+    }
+    
+    int dropCount = 0;
+    while (buffer->undoBytes > undoBudget && dropCount < keepFrom) {
+        buffer->undoBytes -= buffer->undoHistory[dropCount].size;
+        freeUndoRecord(buffer, &(buffer->undoHistory[dropCount]));
+        ++dropCount;
+    }
+    if (dropCount == 0)
+        return;
+    
+    buffer->undoBaseId = buffer->undoHistory[dropCount - 1].id;
+    int amtToMove = buf_len(buffer->undoHistory) - dropCount;
+    memmove(buffer->undoHistory, &(buffer->undoHistory[dropCount]), amtToMove * sizeof(UndoRecord));
+    buf__hdr(buffer->undoHistory)->len -= dropCount;
+    buffer->undoPosition -= dropCount;
+}
+
+// Forgets the records that were undone
+void buffer_discardRedo(Buffer *buffer) {
+    for (int i = buffer->undoPosition; i < buf_len(buffer->undoHistory); i++) {
+        buffer->undoBytes -= buffer->undoHistory[i].size;
+        freeUndoRecord(buffer, &(buffer->undoHistory[i]));
+    }
+    if (buffer->undoHistory)
+        buf__hdr(buffer->undoHistory)->len = buffer->undoPosition;
+}
+
+// Replaces the undo history with records (a stretchy buffer), which the buffer takes over. Used when loading the undo log.
+void buffer_setUndoHistory(Buffer *buffer, UndoRecord *records, int position) {
+    buffer_clearUndoHistory(buffer);
+    buffer->undoHistory = records;
+    buffer->undoPosition = position;
+    for (int i = 0; i < buf_len(records); i++) {
+        records[i].id = buffer->nextUndoId++;
+        records[i].size = undoRecordSize(&(records[i]));
+        buffer->undoBytes += records[i].size;
+    }
+    trimUndoHistory(buffer);
+}
+
+// Id of the last record that was applied, which stands for the current state of the buffer
+internal uint32_t lastUndoId(Buffer *buffer) {
+    return (buffer->undoPosition > 0) ? buffer->undoHistory[buffer->undoPosition - 1].id : buffer->undoBaseId;
+}
+
+internal void pushUndoRecord(Buffer *buffer, UndoRecord record) {
+    // A new change, so the records that were undone can't be redone anymore
+    buffer_discardRedo(buffer);
+    
+    record.id = buffer->nextUndoId++;
+    record.size = undoRecordSize(&record);
+    buffer->undoBytes += record.size;
+    buf_push(buffer->undoHistory, record);
+    buffer->undoPosition = buf_len(buffer->undoHistory);
+    undoLog_recordPushed(buffer, &(buffer->undoHistory[buffer->undoPosition - 1]));
+    trimUndoHistory(buffer);
+}
+
+internal size_t charsSizeOfLines(Line *lines, int count) {
+    size_t size = 0;
+    for (int i = 0; i < count; i++) {
+        size += line_length(&(lines[i]));
+    }
+    return size;
+}
+
+// count lines were inserted at index
+internal void recordInsertedLines(Buffer *buffer, int index, int count) {
+    if (count <= 0)
+        return;
+    UndoRecord record = {0};
+    record.kind = UNDO_INSERT_LINES;
+    record.index = index;
+    record.count = count;
+    record.charsSize = charsSizeOfLines(&(buffer->lines[index]), count);
+    pushUndoRecord(buffer, record);
+}
+
+// The lines were removed from the buffer at index. The record takes them over.
+internal void recordDeletedLines(Buffer *buffer, int index, Line *lines, int count) {
+    if (count <= 0)
+        return;
+    UndoRecord record = {0};
+    record.kind = UNDO_DELETE_LINES;
+    record.index = index;
+    record.count = count;
+    memcpy(buf_add(record.lines, count), lines, count * sizeof(Line));
+    record.charsSize = charsSizeOfLines(lines, count);
+    pushUndoRecord(buffer, record);
+}
+
+// The line at index changed from the before chars to what it has now. before is freed.
+internal void recordChangedLine(Buffer *buffer, int index, char *before) {
+    char *after = line_chars(&(buffer->lines[index]));
+    int beforeLength = buf_len(before);
+    int afterLength = line_length(&(buffer->lines[index]));
+    
+    int prefix = 0;
+    while (prefix < beforeLength && prefix < afterLength && before[prefix] == after[prefix])
+        ++prefix;
+    int suffix = 0;
+    while (suffix < beforeLength - prefix && suffix < afterLength - prefix
+           && before[beforeLength - 1 - suffix] == after[afterLength - 1 - suffix])
+        ++suffix;
+    
+    UndoRecord record = {0};
+    record.kind = UNDO_CHANGE_LINE;
+    record.index = index;
+    record.start = prefix;
+    record.removedLength = beforeLength - prefix - suffix;
+    record.insertedLength = afterLength - prefix - suffix;
+    if (record.removedLength + record.insertedLength > 0) {
+        record.bytes = xmalloc(record.removedLength + record.insertedLength);
+        memcpy(record.bytes, &before[prefix], record.removedLength);
+        memcpy(&record.bytes[record.removedLength], &after[prefix], record.insertedLength);
+    }
+    buf_free(before);
+    
+    if (record.removedLength + record.insertedLength > 0)
+        pushUndoRecord(buffer, record);
+}
+
+// Moves the record's lines back into the buffer
+internal void putBackRecordLines(Buffer *buffer, UndoRecord *record) {
+    int amtToMove = buf_len(buffer->lines) - record->index;
+    buf_reserve(buffer->lines, record->count, BUF_GROW_HALF);
+    buf_add(buffer->lines, record->count);
+    memmove(&(buffer->lines[record->index + record->count]), &(buffer->lines[record->index]), amtToMove * sizeof(Line));
+    memcpy(&(buffer->lines[record->index]), record->lines, record->count * sizeof(Line));
+    buf_free(record->lines);
+    linesInserted(buffer, record->index, record->count);
+    updateUndoRecordSize(buffer, record);
+}
+
+// Moves the lines of the record out of the buffer and into the record
+internal void takeRecordLines(Buffer *buffer, UndoRecord *record) {
+    memcpy(buf_add(record->lines, record->count), &(buffer->lines[record->index]), record->count * sizeof(Line));
+    int amtToMove = buf_len(buffer->lines) - (record->index + record->count);
+    memmove(&(buffer->lines[record->index]), &(buffer->lines[record->index + record->count]), amtToMove * sizeof(Line));
+    buf__hdr(buffer->lines)->len -= record->count;
+    linesRemoved(buffer, record->index, record->count);
+    updateUndoRecordSize(buffer, record);
+}
+
+// Replaces removeLength bytes at start in the line at index with insert
+internal void spliceLine(Buffer *buffer, int index, int start, int removeLength, const char *insert, int insertLength) {
+    Line *line = &(buffer->lines[index]);
+    int length = line_length(line);
+    int amtToMove = length - (start + removeLength);
+    int addedAmt = insertLength - removeLength;
+    if (addedAmt > 0)
+        resizeLine(buffer, line, length + addedAmt);
+    char *chars = line_chars(line);
+    if (chars == NULL)
+        return;
+    memmove(&chars[start + insertLength], &chars[start + removeLength], amtToMove);
+    memcpy(&chars[start], insert, insertLength);
+    if (addedAmt < 0)
+        resizeLine(buffer, line, length + addedAmt);
+    linesChanged(buffer, index, 1);
+}
+
+internal void swapLines(Buffer *buffer, int index) {
+    Line tmp = buffer->lines[index];
+    buffer->lines[index] = buffer->lines[index + 1];
+    buffer->lines[index + 1] = tmp;
+    linesChanged(buffer, index, 2);
+    lineIndex_moved(buffer, index, 2);
+}
+
+// Undoes the last change that hasn't been undone. Returns false if there's nothing to undo.
+bool buffer_undo(Buffer *buffer) {
+    if (buffer->undoPosition == 0)
+        return false;
+    UndoRecord *record = &(buffer->undoHistory[--buffer->undoPosition]);
+    
+    switch (record->kind) {
+        case UNDO_INSERT_LINES:
+        takeRecordLines(buffer, record);
+        buffer->currentLine = record->index;
+        break;
+        case UNDO_DELETE_LINES:
+        putBackRecordLines(buffer, record);
+        buffer->currentLine = record->index + record->count;
+        break;
+        case UNDO_CHANGE_LINE:
+        spliceLine(buffer, record->index, record->start, record->insertedLength, record->bytes, record->removedLength);
+        buffer->currentLine = record->index + 1;
+        break;
+        case UNDO_SWAP_LINES:
+        swapLines(buffer, record->index);
+        buffer->currentLine = record->index + 1;
+        break;
+    }
+    
+    if (buffer->currentLine > buf_len(buffer->lines))
+        buffer->currentLine = buf_len(buffer->lines);
+    // Back to the state the file was saved in, the buffer matches it again
+    buffer->modified = (lastUndoId(buffer) != buffer->savedUndoId);
+    undoLog_undone(buffer, record);
+    return true;
+}
+
+// Redoes the last change that was undone. Returns false if there's nothing to redo.
+bool buffer_redo(Buffer *buffer) {
+    if (buffer->undoPosition == buf_len(buffer->undoHistory))
+        return false;
+    UndoRecord *record = &(buffer->undoHistory[buffer->undoPosition++]);
+    
+    switch (record->kind) {
+        case UNDO_INSERT_LINES:
+        putBackRecordLines(buffer, record);
+        buffer->currentLine = record->index + record->count;
+        break;
+        case UNDO_DELETE_LINES:
+        takeRecordLines(buffer, record);
+        buffer->currentLine = record->index + 1;
+        break;
+        case UNDO_CHANGE_LINE:
+        spliceLine(buffer, record->index, record->start, record->removedLength, &(record->bytes[record->removedLength]), record->insertedLength);
+        buffer->currentLine = record->index + 1;
+        break;
+        case UNDO_SWAP_LINES:
+        swapLines(buffer, record->index);
+        buffer->currentLine = record->index + 2;
+        break;
+    }
+    
+    if (buffer->currentLine > buf_len(buffer->lines))
+        buffer->currentLine = buf_len(buffer->lines);
+    buffer->modified = (lastUndoId(buffer) != buffer->savedUndoId);
+    undoLog_redone(buffer);
+    trimUndoHistory(buffer);
+    return true;
+}
+
+// -- Checkpoints --
+// A checkpoint is the id of the last record that was applied when it was made. Ids only increase along the
+// history, so its position is found with a binary search. If that record isn't in the history anymore
+// (the changes after it were undone and replaced with new ones), the checkpoint can't be restored.
+
+Checkpoint *buffer_findCheckpoint(Buffer *buffer, char *name, int length) {
+    for (int i = 0; i < buf_len(buffer->checkpoints); i++) {
+        Checkpoint *checkpoint = &(buffer->checkpoints[i]);
+        if (buf_len(checkpoint->name) == length && memcmp(checkpoint->name, name, length) == 0)
+            return checkpoint;
+    }
+    return NULL;
+}
+
+// Makes (or moves) the checkpoint with the name at the current state of the buffer
+void buffer_setCheckpoint(Buffer *buffer, char *name, int length) {
+    Checkpoint *checkpoint = buffer_findCheckpoint(buffer, name, length);
+    if (checkpoint == NULL) {
+        Checkpoint newCheckpoint = {0};
+        memcpy(buf_add(newCheckpoint.name, length), name, length);
+        buf_push(buffer->checkpoints, newCheckpoint);
+        checkpoint = buf_end(buffer->checkpoints) - 1;
+    }
+    checkpoint->lastId = lastUndoId(buffer);
+}
+
+void buffer_forgetCheckpoint(Buffer *buffer, Checkpoint *checkpoint) {
+    buf_free(checkpoint->name);
+    int amtToMove = buf_end(buffer->checkpoints) - (checkpoint + 1);
+    memmove(checkpoint, checkpoint + 1, amtToMove * sizeof(Checkpoint));
+    buf__hdr(buffer->checkpoints)->len -= 1;
+    // The records it kept can be forgotten now
+    trimUndoHistory(buffer);
+}
+
+// Returns the undoPosition the buffer has at the checkpoint, or -1 if it's not in the history anymore
+int buffer_checkpointPosition(Buffer *buffer, Checkpoint *checkpoint) {
+    // The first record after the checkpoint
+    int low = 0;
+    int high = buf_len(buffer->undoHistory);
+    while (low < high) {
+        int middle = low + (high - low) / 2;
+        if (buffer->undoHistory[middle].id <= checkpoint->lastId)
+            low = middle + 1;
+        else high = middle;
+    }
+    
+    uint32_t idBefore = (low > 0) ? buffer->undoHistory[low - 1].id : buffer->undoBaseId;
+    return (idBefore == checkpoint->lastId) ? low : -1;
+}
+
+// Undoes or redoes the changes between the current state and the checkpoint.
+// Returns how many changes that was, or -1 if the checkpoint can't be restored.
+int buffer_restoreCheckpoint(Buffer *buffer, Checkpoint *checkpoint) {
+    int changes = 0;
+    while (true) {
+        // Redoing can forget records from the front of the history, so the position is found again each time
+        int position = buffer_checkpointPosition(buffer, checkpoint);
+        if (position < 0)
+            return (changes > 0) ? changes : -1;
+        
+        if (position < buffer->undoPosition) {
+            buffer_undo(buffer);
+        } else if (position > buffer->undoPosition) {
+            buffer_redo(buffer);
+        } else break;
+        ++changes;
+    }
+    return changes;
+}
+
+// Hash of the contents of all of the lines
+uint64_t buffer_contentHash(Buffer *buffer) {
+    uint64_t hash = hash_uint64(buf_len(buffer->lines) + 1);
+    for (int i = 0; i < buf_len(buffer->lines); i++)
+        hash = hash_mix(hash, hash_bytes(line_chars(&(buffer->lines[i])), line_length(&(buffer->lines[i]))));
+    return hash;
+}
+
+BufferMemory buffer_memoryUsage(Buffer *buffer) {
+    BufferMemory memory = {0};
+    // Pooled chars are always allocated from full-size arena blocks
+    memory.lines = buf_memory(buffer->lines) + buf_len(buffer->linePool.slabs.blocks) * ARENA_BLOCK_SIZE + buf_memory(buffer->linePool.slabs.blocks);
+    for (int i = 0; i < buf_len(buffer->lines); i++) {
+        if (buffer->lines[i].charsClass == LINE_CHARS_HEAP)
+            memory.lines += buf_memory(buffer->lines[i].text.chars);
+        memory.tokens += buf_memory(buffer->lines[i].tokens);
+    }
+    memory.outline = buf_memory(buffer->outline) + swissmap_memory(&buffer->symbolIndex) + buf_memory(buffer->symbolNext);
+    memory.bookmarks = buf_memory(buffer->bookmarks) + swissmap_memory(&buffer->bookmarkIndex)
+        + buf_memory(buffer->bookmarkEndpoints) + buf_memory(buffer->bookmarkShifts);
+    memory.undo = buffer->undoBytes + buf_memory(buffer->checkpoints);
+    for (int i = 0; i < buf_len(buffer->checkpoints); i++)
+        memory.undo += buf_memory(buffer->checkpoints[i].name);
+    memory.indexes = map_memory(&buffer->lineIndex) + buf_memory(buffer->lineShifts) + buf_memory(buffer->braceDeltas) + buf_memory(buffer->braceTree);
+    memory.total = memory.lines + memory.tokens + memory.outline + memory.bookmarks + memory.undo + memory.indexes;
+    return memory;
+}
+
+// -- Compaction --
+// Stretchy buffers never shrink on their own, and pool blocks that are freed are only reused for other lines, so a
+// buffer that had a lot of its lines deleted (or their undo records forgotten) keeps holding on to their memory.
+// Compacting copies the chars of the lines into a new pool and gives back what the arrays that grow with the
+// lines aren't using.
+
+// Moves the line's chars into the buffer's new pool, or trims them if they're too long for it
+internal void compactLineChars(Buffer *buffer, Line *line) {
+    if (line_isInline(line))
+        return;
+    if (line->charsClass == LINE_CHARS_HEAP) {
+        adoptLineChars(buffer, line);
+        if (line->charsClass == LINE_CHARS_HEAP)
+            buf_shrink(line->text.chars);
+        return;
+    }
+    char *chars = line->text.chars; // Still in the old pool
+    setLineChars(buffer, line, chars, buf_len(chars));
+}
+
+// Returns how many bytes were given back
+size_t buffer_compact(Buffer *buffer) {
+    BufferMemory before = buffer_memoryUsage(buffer);
+    
+    LinePool oldPool = buffer->linePool;
+    buffer->linePool = (LinePool) {0};
+    for (int i = 0; i < buf_len(buffer->lines); i++) {
+        compactLineChars(buffer, &(buffer->lines[i]));
+        buf_shrink(buffer->lines[i].tokens);
+    }
+    // Lines that were deleted are kept by their undo records
+    for (int i = 0; i < buf_len(buffer->undoHistory); i++) {
+        UndoRecord *record = &(buffer->undoHistory[i]);
+        for (int j = 0; j < buf_len(record->lines); j++) {
+            compactLineChars(buffer, &(record->lines[j]));
+            buf_shrink(record->lines[j].tokens);
+        }
+    }
+    arena_free(&oldPool.slabs);
+    
+    buf_shrink(buffer->lines);
+    buf_shrink(buffer->braceDeltas);
+    buf_shrink(buffer->braceTree);
+    buf_shrink(buffer->outline);
+    buf_shrink(buffer->symbolNext);
+    buf_shrink(buffer->undoHistory);
+    buf_shrink(buffer->lineShifts);
+    
+    BufferMemory after = buffer_memoryUsage(buffer);
+    return before.total > after.total ? before.total - after.total : 0;
+}
+
+// Compacts the buffer if at least half of its line pool or lines array isn't being used. Only looks at a few
+// numbers, so it can be done after every command.
+void buffer_compactIfWasteful(Buffer *buffer) {
+    size_t poolBytes = buf_len(buffer->linePool.slabs.blocks) * ARENA_BLOCK_SIZE;
+    size_t linesBytes = buf_cap(buffer->lines) * sizeof(Line);
+    if (poolBytes + linesBytes < COMPACT_MIN_BYTES)
+        return;
+    if (buffer->linePool.freeBytes > poolBytes / 2 || buf_len(buffer->lines) < buf_cap(buffer->lines) / 2)
+        buffer_compact(buffer);
+}
+
+// Gives each line that doesn't have an id yet a new one. Called for lines as they're added to the buffer.
+void buffer_assignLineIds(Buffer *buffer, Line *lines, int count) {
+    for (int i = 0; i < count; i++) {
+        if (lines[i].id == 0)
+            lines[i].id = buffer->nextLineId++;
+    }
+}
+
+// Index starts at 0
+LineAnchor buffer_anchorLine(Buffer *buffer, int index) {
+    LineAnchor anchor = {0};
+    if (index < 0 || index >= buf_len(buffer->lines))
+        return anchor;
+    anchor.id = buffer->lines[index].id;
+    anchor.hint = index;
+    return anchor;
+}
+
+// Returns the current index (starting at 0) of the anchored line, or -1 if the line was deleted.
+// The hint is checked first. If it's stale, the line id index is used (built the first time it's needed, and kept
+// up to date after that, see lineIndex_find) and the hint is updated.
+int buffer_resolveAnchor(Buffer *buffer, LineAnchor *anchor) {
+    if (anchor->id == 0)
+        return -1;
+    
+    int hint = anchor->hint;
+    if (hint >= 0 && hint < buf_len(buffer->lines) && buffer->lines[hint].id == anchor->id)
+        return hint;
+    
+    if (buffer->lineIndex.cap == 0) {
+        size_t cap = 16;
+        while (cap <= 2 * buf_len(buffer->lines))
+            cap *= 2;
+        map_grow(&buffer->lineIndex, cap);
+        buf_free(buffer->lineShifts);
+        lineIndex_put(buffer, 0, buf_len(buffer->lines));
+    }
+    
+    int index = lineIndex_find(buffer, anchor->id);
+    if (index < 0)
+        return -1;
+    
+    anchor->hint = index;
+    return index;
 }
 
 // If openedFilename is not set in the buffer, then filename is used.
@@ -158,65 +1121,44 @@ void buffer_saveFile(Buffer *buffer, char *filename) {
             buf_push(buffer->openedFilename, filename[i]);
         }
         
-        // Find last occurance of '.' in filename
-        int dotIndex;
-        for (int i = 0; i < strlen(filename); i++) {
-            if (filename[i] == '.') {
-                dotIndex = i;
-            }
-        }
-        
-        // Determine filetype based on extension
-        // TODO: Doesn't handle CPP files yet.
-        FileType ft;
-        switch (filename[dotIndex + 1])
-        {
-            case 't':
-            ft = FT_TEXT;
-            break;
-            case 'm':
-            ft = FT_MARKDOWN;
-            break;
-            case 'c':
-            ft = FT_C;
-            break;
-            case 'h':
-            ft = FT_C_HEADER;
-            break;
-            default:
-            ft = FT_UNKNOWN;
-            break;
-        }
-        if (ft != FT_UNKNOWN) {
-            int isType = true;
-            char *ftExt;
-            getFileTypeExtension(ft, &ftExt);
-            for (int i = dotIndex + 1; i < strlen(filename); i++) {
-                if (filename[i] != ftExt[i - dotIndex - 1]) {
-                    isType = false;
-                    break;
-                }
-            }
-            
-            if (isType) {
-                buffer->fileType = ft;
-            } else {
-                buffer->fileType = FT_UNKNOWN;
-            }
-            free(ftExt);
-        }
+        buffer->fileType = buffer_fileTypeFromFilename(filename);
     }
     
     // Write the characters out to the file
     for (int line = 0; line < buf_len(buffer->lines); line++) {
-        for (int i = 0; i < buf_len(buffer->lines[line].chars); i++) {
-            fprintf(fp, "%c", buffer->lines[line].chars[i]);
+        char *chars = line_chars(&(buffer->lines[line]));
+        for (int i = 0; i < line_length(&(buffer->lines[line])); i++) {
+            fprintf(fp, "%c", chars[i]);
         }
     }
     
     buffer->modified = false;
+    buffer->savedUndoId = lastUndoId(buffer);
     
     fclose(fp);
+    
+    undoLog_saved(buffer);
+}
+
+// Splits text into lines (each keeping its '\n') and pushes them onto lines, ready to be inserted into the buffer.
+// Their chars are put straight into the buffer's line storage, so a big paste doesn't take an allocation per line.
+void buffer_splitLines(Buffer *buffer, const char *text, size_t length, Line **lines) {
+    const char *start = text;
+    const char *end = text + length;
+    while (start < end) {
+        const char *newline = memchr(start, '\n', end - start);
+        const char *stop = newline ? newline + 1 : end;
+        Line line = {0};
+        setLineChars(buffer, &line, start, stop - start);
+        buf_push(*lines, line);
+        start = stop;
+    }
+}
+
+// Frees the chars of lines that were never inserted into the buffer. The lines buffer isn't freed.
+void buffer_releaseLines(Buffer *buffer, Line *lines) {
+    for (int i = 0; i < buf_len(lines); i++)
+        freeLineChars(buffer, &lines[i]);
 }
 
 // The lines buffer isn't freed.
@@ -231,6 +1173,7 @@ int buffer_insertAfterLine(Buffer *buffer, int line, Line *lines) {
     int amtToMove = buf_len(buffer->lines) - line;
     
     // Add space for the new lines into the buffer
+    buf_reserve(buffer->lines, linesAddedAmt, BUF_GROW_HALF);
     buf_add(buffer->lines, linesAddedAmt);
     
     // Move the lines after the line inserting after up by how many lines were inserted // TODO: Make this message clearer
@@ -243,6 +1186,11 @@ int buffer_insertAfterLine(Buffer *buffer, int line, Line *lines) {
     Line *copyDestination = moveSource;
     size_t copyAmt = linesAddedAmt * sizeof(Line);
     memcpy(copyDestination, copySource, copyAmt);
+    for (int i = 0; i < linesAddedAmt; i++)
+        adoptLineChars(buffer, &copyDestination[i]);
+    buffer_assignLineIds(buffer, copyDestination, linesAddedAmt);
+    linesInserted(buffer, lineToInsertAfter, linesAddedAmt);
+    recordInsertedLines(buffer, lineToInsertAfter, linesAddedAmt);
     
     // Set cursor to the last line that was inserted
     buffer->modified = true;
@@ -266,6 +1214,7 @@ int buffer_insertBeforeLine(Buffer *buffer, int line, Line *lines) {
     int amtToMove = buf_len(buffer->lines) - (line - 1);
     
     // Add space for the new lines into the buffer
+    buf_reserve(buffer->lines, linesAddedAmt, BUF_GROW_HALF);
     buf_add(buffer->lines, linesAddedAmt);
     
     // Move the lines after the passed in line (and including it) up by how many lines are being inserted before
@@ -278,6 +1227,11 @@ int buffer_insertBeforeLine(Buffer *buffer, int line, Line *lines) {
     Line *copyDestination = moveSource;
     size_t copyAmt = linesAddedAmt * sizeof(Line);
     memcpy(copyDestination, copySource, copyAmt);
+    for (int i = 0; i < linesAddedAmt; i++)
+        adoptLineChars(buffer, &copyDestination[i]);
+    buffer_assignLineIds(buffer, copyDestination, linesAddedAmt);
+    linesInserted(buffer, lineToInsertBefore - 1, linesAddedAmt);
+    recordInsertedLines(buffer, lineToInsertBefore - 1, linesAddedAmt);
     
     // Set the current line to the line that the lines were inserted before
     buffer->modified = true;
@@ -296,13 +1250,20 @@ void buffer_appendToLine(Buffer *buffer, int line, char *chars) {
         if (lineToAppendTo == 0)
             return;
     }
+    Line *target = &(buffer->lines[lineToAppendTo - 1]);
+    char *before = copyLine(target);
+    
     // Remove the new line character from the line
-    buf_pop(buffer->lines[lineToAppendTo - 1].chars);
+    size_t length = line_length(target);
+    if (length > 0)
+        --length;
     
-    // Copy from the passed-in chars buffer to the line's chars buffer
+    // Copy from the passed-in chars buffer to the end of the line
     size_t num = buf_len(chars);
-    char *destination = buf_add(buffer->lines[lineToAppendTo - 1].chars, num);
-    strncpy(destination, chars, num);
+    resizeLine(buffer, target, length + num);
+    memcpy(&(line_chars(target)[length]), chars, num);
+    linesChanged(buffer, lineToAppendTo - 1, 1);
+    recordChangedLine(buffer, lineToAppendTo - 1, before);
     
     buffer->modified = true;
     buffer->currentLine = lineToAppendTo;
@@ -318,19 +1279,21 @@ void buffer_prependToLine(Buffer *buffer, int line, char *chars) {
             return;
     }
     
-    // Store the old buffer
-    char *oldBuffer = buffer->lines[lineToPrependTo - 1].chars;
-    
-    // Set the line to the new buffer passed in
-    buffer->lines[lineToPrependTo - 1].chars = chars;
+    Line *target = &(buffer->lines[lineToPrependTo - 1]);
+    char *before = copyLine(target);
     
-    // Push onto the buffer the chars of the old buffer
-    size_t num = buf_len(oldBuffer);
-    char *destination = buf_add(buffer->lines[lineToPrependTo - 1].chars, num);
-    strncpy(destination, oldBuffer, num);
+    // Push onto the passed-in buffer the chars of the line, then use it in place of them
+    size_t num = line_length(target);
+    if (num > 0)
+        memcpy(buf_add(chars, num), line_chars(target), num);
+    freeLineChars(buffer, target);
+    target->text.chars = chars;
+    target->charsClass = LINE_CHARS_HEAP;
+    adoptLineChars(buffer, target);
     
-    // Free the old buffer
-    buf_free(oldBuffer);
+    // The record frees the copy of the old chars
+    linesChanged(buffer, lineToPrependTo - 1, 1);
+    recordChangedLine(buffer, lineToPrependTo - 1, before);
     
     buffer->modified = true;
     buffer->currentLine = lineToPrependTo;
@@ -346,11 +1309,17 @@ void buffer_replaceLine(Buffer *buffer, int line, char *chars) {
             return;
     }
     
-    // Free the old buffer
-    buf_free(buffer->lines[lineToReplace - 1].chars);
+    // The record frees the copy of the old chars
+    Line *target = &(buffer->lines[lineToReplace - 1]);
+    char *before = copyLine(target);
     
     // Set the line to the new buffer passed in
-    buffer->lines[lineToReplace - 1].chars = chars;
+    freeLineChars(buffer, target);
+    target->text.chars = chars;
+    target->charsClass = LINE_CHARS_HEAP;
+    adoptLineChars(buffer, target);
+    linesChanged(buffer, lineToReplace - 1, 1);
+    recordChangedLine(buffer, lineToReplace - 1, before);
     
     buffer->modified = true;
     buffer->currentLine = lineToReplace;
@@ -365,30 +1334,34 @@ void buffer_replaceInLine(Buffer *buffer, int line, int startIndex, int endIndex
             return;
     }
     
+    Line *target = &(buffer->lines[lineToReplaceIn - 1]);
+    char *before = copyLine(target);
+    
+    int length = line_length(target);
     int lengthOfStringToReplace = endIndex - startIndex;
     int addedAmt = buf_len(chars) - lengthOfStringToReplace - 1;
-    int amtToMove = buf_len(buffer->lines[lineToReplaceIn - 1].chars) - endIndex;
+    int amtToMove = length - (endIndex + 1);
     
-    // If replacement string is bigger than string to replace, add characters to the buffer. Otherwise, if replacement string is smaller, pop off the correct amount
+    // If replacement string is bigger than string to replace, make room for it first. Otherwise, if replacement string is smaller, the line is shortened after the characters are moved.
     if (addedAmt > 0)
-        buf_add(buffer->lines[lineToReplaceIn - 1].chars, addedAmt);
-    else if (addedAmt < 0) {
-        for (int i = addedAmt; i < 0; i++) {
-            buf_pop(buffer->lines[lineToReplaceIn - 1].chars);
-        }
-    }
+        resizeLine(buffer, target, length + addedAmt);
     
     // Move over the characters due to the replacement string being bigger/smaller than the string being replaced
-    char *moveSource = &(buffer->lines[lineToReplaceIn - 1].chars[endIndex + 1]);
-    char *moveDestination = &(buffer->lines[lineToReplaceIn - 1].chars[endIndex + 1 + addedAmt]);
+    char *lineChars = line_chars(target);
+    char *moveSource = &(lineChars[endIndex + 1]);
+    char *moveDestination = &(lineChars[endIndex + 1 + addedAmt]);
     size_t bytes = sizeof(char) * amtToMove;
     memmove(moveDestination, moveSource, bytes);
     
     // Copy over the replacement string
     char *source = chars;
-    char *destination = &(buffer->lines[lineToReplaceIn - 1].chars[startIndex]);
+    char *destination = &(lineChars[startIndex]);
     size_t copyAmt = buf_len(chars) * sizeof(char);
     memcpy(destination, source, copyAmt);
+    if (addedAmt < 0)
+        resizeLine(buffer, target, length + addedAmt);
+    linesChanged(buffer, lineToReplaceIn - 1, 1);
+    recordChangedLine(buffer, lineToReplaceIn - 1, before);
     
     buffer->modified = true;
     buffer->currentLine = lineToReplaceIn;
@@ -412,6 +1385,11 @@ void buffer_moveLineUp(Buffer *buffer, int line) {
     // Set the old position to the line stored in tmp (the line that's moved down)
     buffer->lines[lineToMove - 1] = tmp;
     
+    // The lines swapped places, so the states they were lexed with no longer line up
+    linesChanged(buffer, lineToMove - 2, 2);
+    lineIndex_moved(buffer, lineToMove - 2, 2);
+    pushUndoRecord(buffer, (UndoRecord) { .kind = UNDO_SWAP_LINES, .index = lineToMove - 2 });
+    
     // Set the currentLine to the new position of the line that was moved up
     buffer->modified = true;
     buffer->currentLine = lineToMove - 1;
@@ -435,6 +1413,11 @@ void buffer_moveLineDown(Buffer *buffer, int line) {
     // Set the old position to the line stored in tmp (the line that's moved up)
     buffer->lines[lineToMove - 1] = tmp;
     
+    // The lines swapped places, so the states they were lexed with no longer line up
+    linesChanged(buffer, lineToMove - 1, 2);
+    lineIndex_moved(buffer, lineToMove - 1, 2);
+    pushUndoRecord(buffer, (UndoRecord) { .kind = UNDO_SWAP_LINES, .index = lineToMove - 1 });
+    
     // Set the currentLine to the new position of the line that was moved down
     buffer->modified = true;
     buffer->currentLine = lineToMove + 1;
@@ -448,13 +1431,12 @@ void buffer_deleteLine(Buffer *buffer, int line) {
             return;
     }
     
+    // The undo history keeps the deleted line
+    Line deleted = buffer->lines[lineToDelete - 1];
+    
     if (lineToDelete == buf_len(buffer->lines)) {
-        buf_free(buffer->lines[buf_len(buffer->lines) - 1].chars);
         buf_pop(buffer->lines);
     } else {
-        // Delete the char buffer of the line that's being deleted
-        buf_free(buffer->lines[lineToDelete - 1].chars);
-        
         // Move all lines down one
         void *source = &(buffer->lines[lineToDelete - 1 + 1]);
         void *destination = &(buffer->lines[lineToDelete - 1]);
@@ -465,6 +1447,9 @@ void buffer_deleteLine(Buffer *buffer, int line) {
         buf_pop(buffer->lines);
     }
     
+    linesRemoved(buffer, lineToDelete - 1, 1);
+    recordDeletedLines(buffer, lineToDelete - 1, &deleted, 1);
+    
     // Set the cursor the the line that was deleted
     buffer->modified = true;
     if (lineToDelete > buf_len(buffer->lines))
@@ -485,8 +1470,9 @@ int buffer_findStringInLine(Buffer *buffer, int line, char *str, int strLength)
     int index = -1; // Column index
     int ii = 0;
     
-    for (int i = 0; i < buf_len(buffer->lines[lineToSearch - 1].chars); i++) {
-        if (buffer->lines[lineToSearch - 1].chars[i] == str[ii]) {
+    char *chars = line_chars(&(buffer->lines[lineToSearch - 1]));
+    for (int i = 0; i < line_length(&(buffer->lines[lineToSearch - 1])); i++) {
+        if (chars[i] == str[ii]) {
             if (ii == 0)
                 index = i;
             ++ii;
@@ -1,10 +1,102 @@
 #ifdef _WIN32
 #include <windows.h>
 #include <Wincon.h>
+#else
+#include <errno.h>
 #endif
 
 #include "edimcoder.h"
 
+// -- Output frames --
+// Printing a page of lines a character at a time is a syscall (and a stdout lock) per character, which is slow over
+// a remote connection. While a frame is open, everything printed through the output functions is collected here
+// instead, and written with one write when the outermost frame ends.
+internal char *outputFrame; // Stretchy buffer
+internal int outputFrameDepth;
+
+void output_beginFrame(void) {
+    ++outputFrameDepth;
+}
+
+void output_endFrame(void) {
+    assert(outputFrameDepth > 0);
+    if (--outputFrameDepth == 0)
+        output_flush();
+}
+
+// Writes out what the frame has so far. The frame stays open.
+void output_flush(void) {
+    if (buf_len(outputFrame) == 0)
+        return;
+    // Anything printed before the frame is still in stdout's buffer
+    fflush(stdout);
+#ifdef _WIN32
+    fwrite(outputFrame, 1, buf_len(outputFrame), stdout);
+    fflush(stdout);
+#else
+    size_t written = 0;
+    while (written < buf_len(outputFrame)) {
+        ssize_t result = write(STDOUT_FILENO, outputFrame + written, buf_len(outputFrame) - written);
+        if (result < 0) {
+            if (errno == EINTR)
+                continue;
+            break;
+        }
+        written += (size_t) result;
+    }
+#endif
+    buf_pop_all(outputFrame);
+}
+
+void output_write(const char *chars, size_t length) {
+    if (outputFrameDepth == 0) {
+        fwrite(chars, 1, length, stdout);
+        return;
+    }
+    memcpy(buf_add(outputFrame, length), chars, length);
+}
+
+void output_string(const char *str) {
+    output_write(str, strlen(str));
+}
+
+void output_char(char c) {
+    if (outputFrameDepth == 0) {
+        putchar(c);
+        return;
+    }
+    buf_push(outputFrame, c);
+}
+
+void output_vprintf(const char *fmt, va_list args) {
+    if (outputFrameDepth == 0) {
+        vprintf(fmt, args);
+        return;
+    }
+    char small[256];
+    va_list copy;
+    va_copy(copy, args);
+    int length = vsnprintf(small, sizeof(small), fmt, copy);
+    va_end(copy);
+    if (length <= 0)
+        return;
+    if ((size_t) length < sizeof(small)) {
+        output_write(small, (size_t) length);
+        return;
+    }
+    // Too long for the stack buffer, print it straight into the frame (vsnprintf needs room for the terminator)
+    buf_reserve(outputFrame, (size_t) length + 1, BUF_GROW_DOUBLE);
+    vsnprintf(buf_end(outputFrame), (size_t) length + 1, fmt, args);
+    buf__hdr(outputFrame)->len += length;
+}
+
+void output_printf(const char *fmt, ...) {
+    va_list args;
+    va_start(args, fmt);
+    output_vprintf(fmt, args);
+    va_end(args);
+}
+
 void setColor(COLOR foreground)
 {
 #ifdef _WIN32
@@ -43,37 +135,39 @@ void setColor(COLOR foreground)
         printf("ERROR: Wrong Color - Windows\n");
         return;
     }
+    // The console's color applies to what's written after it changes, so what the frame has so far goes out first
+    output_flush();
     SetConsoleTextAttribute(hConsole, win32foreground);
 #else
     switch (foreground)
     {
         case COLOR_RED:
         {
-            printf(COL_RED);
+            output_string(COL_RED);
         } break;
         case COLOR_GREEN:
         {
-            printf(COL_GREEN);
+            output_string(COL_GREEN);
         } break;
         case COLOR_BLUE:
         {
-            printf(COL_BLUE);
+            output_string(COL_BLUE);
         } break;
         case COLOR_YELLOW:
         {
-            printf(COL_YELLOW);
+            output_string(COL_YELLOW);
         } break;
         case COLOR_CYAN:
         {
-            printf(COL_CYAN);
+            output_string(COL_CYAN);
         } break;
         case COLOR_MAGENTA:
         {
-            printf(COL_MAGENTA);
+            output_string(COL_MAGENTA);
         } break;
         case COLOR_WHITE:
         {
-            printf(COL_RESET);
+            output_string(COL_RESET);
         } break;
         default:
         printf("ERROR: Wrong Color - Unix\n");
@@ -85,9 +179,10 @@ void setColor(COLOR foreground)
 void resetColor(void)
 {
 #ifdef _WIN32
+    output_flush();
     SetConsoleTextAttribute(hConsole, FOREGROUND_WHITE);
 #else
-    printf(COL_RESET);
+    output_string(COL_RESET);
 #endif
 }
 
@@ -97,7 +192,7 @@ void colors_printf(COLOR foreground, const char *fmt, ...)
     
     va_list args;
     va_start(args, fmt);
-    vprintf(fmt, args);
+    output_vprintf(fmt, args);
     va_end(args);
     
     resetColor();
@@ -109,12 +204,12 @@ void colors_puts(COLOR foreground, const char *fmt, ...)
     
     va_list args;
     va_start(args, fmt);
-    vprintf(fmt, args);
+    output_vprintf(fmt, args);
     va_end(args);
     
     resetColor();
     
-    printf("\n");
+    output_write("\n", 1);
 }
 
 void printError(const char *fmt, ...)
@@ -123,7 +218,7 @@ void printError(const char *fmt, ...)
     
     va_list args;
     va_start(args, fmt);
-    vprintf(fmt, args);
+    output_vprintf(fmt, args);
     va_end(args);
     
     resetColor();
@@ -135,7 +230,7 @@ void printPrompt(const char *fmt, ...)
     
     va_list args;
     va_start(args, fmt);
-    vprintf(fmt, args);
+    output_vprintf(fmt, args);
     va_end(args);
     
     resetColor();
@@ -147,7 +242,7 @@ void printLineNumber(const char *fmt, ...)
     
     va_list args;
     va_start(args, fmt);
-    vprintf(fmt, args);
+    output_vprintf(fmt, args);
     va_end(args);
     
     resetColor();
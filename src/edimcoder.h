@@ -27,10 +27,17 @@ void clrscr();
 #include <conio.h>
 #define getch _getch
 #define kbhit _kbhit
+#define terminal_begin()
+#define terminal_lineMode(on)
+#define terminal_getchar getchar
 #else
 #include <alloca.h>
 #include <unistd.h>
 #include <termios.h>
+void terminal_begin(void);
+void terminal_lineMode(bool on);
+int terminal_getchar(void);
+void terminal_readPaste(char **text);
 char getch();
 char getch_nonblocking();
 #endif
@@ -42,6 +49,7 @@ typedef enum State {
 /* === editor.c === */
 #define MAXLENGTH 900 /* 2000000 was too big on Windows */
 
+void editorState_internCommands(void);
 State editorState_menu(void);
 void editorState_editor(void);
 
@@ -52,6 +60,7 @@ void printFileInfo(void);
 /* == Streatchy Buffers (by Sean Barratt) === */
 
 #define MAX(x, y) ((x) >= (y) ? (x) : (y))
+#define MIN(x, y) ((x) <= (y) ? (x) : (y))
 #define CLAMP_MAX(x, max) MIN(x, max)
 #define CLAMP_MIN(x, min) MAX(x, min)
 #define IS_POW2(x) (((x) != 0) && ((x) & ((x)-1)) == 0)
@@ -59,8 +68,27 @@ void printFileInfo(void);
 void *xcalloc(size_t num_elems, size_t elem_size);
 void *xrealloc(void *prt, size_t num_bytes);
 void *xmalloc(size_t num_bytes);
+void xfree(void *ptr);
 void fatal(const char *fmt, ...);
 
+// Allocation counters, compiled in with -DEDIM_ALLOC_STATS. Memory from xmalloc, xcalloc, and xrealloc must then
+// be freed with xfree (buf_free and the arenas do), since each allocation is prefixed with its size.
+// The stretchy buffers also count how often they grow at each buf_push/buf_add in the code.
+#ifdef EDIM_ALLOC_STATS
+typedef struct AllocStats {
+    uint64_t mallocCalls;
+    uint64_t callocCalls;
+    uint64_t reallocCalls;
+    uint64_t freeCalls;
+    uint64_t growEvents;
+    size_t bytesLive;
+    size_t peakBytes;
+} AllocStats;
+
+AllocStats allocStats_get(void);
+void allocStats_print(int maxSites);
+#endif
+
 typedef struct BufHdr {
     size_t len;
     size_t cap;
@@ -69,20 +97,61 @@ typedef struct BufHdr {
 
 #define buf__hdr(b) ((BufHdr *) ((char *) (b)  - offsetof(BufHdr, buf)))
 #define buf__fits(b, n) (buf_len(b) + (n) <= buf_cap(b))
+// buf_reserve makes room for n more elements, growing the buffer by the growth policy (BufGrowth) if it has to
+#ifdef EDIM_ALLOC_STATS
+#define buf__fit(b, n) (buf__fits((b), (n)) ? 0 : ((b) = buf__growAt((b), buf_len(b) + (n), sizeof(*(b)), BUF_GROW_DOUBLE, __FILE__, __LINE__)))
+#define buf_reserve(b, n, growth) (buf__fits((b), (n)) ? 0 : ((b) = buf__growAt((b), buf_len(b) + (n), sizeof(*(b)), (growth), __FILE__, __LINE__)))
+#else
 #define buf__fit(b, n) (buf__fits((b), (n)) ? 0 : ((b) = buf__grow((b), buf_len(b) + (n), sizeof(*(b)))))
+#define buf_reserve(b, n, growth) (buf__fits((b), (n)) ? 0 : ((b) = buf__growBy((b), buf_len(b) + (n), sizeof(*(b)), (growth))))
+#endif
 
 #define buf_len(b) ((b) ? buf__hdr(b)->len : 0)
 #define buf_cap(b) ((b) ? buf__hdr(b)->cap : 0)
+#define buf_memory(b) ((b) ? offsetof(BufHdr, buf) + buf_cap(b) * sizeof(*(b)) : 0) // Bytes allocated for the buffer
 #define buf_push(b, x) (buf__fit((b), 1), (b)[buf__hdr(b)->len++] = (x))
 #define buf_end(b) ((b) + buf_len(b))
 
-#define buf_add(b, n) (buf__fit((b), n), buf__hdr(b)->len += n, &(b)[buf__hdr(b)->len - n]) // TODO: Not sure if I should be returning the address or not
+#define buf_add(b, n) (buf__fit((b), (n)), buf__hdr(b)->len += (n), &(b)[buf__hdr(b)->len - (n)]) // TODO: Not sure if I should be returning the address or not
 #define buf_pop(b) (buf__hdr(b)->len--, &(b)[buf__hdr(b)->len + 1]) // TODO: Check that array exists and length doesn't go below 0
 #define buf_pop_all(b) (buf__hdr(b)->len = 0)
 
-#define buf_free(b) ((b) ? (free(buf__hdr(b)), (b) = NULL) : 0)
+#define buf_free(b) ((b) ? (xfree(buf__hdr(b)), (b) = NULL) : 0)
+// Gives back the capacity the buffer isn't using. An empty buffer is freed.
+#define buf_shrink(b) ((b) = buf__shrink((b), sizeof(*(b))))
+
+// How a stretchy buffer's capacity grows when it's full. buf_push and buf_add double it, buf_reserve takes the policy.
+typedef enum BufGrowth {
+    BUF_GROW_DOUBLE, // 1 + 2 * cap
+    BUF_GROW_HALF, // 1.5 * cap, for big arrays that keep growing a little at a time
+    BUF_GROW_PAGES, // Doubles, but rounded up to whole BUF_PAGE_SIZE pages
+    BUF_GROW_EXACT, // Only what was asked for, for arrays that are filled once
+} BufGrowth;
+
+#define BUF_PAGE_SIZE 4096
 
 void *buf__grow(const void *buf, size_t new_len, size_t elem_size);
+void *buf__growBy(const void *buf, size_t new_len, size_t elem_size, BufGrowth growth);
+void *buf__shrink(void *buf, size_t elem_size);
+#ifdef EDIM_ALLOC_STATS
+void *buf__growAt(const void *buf, size_t new_len, size_t elem_size, BufGrowth growth, const char *file, int line);
+#endif
+
+#define ALIGN_UP(n, a) (((n) + (a) - 1) & ~(size_t)((a) - 1))
+
+#define ARENA_ALIGNMENT 8
+#define ARENA_BLOCK_SIZE (64 * 1024)
+
+typedef struct Arena {
+    char *ptr;
+    char *end;
+    char **blocks; // Stretchy buffer
+} Arena;
+
+void arena_grow(Arena *arena, size_t minSize);
+void *arena_alloc(Arena *arena, size_t size);
+void arena_reset(Arena *arena);
+void arena_free(Arena *arena);
 
 /* === Hash Map === */
 
@@ -107,75 +176,271 @@ void *map_get_from_uint64(Map *map, uint64_t key);
 void map_put_from_uint64(Map *map, uint64_t key, void *val);
 uint64_t map_get_uint64(Map *map, void *key);
 void map_put_uint64(Map *map, void *key, uint64_t val);
+size_t map_memory(Map *map);
 void map_test(void);
+void map_benchmark(void);
+void hash_benchmark(void);
+
+// Hash map in the style of a swiss table, see hashmap.c. Keys and values are copied in and can be any size.
+// hash and equal are used for the keys if given, otherwise the key bytes are hashed and compared (inline for 8- and
+// 16-byte keys, like pointers and ids).
+typedef uint64_t (*SwissMapHash)(const void *key);
+typedef bool (*SwissMapEqual)(const void *a, const void *b);
+
+typedef struct SwissMap {
+    uint8_t *ctrl; // A control byte per slot (and a copy of the first group at the end), SWISSMAP_EMPTY or 7 bits of the hash
+    char *slots; // cap slots, each a key followed by a value
+    uint32_t *homes; // For each full slot, the bits of its key's hash that pick its home slot, so moving keys doesn't rehash them
+    size_t len;
+    size_t cap;
+    size_t keySize;
+    size_t valSize;
+    size_t slotSize;
+    int keyWords; // 1 or 2 if the keys are 8 or 16 bytes hashed and compared inline, 0 if not
+    SwissMapHash hash;
+    SwissMapEqual equal;
+} SwissMap;
+
+void swissmap_init(SwissMap *map, size_t keySize, size_t valSize, SwissMapHash hash, SwissMapEqual equal);
+void *swissmap_get(SwissMap *map, const void *key);
+void *swissmap_put(SwissMap *map, const void *key, const void *val);
+bool swissmap_remove(SwissMap *map, const void *key);
+void swissmap_clear(SwissMap *map);
+void swissmap_free(SwissMap *map);
+size_t swissmap_memory(SwissMap *map);
+
+// Interned strings: each distinct string is stored once (zero-terminated, and never freed), so interned strings
+// can be compared by pointer. Not thread-safe, str_intern_find can only be used from other threads while nothing is being interned.
+const char *str_intern_range(const char *start, const char *end);
+const char *str_intern(const char *str);
+const char *str_intern_find(const char *start, const char *end);
 
 /* === buffer.c - Text Editing Data Structures === */
 
 typedef enum FileType {
-    FT_UNKNOWN, FT_TEXT, FT_MARKDOWN, FT_C, FT_CPP, FT_C_HEADER // TODO: Add Batch and Bash files
+    FT_UNKNOWN, FT_TEXT, FT_MARKDOWN, FT_C, FT_CPP, FT_C_HEADER, FT_SHELL // TODO: Add Batch files
 } FileType;
 
-void getFileTypeExtension(FileType ft, char **ftExt);
+
+typedef struct Token Token;
+
+// Lines of up to LINE_INLINE_CAPACITY chars are kept right in the Line, in place of the chars pointer. Longer ones
+// are stretchy buffers, allocated from their buffer's LinePool instead of on their own if they're short enough:
+// each size class is twice the size of the one before it, starting at LINE_POOL_MIN_BLOCK bytes (with the BufHdr).
+// Use line_chars and line_length to read a line, and only change it through the buffer_* functions.
+#define LINE_INLINE_CAPACITY 24
+#define LINE_POOL_CLASSES 5
+#define LINE_POOL_MIN_BLOCK 64
+#define LINE_CHARS_HEAP 0 // Line.charsClass of chars allocated on their own, like any other stretchy buffer
+#define LINE_CHARS_INLINE 0x80 // Line.charsClass flag for chars kept in the Line, the rest of the bits are their length
+
+#define line_isInline(line) (((line)->charsClass & LINE_CHARS_INLINE) != 0)
+#define line_chars(line) (line_isInline(line) ? (line)->text.inlineChars : (line)->text.chars)
+#define line_length(line) (line_isInline(line) ? (size_t) ((line)->charsClass & (LINE_CHARS_INLINE - 1)) : buf_len((line)->text.chars))
 
 typedef struct Line {
-    char *chars;
+    union {
+        char *chars; // Stretchy buffer, unless the line is inline
+        char inlineChars[LINE_INLINE_CAPACITY];
+    } text; // Named because anonymous unions are C11 and we build as C99
+    uint32_t id; // Stable id given by the buffer when the line is added to it. 0 means not yet assigned.
+    uint8_t charsClass; // LINE_CHARS_HEAP, the size class + 1 of the pool block the chars are in, or LINE_CHARS_INLINE | length
+    // Lexer cache, see lexer.c
+    uint8_t lexEntry; // Lexer state at the start of the line that the tokens were lexed with
+    uint8_t lexExit; // Lexer state at the end of the line
+    uint8_t lexFlags;
+    Token *tokens; // Stretchy buffer, only valid when lexFlags has LINE_LEXED
 } Line;
 
+// Stable reference to a line. Unlike a Line pointer or an index, it stays valid when
+// the lines array is reallocated or when lines are inserted/deleted/moved around it.
+// The hint is the last known index of the line, so resolving is O(1) in the common case.
+typedef struct LineAnchor {
+    uint32_t id;
+    int hint;
+} LineAnchor;
+
+// Lines inserted (count > 0) or removed (count < 0) at index, see buffer_resolveAnchor
+typedef struct LineShift {
+    int index;
+    int count;
+} LineShift;
+
+// The most shifts kept before the line id index is dropped, to be rebuilt the next time it's needed
+#define LINE_SHIFTS_MAX 1024
+
+// One end of a bookmark's range, see parsing.c
+typedef struct BookmarkEndpoint {
+    int line; // The line number when the endpoints were sorted, minus the shifts up to it in bookmarkShifts
+    int bookmark; // Index in bookmarks
+    bool isEnd;
+} BookmarkEndpoint;
+
+// Blocks for the chars of a buffer's lines. They're carved out of big slabs, and freed blocks go on a free list
+// for their size class, so closing the buffer frees a few slabs instead of every line.
+typedef struct LinePool {
+    Arena slabs;
+    void *freeBlocks[LINE_POOL_CLASSES]; // Linked through the first bytes of each block
+    size_t freeBytes; // Total size of the blocks in freeBlocks
+} LinePool;
+
+// Buffers smaller than this (line pool plus lines array) aren't compacted after commands
+#define COMPACT_MIN_BYTES (1024 * 1024)
+
 typedef enum OperationKind {
     Undo, InsertAfter, InsertBefore, AppendTo, PrependTo, ReplaceLine, ReplaceString, DeleteLine
 } OperationKind;
 
-typedef struct Operation {
-    OperationKind kind;
-    int *lines; // Line(s) that have been modified/added/deleted by the operation
-    union {
-        Line original; // The original line that was modified/deleted - TODO: Not very memory efficient
-    };
-} Operation;
-
-// Levels:
+typedef enum UndoKind {
+    UNDO_INSERT_LINES, UNDO_DELETE_LINES, UNDO_CHANGE_LINE, UNDO_SWAP_LINES
+} UndoKind;
+
+// One change in a buffer's undo history, see buffer.c. Lines are never copied: the Line structs of inserted
+// or deleted lines are moved between the buffer and the record, and a changed line only keeps the bytes that differ.
+typedef struct UndoRecord {
+    uint8_t kind;
+    uint32_t id; // Increases along the history, so checkpoints can find their place with a binary search
+    int index; // First line (index, starting at 0) that the change is at
+    int count; // Number of lines inserted or deleted
+    Line *lines; // Stretchy buffer of the lines while they're not in the buffer (deleted lines, or inserted lines that were undone)
+    size_t charsSize; // Bytes of chars the lines have
+    // UNDO_CHANGE_LINE: the removedLength bytes at start were replaced with insertedLength bytes.
+    // bytes has the removed bytes followed by the inserted ones.
+    int start;
+    int removedLength;
+    int insertedLength;
+    char *bytes;
+    size_t size; // Memory the record owns right now, counted against undoBudget
+} UndoRecord;
+
+// A named state of a buffer. It's just a place in the undo history, so making one doesn't copy anything, and
+// going back to it undoes (or redoes) only the changes made since. The records it needs are kept in the history
+// even over undoBudget, until the checkpoint is forgotten.
+typedef struct Checkpoint {
+    char *name; // Stretchy buffer
+    uint32_t lastId; // Id of the last applied record when the checkpoint was made (or undoBaseId if there was none)
+} Checkpoint;
+
+typedef enum OutlineNodeKind {
+    OUTLINE_HEADING, OUTLINE_FUNCTION, OUTLINE_NAMESPACE, OUTLINE_CLASS, OUTLINE_STRUCT, OUTLINE_UNION, OUTLINE_ENUM
+} OutlineNodeKind;
+
+// Outline node flags
+#define OUTLINE_FLAG_TEMPLATE 1 // Declaration has a template header (on the same or the previous line)
+#define OUTLINE_FLAG_MEMBER 2 // Qualified name, like 'Foo::bar'
+#define OUTLINE_FLAG_OPERATOR 4 // Operator overload
+
+// Levels (for markdown headings):
 //  0 for #
 //  1 for ##
 //  ...
-typedef struct MarkdownOutlineNode {
-    Line *line;
-    int lineNum;
-    int level;
-} MarkdownOutlineNode;
-
-typedef struct COutlineNode {
-    Line *line;
-    int lineNum;
-} COutlineNode;
+typedef struct OutlineNode {
+    LineAnchor line;
+    // Where the name of the definition is in the line (the last component for qualified names), used for the symbol index
+    int nameStart;
+    int nameLength;
+    uint8_t kind;
+    uint8_t level;
+    uint8_t flags;
+} OutlineNode;
 
 typedef struct Bookmark Bookmark;
 
+// Buffer.savedUndoId of a buffer that has never matched a file, like a new one
+#define UNDO_NOT_SAVED UINT32_MAX
+
 typedef struct Buffer {
     char *openedFilename; // char Stretchy buffer for the currently opened filename
     FileType fileType;
     Line *lines;
-    Operation lastOperation;
+    LinePool linePool;
+    uint32_t nextLineId;
+    // Line id -> where the line was and how many lineShifts it had seen then. Built the first time an anchor's hint
+    // misses, then kept up to date as lines are inserted, removed, and moved.
+    Map lineIndex;
+    LineShift *lineShifts; // Stretchy buffer of the inserts and removes since lineIndex was built
+    // Lexer cache bookkeeping, see lexer.c
+    FileType lexFileType; // The filetype the cached tokens were lexed as
+    int lexedUpTo; // Lines before this index are lexed and their states are consistent
+    int lexHighWater; // No line at or past this index has been lexed since the last reset
+    int lexDirtyMax; // Last index changed since lexedUpTo was lowered, -1 for none
+    UndoRecord *undoHistory; // Stretchy buffer, oldest first
+    int undoPosition; // Records before this are applied, the ones after it were undone and can be redone
+    size_t undoBytes; // Total size of the records
+    uint32_t nextUndoId;
+    uint32_t undoBaseId; // Id of the last record forgotten from the front of the history, 0 if none were
+    // Id of the last record that was applied when the buffer last matched its file, or UNDO_NOT_SAVED. Undoing or
+    // redoing back to it makes the buffer unmodified again.
+    uint32_t savedUndoId;
+    Checkpoint *checkpoints; // Stretchy buffer
+    FILE *undoLog; // Open for appending, see undolog.c. NULL if the buffer isn't from a file, or hasn't changed since it was opened.
+    bool undoLogPending; // The log is started on the first change, from the contents with hash undoLogHash
+    uint64_t undoLogHash;
     Bookmark *bookmarks;
+    SwissMap bookmarkIndex; // Interned bookmark name -> index (int) in bookmarks
+    // The bookmarks' endpoints sorted by line, and a Fenwick tree (starting at 1) of how far the lines were shifted
+    // by edits since then, so inserting or deleting lines moves every bookmark after them in O(log n). See parsing.c.
+    BookmarkEndpoint *bookmarkEndpoints;
+    int *bookmarkShifts;
+    bool bookmarkEndpointsStale; // Bookmarks were added or removed, so the ranges in the Bookmarks are the current ones
     // Used by default when no line passed into a command.
     // Commands that modify the file will change the currentLine to the last line it modified. Some commands, like 'c', don't modify the file based on the current line, but will change the current line to what it's modifying ('c' will change the current line to the last line in the file and start inserting from there).
     int currentLine;
     bool modified;
-    union outline {
-        void *nodes;
-        MarkdownOutlineNode *markdown_nodes;
-        COutlineNode *c_nodes;
-    } outline;
+    OutlineNode *outline; // Stretchy buffer, sorted by line
+    // Range of lines (indices, inclusive) that changed since the outline was last updated, -1 when nothing changed.
+    // changedLineDelta is how many lines were added (or removed, if negative) in that time.
+    int changedStart;
+    int changedEnd;
+    int changedLineDelta;
+    // Symbol index: interned name of a definition -> index (int) of the first outline node with that name.
+    // symbolNext chains the nodes with the same name (index + 1, 0 ends the chain).
+    // Rebuilt lazily from the outline the next time a symbol is looked up after the outline changed.
+    SwissMap symbolIndex;
+    int *symbolNext;
+    bool symbolIndexStale;
+    // Brace depth index, see buffer.c. braceDeltas has the net number of braces opened on each line, and
+    // braceTree is a Fenwick tree over it (starting at 1), so the depth at any line is a prefix sum.
+    int *braceDeltas;
+    int *braceTree;
+    bool braceTreeStale; // Lines were inserted or removed since braceTree was built
+    FileType braceFileType; // The filetype the braces were counted as
 } Buffer;
 
 // Stretchy buffer of Buffers
 Buffer *buffers;
 Buffer *currentBuffer;
+// Memory the undo history of each buffer can use before the oldest changes are forgotten.
+// Set with the EDIM_UNDO_BUDGET environment variable (in bytes).
+#define UNDO_DEFAULT_BUDGET (64 * 1024 * 1024)
+extern size_t undoBudget;
+
+// Bytes a buffer has allocated, by what they're for. Shown by the 'stats' command.
+typedef struct BufferMemory {
+    size_t lines; // The Line structs and their chars
+    size_t tokens; // The lexer's cached tokens
+    size_t outline; // The outline and the symbol index
+    size_t bookmarks;
+    size_t undo; // Undo history and checkpoints
+    size_t indexes; // Line id and brace depth indexes
+    size_t total;
+} BufferMemory;
 
 void buffer_initEmptyBuffer(Buffer *buffer);
 int buffer_openFile(Buffer *buffer, char *filename);
+void buffer_readLines(Buffer *buffer, FILE *fp);
 void buffer_saveFile(Buffer *buffer, char *filename);
 void buffer_close(Buffer *buffer);
 
+void buffer_internExtensions(void);
+FileType buffer_fileTypeFromFilename(char *filename);
+void buffer_markChanged(Buffer *buffer, int first, int last);
+void buffer_assignLineIds(Buffer *buffer, Line *lines, int count);
+LineAnchor buffer_anchorLine(Buffer *buffer, int index);
+int buffer_resolveAnchor(Buffer *buffer, LineAnchor *anchor);
+
+void buffer_splitLines(Buffer *buffer, const char *text, size_t length, Line **lines);
+void buffer_releaseLines(Buffer *buffer, Line *lines);
 int buffer_insertAfterLine(Buffer *buffer, int line, Line *lines);
 int buffer_insertBeforeLine(Buffer *buffer, int line, Line *lines);
 void buffer_appendToLine(Buffer *buffer, int line, char *chars);
@@ -194,7 +459,99 @@ void buffer_deleteLine(Buffer *buffer, int line);
 // void buffer_deleteLines(Buffer *buffer, int lineStart, int lineEnd);
 int buffer_findStringInLine(Buffer *buffer, int line, char *str, int strLength);
 int buffer_findStringInFile(Buffer *buffer, char *str, int strLength, int *colIndex);
-
+bool buffer_undo(Buffer *buffer);
+bool buffer_redo(Buffer *buffer);
+void buffer_clearUndoHistory(Buffer *buffer);
+void buffer_discardRedo(Buffer *buffer);
+void buffer_setUndoHistory(Buffer *buffer, UndoRecord *records, int position);
+uint64_t buffer_contentHash(Buffer *buffer);
+BufferMemory buffer_memoryUsage(Buffer *buffer);
+size_t buffer_compact(Buffer *buffer);
+void buffer_compactIfWasteful(Buffer *buffer);
+Checkpoint *buffer_findCheckpoint(Buffer *buffer, char *name, int length);
+void buffer_setCheckpoint(Buffer *buffer, char *name, int length);
+void buffer_forgetCheckpoint(Buffer *buffer, Checkpoint *checkpoint);
+int buffer_checkpointPosition(Buffer *buffer, Checkpoint *checkpoint);
+int buffer_restoreCheckpoint(Buffer *buffer, Checkpoint *checkpoint);
+
+void undoLog_open(Buffer *buffer);
+void undoLog_close(Buffer *buffer);
+void undoLog_recordPushed(Buffer *buffer, UndoRecord *record);
+void undoLog_undone(Buffer *buffer, UndoRecord *record);
+void undoLog_redone(Buffer *buffer);
+void undoLog_saved(Buffer *buffer);
+
+void fileState_restore(Buffer *buffer);
+void fileState_save(Buffer *buffer);
+void buffer_setBraceDelta(Buffer *buffer, int index, int delta);
+int buffer_braceDepth(Buffer *buffer, int index);
+int buffer_findMatchingBrace(Buffer *buffer, int index);
+int buffer_blockEnd(Buffer *buffer, int index);
+
+
+/* === lexer.c === */
+
+typedef enum TokenKind {
+    TOKEN_IDENTIFIER, TOKEN_KEYWORD, TOKEN_TYPE, TOKEN_NUMBER, TOKEN_STRING, TOKEN_CHAR, TOKEN_COMMENT, TOKEN_PREPROCESSOR, TOKEN_PUNCTUATION,
+    TOKEN_HEADING, TOKEN_EMPHASIS, TOKEN_LINK, // Markdown
+    TOKEN_VARIABLE // Shell
+} TokenKind;
+
+// Token flags
+#define TOKEN_FLAG_CONTROL 1 // Keyword that starts a statement (if, while, return, ...)
+#define TOKEN_FLAG_PREPROCESSOR 2 // Token is part of a preprocessor directive
+
+// Offsets are into the line's chars
+typedef struct Token {
+    int start;
+    int length;
+    uint8_t kind;
+    uint8_t flags;
+} Token;
+
+// Lexer states carried from the end of one line to the start of the next. These are bit flags.
+#define LEX_STATE_NORMAL 0
+#define LEX_STATE_BLOCK_COMMENT 1
+#define LEX_STATE_STRING 2 // String continued with a backslash
+#define LEX_STATE_PREPROCESSOR 4 // Directive continued with a backslash
+#define LEX_STATE_LINE_COMMENT 8 // Line comment continued with a backslash
+#define LEX_STATE_CODE_BLOCK 16 // Markdown fenced code block
+#define LEX_STATE_SINGLE_QUOTE 32 // Shell single quoted string that continues onto the next line
+
+// Line lexFlags
+#define LINE_LEXED 1 // lexEntry and lexExit are up to date
+#define LINE_HAS_TOKENS 2 // tokens are up to date (if the line is lexed)
+
+bool lexer_isSupported(FileType ft);
+bool lexer_isC(FileType ft);
+uint8_t lexer_lexLine(FileType ft, const char *chars, int length, uint8_t state, Token **tokens);
+void lexer_ensureLexed(Buffer *buffer, int lastIndex);
+Token *lexer_getTokens(Buffer *buffer, int index);
+void lexer_reset(Buffer *buffer);
+void lexer_linesChanged(Buffer *buffer, int index, int count);
+void lexer_linesInserted(Buffer *buffer, int index, int count);
+void lexer_linesRemoved(Buffer *buffer, int index, int count);
+bool lexer_tokenEquals(Line *line, Token *token, const char *str);
+int lexer_countBraces(const char *chars, int length, Token *tokens);
+
+/* === symboldb.c - Project-wide Symbol Database === */
+
+#define SYMBOLDB_FILENAME ".edimtags"
+
+// A definition found in the symbol database. The strings point into the loaded database and stay valid until it's reloaded or closed.
+typedef struct SymbolLocation {
+    const char *directory; // The directory that was indexed
+    const char *path; // Relative to directory, not zero-terminated
+    int pathLength;
+    int line; // Starts at 1
+    uint8_t kind; // OutlineNodeKind
+} SymbolLocation;
+
+bool symbolDb_index(const char *directory, int *filesParsed, int *filesTotal);
+bool symbolDb_load(const char *directory);
+bool symbolDb_isLoaded(void);
+int symbolDb_find(const char *name, int length, SymbolLocation *results, int max);
+void symbolDb_close(void);
 
 /* === parsing.c === */
 
@@ -209,8 +566,10 @@ typedef struct lineRange {
 } lineRange;
 
 typedef struct Bookmark {
-    char *name; // Dynamic Array Buffer
-    lineRange range;
+    const char *name; // Interned
+    lineRange range; // Updated from the endpoints when the bookmark is looked up
+    int startEndpoint; // Indices in bookmarkEndpoints
+    int endEndpoint;
 } Bookmark;
 
 // Function pointer to function that can run user-code on specific keypresses during input (with getInput). If null, the function is not called
@@ -243,6 +602,7 @@ typedef bool (*inputKeyCallback)(char, bool isSpecial, char **, int *);
 #define INPUT_RIGHT 67
 #define INPUT_DELETE1 51
 #define INPUT_DELETE2 126
+#define INPUT_PASTE1 50 // ESC [ 200 ~ starts a bracketed paste, ESC [ 201 ~ ends it
 #define INPUT_END 70
 #define INPUT_HOME 72
 #define INPUT_ENDINPUT 4 // CTRL-D
@@ -252,28 +612,34 @@ typedef bool (*inputKeyCallback)(char, bool isSpecial, char **, int *);
 char *skipWhitespace(char *start, char *endBound);
 char *skipWord(char *start, char *endBound, bool includeNumbers, bool includeSymbols);
 char *skipNumbers(char *start, char *endBound);
+char *skipIdentifier(char *start, char *endBound);
 char *skipLineNumber(char *start, char *endBound);
 
 long parseLineNumber(Buffer *buffer, char *start, char *endBound);
 
 char *getInput(bool *canceled, char *inputBuffer, inputKeyCallback callback);
+char *getInputLines(bool *canceled, char *inputBuffer, char **pasteRest);
 int parsing_getLine(char *line, int max, int trimSpace);
 int parsing_getLine_dynamic(char **chars, int trimSpace);
 
+bool outline_isSupported(FileType ft);
+void outline_build(Buffer *buffer);
 void createOutline(void);
 void recreateOutline(void);
 void showOutline(void);
-
-void createMarkdownOutline(void);
-void createCOutline(void);
-void showMarkdownOutline(void);
-void showCOutline(void);
+int outline_findSymbol(Buffer *buffer, const char *name, int length, int *lineIndices, int max);
+int outline_definitionEnd(Buffer *buffer, int index);
 
 // Returns if bookmark was found with result_bookmark changed to a pointer
 // to it.
 bool get_bookmark(Buffer *buffer, pString name, Bookmark **result_bookmark);
 // Returns true if updated existing bookmark, false otherwise
 bool add_bookmark(Buffer *buffer, pString name, lineRange range);
+// Returns false if there's no bookmark with the name
+bool remove_bookmark(Buffer *buffer, pString name);
+void bookmarks_updateRanges(Buffer *buffer);
+void bookmarks_linesInserted(Buffer *buffer, int index, int count);
+void bookmarks_linesRemoved(Buffer *buffer, int index, int count);
 
 /* === Colors === */
 
@@ -317,6 +683,15 @@ typedef enum COLOR
 HANDLE hConsole; // Used for coloring output on Windows
 #endif
 
+void output_beginFrame(void);
+void output_endFrame(void);
+void output_flush(void);
+void output_write(const char *chars, size_t length);
+void output_string(const char *str);
+void output_char(char c);
+void output_vprintf(const char *fmt, va_list args);
+void output_printf(const char *fmt, ...);
+
 void setColor(COLOR foreground);
 void resetColor(void);
 void colors_printf(COLOR foreground, const char *fmt, ...);
@@ -2,9 +2,19 @@
 
 internal void editorState_openAnotherFile(char *rest, int restLength);
 internal void editorState_openNewFile(char *rest, int restLength);
+internal void editorState_jumpToFile(char *filename, int line);
+internal void editorState_jumpToSymbolDefinition(char *name, int nameLength);
+internal void editorState_indexDirectory(char *rest, char *end);
+internal void editorState_checkpoint(char *rest, char *end);
+internal void editorState_checkout(char *rest, char *end);
+internal void editorState_compareCheckpoints(char *rest, char *end);
+internal void editorState_forgetCheckpoint(char *rest, char *end);
+internal void editorState_printMemoryStats(void);
+internal void editorState_compactBuffers(void);
 
 internal int getLineNumber();
 internal int checkLineNumber(int original_line);
+internal int tokenColor(Token *token);
 
 internal void editorState_printHelpScreen();
 
@@ -21,6 +31,52 @@ internal void editorState_deleteLine(lineRange line_range);
 internal void editorState_moveUp(lineRange line_range);
 internal void editorState_moveDown(lineRange line_range);
 
+// Memory for the command being run. It's all released at once when the command is done, so nothing allocated
+// from it has to be freed (or can be kept after the command).
+internal Arena commandArena;
+// The command being typed. Kept (and emptied) between commands, so reading a command doesn't allocate.
+internal char *commandInput;
+
+// Returns a zero-terminated copy of the string from start to end, allocated from commandArena
+internal char *commandString(const char *start, const char *end) {
+    char *str = arena_alloc(&commandArena, end - start + 1);
+    memcpy(str, start, end - start);
+    str[end - start] = '\0';
+    return str;
+}
+
+// Returns the end of the text from start to end without the whitespace (and line break) at its end
+internal char *trimEnd(char *start, char *end) {
+    while (end > start && (end[-1] == '\n' || end[-1] == '\r' || end[-1] == ' ' || end[-1] == '\t' || end[-1] == '\0'))
+        --end;
+    return end;
+}
+
+// Interned names of the commands that are words, so the command a line starts with is found with pointer compares
+internal const char *clearCommand;
+internal const char *helpCommand;
+internal const char *infoCommand;
+internal const char *tagsCommand;
+internal const char *checkpointCommand;
+internal const char *checkoutCommand;
+internal const char *compareCommand;
+internal const char *forgetCommand;
+internal const char *statsCommand;
+internal const char *compactCommand;
+
+void editorState_internCommands(void) {
+    clearCommand = str_intern("clear");
+    helpCommand = str_intern("help");
+    infoCommand = str_intern("info");
+    tagsCommand = str_intern("tags");
+    checkpointCommand = str_intern("checkpoint");
+    checkoutCommand = str_intern("checkout");
+    compareCommand = str_intern("compare");
+    forgetCommand = str_intern("forget");
+    statsCommand = str_intern("stats");
+    compactCommand = str_intern("compact");
+}
+
 internal bool commandInputCallback(char c, bool isSpecial, char **inputBuffer, int *currentIndex) {
     bool bufferEmpty = false;
     if (*inputBuffer == NULL || buf_len(*inputBuffer) == 0)
@@ -63,10 +119,7 @@ internal bool commandInputCallback(char c, bool isSpecial, char **inputBuffer, i
     }*/
     
     if (!isSpecial && bufferEmpty) {
-        char *str = malloc(3 * sizeof(char));
-        str[0] = 'h';
-        str[1] = ' ';
-        str[2] = '\0';
+        char str[3] = "h ";
         switch (c) {
             case 'i':
             str[0] = 'i'; break;
@@ -82,6 +135,8 @@ internal bool commandInputCallback(char c, bool isSpecial, char **inputBuffer, i
             str[0] = 'R'; break;
             case 'j':
             str[0] = 'j'; break;
+            case 'J':
+            str[0] = 'J'; break;
             case 'p':
             str[0] = 'p'; break;
             case 'P':
@@ -98,6 +153,8 @@ internal bool commandInputCallback(char c, bool isSpecial, char **inputBuffer, i
             str[0] = 'F'; break;*/
             case 'u':
             str[0] = 'u'; break;
+            case 'U':
+            str[0] = 'U'; break;
             case 'n':
             str[0] = 'n'; break;
             case 'b':
@@ -114,6 +171,8 @@ internal bool commandInputCallback(char c, bool isSpecial, char **inputBuffer, i
             str[0] = 'q'; break;
             case 'Q':
             str[0] = 'Q'; break;
+            case '%':
+            str[0] = '%'; break;
             // --
             case 'h':
             {
@@ -122,7 +181,6 @@ internal bool commandInputCallback(char c, bool isSpecial, char **inputBuffer, i
                     buf_push(*inputBuffer, str2[i]);
                 printf("%s", str2);
                 (*currentIndex) += strlen(str2);
-                free(str); str = NULL;
             } return false;
             case '#':
             {
@@ -131,25 +189,26 @@ internal bool commandInputCallback(char c, bool isSpecial, char **inputBuffer, i
                     buf_push(*inputBuffer, str2[i]);
                 printf("%s", str2);
                 (*currentIndex) += strlen(str2);
-                free(str); str = NULL;
+            } return false;
+            case '@':
+            {
+                char *str2 = "stats ";
+                for (int i = 0; i < strlen(str2); i++)
+                    buf_push(*inputBuffer, str2[i]);
+                printf("%s", str2);
+                (*currentIndex) += strlen(str2);
             } return false;
             // --
             default:
-            free(str); str = NULL;
             return true;
         }
         printf("%s", str);
         for (int i = 0; i < strlen(str); i++)
             buf_push(*inputBuffer, str[i]);
         (*currentIndex) += strlen(str);
-        free(str); str = NULL;
         return false;
     } else if (!isSpecial) {
-        char *str = malloc(3 * sizeof(char));
-        str[0] = '$';
-        str[1] = ' ';
-        str[2] = '\0';
-        //char *str = "$ ";
+        char str[3] = "$ ";
         switch (c) {
             case '$':
             str[0] = '$'; break;
@@ -158,22 +217,20 @@ internal bool commandInputCallback(char c, bool isSpecial, char **inputBuffer, i
             /*case '0': // Check that no other numbers before (aside from space)
             str[0] = '0'; break;*/
             default:
-            free(str); str = NULL;
             return true;
         }
         for (int i = 0; i < strlen(str); i++)
             buf_push(*inputBuffer, str[i]);
         printf("%s", str);
         (*currentIndex) += strlen(str);
-        free(str); str = NULL;
         return false;
     }
     
     return true;
 }
 
-/* Menu for Editor */
-State editorState_menu(void) {
+// Reads and runs one command. Anything it allocates from commandArena is released when it returns, see editorState_menu.
+internal State editorState_runCommand(void) {
     /* Prompt */
     if (buf_len(currentBuffer->openedFilename) > 0) {
         // TODO: This will also print out the directory, so I should get rid of everything before the last slash
@@ -185,13 +242,14 @@ State editorState_menu(void) {
         
     } else printPrompt("\n<%d: new file*|%d> ", currentBuffer - buffers, currentBuffer->currentLine);
     
-    char *input = NULL;
     bool canceled = false;
-    input = getInput(&canceled, input, commandInputCallback);
-    if (canceled || input == NULL || buf_len(input) == 0 || (buf_len(input) == 1 && input[0] == '\n')) {
-        buf_free(input);
+    commandInput = getInput(&canceled, commandInput, commandInputCallback);
+    if (canceled || commandInput == NULL || buf_len(commandInput) == 0 || (buf_len(commandInput) == 1 && commandInput[0] == '\n'))
         return KEEP;
-    }
+    // The parsing functions can look one character past the end of the input, so make sure it's not left over from an earlier command
+    buf_push(commandInput, '\0');
+    buf_pop(commandInput);
+    char *input = commandInput;
     
     char *current = input;
     
@@ -203,8 +261,10 @@ State editorState_menu(void) {
     command.start = current;
     current = skipWord(current, buf_end(input), false, false);
     command.end = current;
-    if (command.start == command.end) {
-        // TODO: Read symbol?
+    if (command.start == command.end && current < buf_end(input) && *current != '\n') {
+        // Commands that are a symbol, like '%'
+        ++current;
+        command.end = current;
     }
     
     // Skip Whitespace
@@ -212,25 +272,52 @@ State editorState_menu(void) {
     
     printf("\n");
     
-    // String Comparisons - I believe this is inefficient
-    // TODO: Look into string interning
-    size_t maxChars = (command.end - command.start);
-    //printf("'%.*s'", maxChars, command.start);
-    if (strncmp(command.start, "clear", 5) == 0) {
+    // Word commands. The lookup doesn't intern anything, so a command that was never interned is NULL here.
+    const char *commandName = str_intern_find(command.start, command.end);
+    if (commandName == clearCommand) {
         clrscr();
-        buf_free(input);
         return KEEP;
-    } else if (strncmp(command.start, "help", 4) == 0) {
+    } else if (commandName == helpCommand) {
         editorState_printHelpScreen();
-        buf_free(input);
         return KEEP;
-    } else if (strncmp(command.start, "info", 4) == 0) {
+    } else if (commandName == infoCommand) {
         printFileInfo();
-        buf_free(input);
+        return KEEP;
+    } else if (commandName == tagsCommand) {
+        editorState_indexDirectory(current, buf_end(input));
+        return KEEP;
+    } else if (commandName == checkpointCommand) {
+        editorState_checkpoint(current, buf_end(input));
+        return KEEP;
+    } else if (commandName == checkoutCommand) {
+        editorState_checkout(current, buf_end(input));
+        return KEEP;
+    } else if (commandName == compareCommand) {
+        editorState_compareCheckpoints(current, buf_end(input));
+        return KEEP;
+    } else if (commandName == forgetCommand) {
+        editorState_forgetCheckpoint(current, buf_end(input));
+        return KEEP;
+    } else if (commandName == statsCommand) {
+        editorState_printMemoryStats();
+        return KEEP;
+    } else if (commandName == compactCommand) {
+        editorState_compactBuffers();
+        return KEEP;
+    }
+    
+    // 'o 'symbol' opens the file a symbol is defined in. It's handled before the line numbers are parsed, which would
+    // take the symbol for the line it's defined on in the current file.
+    if (command.end - command.start == 1 && *command.start == 'o' && current < buf_end(input) && *current == '\'') {
+        char *nameEnd = trimEnd(current + 1, buf_end(input));
+        if (nameEnd == current + 1)
+            printError("Please give the name of a symbol.");
+        else editorState_jumpToSymbolDefinition(current + 1, nameEnd - (current + 1));
         return KEEP;
     }
 
     // TODO: Interpret variable for line range
+    bool startIsDefinition = (*current == '\'');
     int line_start = (int) parseLineNumber(currentBuffer, current, buf_end(input));
     current = skipLineNumber(current, buf_end(input));
     current = skipWhitespace(current, buf_end(input));
@@ -252,6 +339,11 @@ State editorState_menu(void) {
         line_range_length = line_range.end - line_range.start;
         current = skipWhitespace(current, buf_end(input));
     }
+    else if (startIsDefinition && line_start != 0) {
+        // A definition on its own is the range of lines it spans
+        line_range.end = outline_definitionEnd(currentBuffer, line_start - 1) + 1;
+        line_range_length = line_range.end - line_range.start;
+    }
 
     // If no line number/range given, then check for a bookmark name (denoted
     // by a # at the start)
@@ -340,6 +432,8 @@ State editorState_menu(void) {
                     endLine = line;
                     line = tmp;
                 }
+                // The whole range goes out in one write
+                output_beginFrame();
                 // Print the line before
                 if (line - 2 >= 0)
                     printLine(line - 2, 0, true);
@@ -355,11 +449,68 @@ State editorState_menu(void) {
                 // Print the line after
                 if (endLine < buf_len(currentBuffer->lines))
                     printLine(endLine, 0, true);
+                output_endFrame();
             }
             
             currentBuffer->currentLine = line;
         } break;
-        case 'd': // Define bookmark - currently O(n) // TODO: Switch to using hashmap for storing bookmarks
+        case 'J': // Jump to the definition of a symbol in the outline, or in the project's symbol database
+        {
+            pString name;
+            name.start = current;
+            name.end = trimEnd(current, buf_end(input));
+            int name_length = name.end - name.start;
+            
+            if (name_length == 0) {
+                printError("Please give the name of a symbol.");
+                break;
+            }
+            
+            editorState_jumpToSymbolDefinition(name.start, name_length);
+        } break;
+        case 'u': // Undo, optionally a number of times
+        case 'U': // Redo
+        {
+            bool redo = (command.start[0] == 'U');
+            int times = (line_range.start > 0) ? line_range.start : 1;
+            int done = 0;
+            while (done < times && (redo ? buffer_redo(currentBuffer) : buffer_undo(currentBuffer)))
+                ++done;
+            
+            if (done == 0) {
+                printError(redo ? "Nothing to redo." : "Nothing to undo.");
+                break;
+            }
+            if (done < times)
+                printf("Only %d change(s) could be %s.\n", done, redo ? "redone" : "undone");
+            
+            int line = currentBuffer->currentLine;
+            if (line - 2 >= 0)
+                printLine(line - 2, 0, true);
+            if (line - 1 >= 0)
+                printLine(line - 1, '*', true);
+            if (line < buf_len(currentBuffer->lines))
+                printLine(line, 0, true);
+            
+            recreateOutline();
+        } break;
+        case '%': // Jump to the line with the brace that matches the one the line opens or closes
+        {
+            int line = line_range.start;
+            if (line == 0) line = currentBuffer->currentLine;
+            else line = checkLineNumber(line);
+            if (line == 0) break;
+            
+            int match = buffer_findMatchingBrace(currentBuffer, line - 1);
+            if (match == -1) {
+                printError("No matching brace for line %d.", line);
+                break;
+            }
+            printLine(line - 1, 0, true);
+            printLine(match, '*', true);
+            currentBuffer->currentLine = match + 1;
+        } break;
+        case 'd': // Define bookmark
         {
             pString name;
             name.start = current;
@@ -381,6 +532,23 @@ State editorState_menu(void) {
             bool updated = add_bookmark(currentBuffer, name, line_range);
             //map_put(bookmarks, (void *) name, (void *) line_range);
         } break;
+        case 'D': // Delete bookmark
+        {
+            pString name;
+            name.start = current;
+            current = skipWord(current, buf_end(input), true, false);
+            name.end = current;
+            int name_length = name.end - name.start;
+
+            current = skipWhitespace(current, buf_end(input));
+            restLength = buf_len(input) - (current - input);
+
+            if (remove_bookmark(currentBuffer, name)) {
+                printf("Deleted bookmark '%.*s'\n", name_length, name.start);
+            } else {
+                printError("No bookmark named '%.*s'.", name_length, name.start);
+            }
+        } break;
         case 'w': // TODO: For Testing
         {
             pString name;
@@ -402,9 +570,9 @@ State editorState_menu(void) {
         case 'g':
         {
             // Show list of bookmarks
-
+            bookmarks_updateRanges(currentBuffer);
             for (int i = 0; i < buf_len(currentBuffer->bookmarks); i++) {
-                printf("%4d: %.*s %d:%d", i, (int) buf_len(currentBuffer->bookmarks[i].name), currentBuffer->bookmarks[i].name, currentBuffer->bookmarks[i].range.start, currentBuffer->bookmarks[i].range.end);
+                printf("%4d: %s %d:%d", i, currentBuffer->bookmarks[i].name, currentBuffer->bookmarks[i].range.start, currentBuffer->bookmarks[i].range.end);
                 printf("\n");
             }
         } break;
@@ -433,20 +601,10 @@ State editorState_menu(void) {
                 
                 printf("Saving '%s'\n", filename);
                 buffer_saveFile(currentBuffer, filename);
+                buf_free(filename);
             } else if (filename_length > 0) { // TODO: Should be checked first - default
                 // Put filename into a buffer with \0 at end
-                char *filename_buf = NULL;
-                char *c = filename.start;
-                buf_add(filename_buf, (long unsigned int) (filename.end - filename.start + 1));
-
-                for (int i = 0; i < filename.end - filename.start + 1; i++) {
-                    if (i == filename.end - filename.start) {
-                        filename_buf[i] = '\0';
-                    } else {
-                        filename_buf[i] = filename.start[i];
-                    }
-                }
-
+                char *filename_buf = commandString(filename.start, filename.end);
                 printf("Saving '%s'\n", filename_buf);
                 buffer_saveFile(currentBuffer, filename_buf);
             } else {
@@ -550,6 +708,9 @@ State editorState_menu(void) {
                     line = tmp;
                 }
                 
+                // The whole range goes out in one write
+                output_beginFrame();
+                
                 // Print the line before
                 if (line - 2 >= 0)
                     printLine(line - 2, 0, true);
@@ -563,6 +724,7 @@ State editorState_menu(void) {
                 // Print the line after
                 if (endLine < buf_len(currentBuffer->lines))
                     printLine(endLine, 0, true);
+                output_endFrame();
             }
         } break;
         case 'f':
@@ -591,7 +753,6 @@ State editorState_menu(void) {
                         
                         currentBuffer = &(buffers[next]);
                         
-                        buf_free(input);
                         return KEEP;
                     } break;
                     case 'p':
@@ -603,7 +764,6 @@ State editorState_menu(void) {
                         
                         currentBuffer = &(buffers[previous]);
                         
-                        buf_free(input);
                         return KEEP;
                     } break;
                 }
@@ -618,7 +778,6 @@ State editorState_menu(void) {
                         
                         currentBuffer = &(buffers[next]);
                         
-                        buf_free(input);
                         return KEEP;
                     } break;
                     case 'p':
@@ -630,7 +789,6 @@ State editorState_menu(void) {
                         
                         currentBuffer = &(buffers[previous]);
                         
-                        buf_free(input);
                         return KEEP;
                     } break;
                 }
@@ -654,7 +812,6 @@ State editorState_menu(void) {
                 
                 currentBuffer = &(buffers[index]);
                 
-                buf_free(input);
                 return KEEP;
             }
             
@@ -691,29 +848,25 @@ State editorState_menu(void) {
         } break;
         case 'e':
         {
-            buf_free(input);
             return EXIT;
         } break;
         case 'E':
         {
-            buf_free(input);
             return FORCE_EXIT;
         } break;
         case 'q':
         {
-            buf_free(input);
             return QUIT;
         } break;
         case 'Q':
         {
-            buf_free(input);
             return FORCE_QUIT;
         } break;
         // Hacked in - change filetype to FT_C because of how poor my filetype extension matching is
         case 't':
         {
             currentBuffer->fileType = FT_C;
-            recreateOutline();
+            createOutline();
         } break;
         case 'T':
         {
@@ -725,10 +878,22 @@ State editorState_menu(void) {
         } break;
     }
     
-    buf_free(input);
     return KEEP;
 }
 
+/* Menu for Editor */
+State editorState_menu(void) {
+    State state = editorState_runCommand();
+    // Done with the command's input and everything else it allocated
+    if (commandInput != NULL)
+        buf_pop_all(commandInput);
+    arena_reset(&commandArena);
+    // Give back what the command left unused (like after deleting most of a big file)
+    if (currentBuffer != NULL)
+        buffer_compactIfWasteful(currentBuffer);
+    return state;
+}
+
 internal void editorState_openAnotherFile(char *rest, int restLength) {
     char str[MAXLENGTH / 4];
     int strLength = 0;
@@ -789,6 +954,296 @@ internal void editorState_openAnotherFile(char *rest, int restLength) {
     } else printFileInfo();
 }
 
+// Looks for the definition in the current buffer's outline first, then in the symbol database. When it's in
+// another file, that file is opened (or switched to, if it's already open) with the definition as the current line.
+internal void editorState_jumpToSymbolDefinition(char *name, int nameLength) {
+    // Show every definition with that name, the first one becomes the current line
+    int lineIndices[16];
+    int found = outline_findSymbol(currentBuffer, name, nameLength, lineIndices, 16);
+    if (found > 0) {
+        for (int i = 0; i < found; i++)
+            printLine(lineIndices[i], i == 0 ? '*' : 0, true);
+        currentBuffer->currentLine = lineIndices[0] + 1;
+        return;
+    }
+    
+    SymbolLocation locations[16];
+    found = symbolDb_find(name, nameLength, locations, 16);
+    if (found == 0) {
+        printError("No definition of '%.*s' in the outline%s.", nameLength, name, symbolDb_isLoaded() ? " or the symbol database" : "");
+        return;
+    }
+    
+    // List the other definitions, and go to the first one
+    char **filenames = arena_alloc(&commandArena, found * sizeof(char *));
+    for (int i = 0; i < found; i++) {
+        // Files in the current directory are opened without a "./", like they would be from the command line
+        int directoryLength = 0;
+        if (strcmp(locations[i].directory, ".") != 0)
+            directoryLength = strlen(locations[i].directory) + 1;
+        char *filename = arena_alloc(&commandArena, directoryLength + locations[i].pathLength + 1);
+        if (directoryLength > 0) {
+            memcpy(filename, locations[i].directory, directoryLength - 1);
+            filename[directoryLength - 1] = '/';
+        }
+        memcpy(filename + directoryLength, locations[i].path, locations[i].pathLength);
+        filename[directoryLength + locations[i].pathLength] = '\0';
+        filenames[i] = filename;
+    }
+    if (found > 1) {
+        for (int i = 0; i < found; i++)
+            printf("%c %s:%d\n", i == 0 ? '*' : ' ', filenames[i], locations[i].line);
+    }
+    editorState_jumpToFile(filenames[0], locations[0].line);
+}
+
+// Switches to the buffer that has the file open, or opens it in a new buffer. Line (starting at 1) becomes the current line.
+internal void editorState_jumpToFile(char *filename, int line) {
+    int filenameLength = strlen(filename);
+    Buffer *target = NULL;
+    for (int i = 0; i < buf_len(buffers); i++) {
+        if (buf_len(buffers[i].openedFilename) == filenameLength + 1 && memcmp(buffers[i].openedFilename, filename, filenameLength + 1) == 0) {
+            target = &buffers[i];
+            break;
+        }
+    }
+    
+    if (target != NULL) {
+        currentBuffer = target;
+    } else {
+        int previousBuffer = currentBuffer - buffers;
+        {
+            Buffer buffer;
+            buffer_initEmptyBuffer(&buffer);
+            buf_push(buffers, buffer);
+            currentBuffer = buf_end(buffers) - 1;
+        }
+        
+        if (!buffer_openFile(currentBuffer, filename)) {
+            // The database is out of date, don't create the file
+            printError("Couldn't open '%s'. Use 'tags' to update the symbol database.", filename);
+            buffer_close(currentBuffer);
+            buf_pop(buffers);
+            currentBuffer = &buffers[previousBuffer];
+            return;
+        }
+        printf("Opened '%s' in buffer %d\n", filename, (int) (currentBuffer - buffers));
+    }
+    
+    if (line > buf_len(currentBuffer->lines))
+        line = buf_len(currentBuffer->lines);
+    if (line < 1) {
+        currentBuffer->currentLine = 0;
+        return;
+    }
+    printLine(line - 1, '*', true);
+    currentBuffer->currentLine = line;
+}
+
+// 'tags (directory)' - Creates or updates the symbol database for the directory (the current directory by default)
+internal void editorState_indexDirectory(char *rest, char *end) {
+    while (end > rest && (end[-1] == '\n' || end[-1] == '\r' || end[-1] == ' ' || end[-1] == '\t' || end[-1] == '\0'))
+        --end;
+    
+    char *directory = (end == rest) ? "." : commandString(rest, end);
+    
+    int filesParsed = 0;
+    int filesTotal = 0;
+    if (symbolDb_index(directory, &filesParsed, &filesTotal)) {
+        colors_printf(COLOR_CYAN, "Indexed %d files in '%s' (%d parsed).\n", filesTotal, directory, filesParsed);
+    } else {
+        printError("Couldn't write the symbol database for '%s'.", directory);
+    }
+}
+
+internal void printMemoryRow(BufferMemory *memory) {
+    printf("%10.1f %10.1f %10.1f %10.1f %10.1f %10.1f %10.1f", memory->lines / 1024.0, memory->tokens / 1024.0, memory->outline / 1024.0,
+           memory->bookmarks / 1024.0, memory->undo / 1024.0, memory->indexes / 1024.0, memory->total / 1024.0);
+}
+
+// 'stats' - Shows how much memory (in KB) each open buffer uses, and the allocation counters if they're compiled in
+internal void editorState_printMemoryStats(void) {
+    printf("%-3s %10s %10s %10s %10s %10s %10s %10s  %s\n", "", "Lines", "Tokens", "Outline", "Bookmarks", "Undo", "Indexes", "Total", "File");
+    BufferMemory total = {0};
+    for (int i = 0; i < buf_len(buffers); i++) {
+        BufferMemory memory = buffer_memoryUsage(&buffers[i]);
+        total.lines += memory.lines;
+        total.tokens += memory.tokens;
+        total.outline += memory.outline;
+        total.bookmarks += memory.bookmarks;
+        total.undo += memory.undo;
+        total.indexes += memory.indexes;
+        total.total += memory.total;
+        
+        printf("%-3d ", i);
+        printMemoryRow(&memory);
+        if (buf_len(buffers[i].openedFilename) > 0)
+            printf("  %.*s\n", (int) buf_len(buffers[i].openedFilename), buffers[i].openedFilename);
+        else printf("  new file\n");
+    }
+    if (buf_len(buffers) > 1) {
+        printf("%-3s ", "All");
+        printMemoryRow(&total);
+        printf("\n");
+    }
+#ifdef EDIM_ALLOC_STATS
+    printf("\n");
+    allocStats_print(10);
+#endif
+}
+
+// 'compact' - Gives back the memory that the open buffers are holding on to without using it
+internal void editorState_compactBuffers(void) {
+    size_t total = 0;
+    for (int i = 0; i < buf_len(buffers); i++) {
+        size_t freed = buffer_compact(&buffers[i]);
+        total += freed;
+        printf("%-3d %10.1f KB", i, freed / 1024.0);
+        if (buf_len(buffers[i].openedFilename) > 0)
+            printf("  %.*s\n", (int) buf_len(buffers[i].openedFilename), buffers[i].openedFilename);
+        else printf("  new file\n");
+    }
+    colors_printf(COLOR_CYAN, "Freed %.1f KB.\n", total / 1024.0);
+}
+
+// Prints a change from the undo history, as it would be made going forward (or backward if reverse is set)
+internal void printUndoChange(UndoRecord *record, bool reverse) {
+    switch (record->kind) {
+        case UNDO_INSERT_LINES:
+        case UNDO_DELETE_LINES:
+        {
+            bool inserted = (record->kind == UNDO_INSERT_LINES) != reverse;
+            colors_printf(inserted ? COLOR_GREEN : COLOR_RED, "%c %d line(s) at line %d\n", inserted ? '+' : '-', record->count, record->index + 1);
+            // The record only has the lines while they're out of the buffer
+            for (int i = 0; i < buf_len(record->lines) && i < 3; i++) {
+                printf("    %.*s\n", (int) line_length(&(record->lines[i])), line_chars(&(record->lines[i])));
+            }
+            if (buf_len(record->lines) > 3)
+                printf("    ...\n");
+        } break;
+        case UNDO_CHANGE_LINE:
+        {
+            char *removed = record->bytes;
+            int removedLength = record->removedLength;
+            char *inserted = &(record->bytes[record->removedLength]);
+            int insertedLength = record->insertedLength;
+            if (reverse) {
+                char *bytes = removed; removed = inserted; inserted = bytes;
+                int length = removedLength; removedLength = insertedLength; insertedLength = length;
+            }
+            colors_printf(COLOR_YELLOW, "~ line %d, column %d: '%.*s' -> '%.*s'\n", record->index + 1, record->start + 1, removedLength, removed, insertedLength, inserted);
+        } break;
+        case UNDO_SWAP_LINES:
+        colors_printf(COLOR_YELLOW, "~ lines %d and %d swapped\n", record->index + 1, record->index + 2);
+        break;
+    }
+}
+
+internal pString parseCheckpointName(char *rest, char *end) {
+    pString name;
+    name.start = skipWhitespace(rest, end);
+    name.end = skipWord(name.start, end, true, false);
+    return name;
+}
+
+// 'checkpoint (name)' - Makes a checkpoint at the current state of the buffer, or lists the checkpoints if no name given
+internal void editorState_checkpoint(char *rest, char *end) {
+    pString name = parseCheckpointName(rest, end);
+    int nameLength = name.end - name.start;
+    if (nameLength > 0) {
+        buffer_setCheckpoint(currentBuffer, name.start, nameLength);
+        colors_printf(COLOR_CYAN, "Set checkpoint '%.*s'.\n", nameLength, name.start);
+        return;
+    }
+    
+    if (buf_len(currentBuffer->checkpoints) == 0) {
+        printf("No checkpoints.\n");
+        return;
+    }
+    for (int i = 0; i < buf_len(currentBuffer->checkpoints); i++) {
+        Checkpoint *checkpoint = &(currentBuffer->checkpoints[i]);
+        int position = buffer_checkpointPosition(currentBuffer, checkpoint);
+        printf("%4d: %.*s", i, (int) buf_len(checkpoint->name), checkpoint->name);
+        if (position < 0) {
+            printf(" (lost: the changes after it were undone and replaced)\n");
+        } else if (position == currentBuffer->undoPosition) {
+            printf(" (current)\n");
+        } else {
+            int distance = currentBuffer->undoPosition - position;
+            printf(" (%d change(s) %s)\n", abs(distance), (distance > 0) ? "back" : "ahead");
+        }
+    }
+}
+
+// 'checkout (name)' - Brings the buffer back to the state it had at the checkpoint
+internal void editorState_checkout(char *rest, char *end) {
+    pString name = parseCheckpointName(rest, end);
+    int nameLength = name.end - name.start;
+    Checkpoint *checkpoint = buffer_findCheckpoint(currentBuffer, name.start, nameLength);
+    if (checkpoint == NULL) {
+        printError("No checkpoint named '%.*s'.", nameLength, name.start);
+        return;
+    }
+    
+    int changes = buffer_restoreCheckpoint(currentBuffer, checkpoint);
+    if (changes < 0) {
+        printError("Checkpoint '%.*s' can't be restored: the changes after it were undone and replaced.", nameLength, name.start);
+        return;
+    }
+    colors_printf(COLOR_CYAN, "Restored checkpoint '%.*s' (%d change(s)).\n", nameLength, name.start, changes);
+    if (changes > 0)
+        recreateOutline();
+}
+
+// 'compare (name) (name)' - Lists the changes from the first checkpoint to the second (or to the current state)
+internal void editorState_compareCheckpoints(char *rest, char *end) {
+    pString names[2];
+    names[0] = parseCheckpointName(rest, end);
+    names[1] = parseCheckpointName(names[0].end, end);
+    
+    int positions[2] = { -1, currentBuffer->undoPosition };
+    for (int i = 0; i < 2; i++) {
+        int nameLength = names[i].end - names[i].start;
+        if (i == 1 && nameLength == 0)
+            break;
+        Checkpoint *checkpoint = buffer_findCheckpoint(currentBuffer, names[i].start, nameLength);
+        if (checkpoint == NULL) {
+            printError("No checkpoint named '%.*s'.", nameLength, names[i].start);
+            return;
+        }
+        positions[i] = buffer_checkpointPosition(currentBuffer, checkpoint);
+        if (positions[i] < 0) {
+            printError("Checkpoint '%.*s' is lost: the changes after it were undone and replaced.", nameLength, names[i].start);
+            return;
+        }
+    }
+    
+    if (positions[0] == positions[1]) {
+        printf("No changes.\n");
+    } else if (positions[0] < positions[1]) {
+        for (int i = positions[0]; i < positions[1]; i++) {
+            printUndoChange(&(currentBuffer->undoHistory[i]), false);
+        }
+    } else {
+        for (int i = positions[0] - 1; i >= positions[1]; i--) {
+            printUndoChange(&(currentBuffer->undoHistory[i]), true);
+        }
+    }
+}
+
+// 'forget (name)' - Removes the checkpoint, so the undo history doesn't need to keep its changes
+internal void editorState_forgetCheckpoint(char *rest, char *end) {
+    pString name = parseCheckpointName(rest, end);
+    int nameLength = name.end - name.start;
+    Checkpoint *checkpoint = buffer_findCheckpoint(currentBuffer, name.start, nameLength);
+    if (checkpoint == NULL) {
+        printError("No checkpoint named '%.*s'.", nameLength, name.start);
+        return;
+    }
+    buffer_forgetCheckpoint(currentBuffer, checkpoint);
+    colors_printf(COLOR_CYAN, "Forgot checkpoint '%.*s'.\n", nameLength, name.start);
+}
+
 internal void editorState_openNewFile(char *rest, int restLength) {
     {
         Buffer buffer;
@@ -878,32 +1333,19 @@ internal int checkLineNumber(int original_line) {
 }
 
 internal Line *multiLineEditor(int previousLine, Line *insertLines, bool *canceled, OperationKind kind) {
+    // If C, C++, or C_HEADER files, autoindent to the brace depth
+    bool autoIndent = (currentBuffer->fileType == FT_C || currentBuffer->fileType == FT_CPP || currentBuffer->fileType == FT_C_HEADER || currentBuffer->fileType == FT_UNKNOWN);
+    int depth = 0;
+    uint8_t lexState = LEX_STATE_NORMAL;
+    if (autoIndent) {
+        depth = buffer_braceDepth(currentBuffer, previousLine);
+        if (previousLine > 0 && lexer_isSupported(currentBuffer->fileType))
+            lexState = currentBuffer->lines[previousLine - 1].lexExit;
+    }
+    
     char *chars = NULL;
-    if (previousLine - 1 > 0) { // AutoIndentation
-        int whitespaceCount = 0;
-        char *start = currentBuffer->lines[previousLine - 1].chars;
-        while (*start == '\t') {
-            ++whitespaceCount;
-            ++start;
-            if (start - chars > buf_len(chars)) break;
-        }
-        
-        while (start - chars <= buf_len(chars)) {
-            if (*start == '{') {
-                ++whitespaceCount;
-            } else if (*start == '}')
-                --whitespaceCount;
-            ++start;
-        }
-        
-        chars = NULL;
-        
-        // If C, C++, or C_HEADER files, autoindent
-        if (currentBuffer->fileType == FT_C || currentBuffer->fileType == FT_CPP || currentBuffer->fileType == FT_C_HEADER || currentBuffer->fileType == FT_UNKNOWN) {
-            for (int i = 0; i < whitespaceCount; i++) {
-                buf_push(chars, '\t');
-            }
-        }
+    for (int i = 0; i < depth; i++) {
+        buf_push(chars, '\t');
     }
     
     char operation = ' ';
@@ -922,36 +1364,36 @@ internal Line *multiLineEditor(int previousLine, Line *insertLines, bool *cancel
     printLineNumber("%c%4d ", operation, currentLine);
     
     bool inputCanceled = false;
-    while ((chars = getInput(&inputCanceled, chars, NULL)) != NULL && buf_len(chars) != 0) {
-        buf_push(insertLines, ((Line) { chars }));
-        ++currentLine;
+    char *pasteRest = NULL; // What a paste left after its last line break, to go on with on the next line
+    while ((chars = getInputLines(&inputCanceled, chars, &pasteRest)) != NULL && buf_len(chars) != 0) {
+        // A paste can give back a lot of lines at once. They go into the buffer's line storage in one go.
+        int firstNew = buf_len(insertLines);
+        buffer_splitLines(currentBuffer, chars, buf_len(chars), &insertLines);
+        int added = buf_len(insertLines) - firstNew;
+        currentLine += added;
+        if (added > 1 || pasteRest != NULL)
+            colors_printf(COLOR_CYAN, "Pasted %d line(s)\n", added);
         
-        // Count number of tabs at start of line for autoindentation of next line
+        // The lines being typed in aren't in the buffer yet, so their braces are counted here
         // TODO: Make work with spaces.
-        int whitespaceCount = 0;
-        char *start = chars;
-        while (*start == '\t') {
-            ++whitespaceCount;
-            ++start;
-            if (start - chars > buf_len(chars)) break;
-        }
-        
-        int scopeOpeningCount = 0;
-        while (start - chars <= buf_len(chars)) {
-            if (*start == '{') {
-                ++scopeOpeningCount;
-            } else if (*start == '}')
-                --scopeOpeningCount;
-            ++start;
+        buf_pop_all(chars);
+        if (autoIndent) {
+            Token *tokens = NULL;
+            for (int i = firstNew; i < buf_len(insertLines); i++) {
+                Line *typed = &(insertLines[i]);
+                if (tokens != NULL)
+                    buf_pop_all(tokens);
+                lexState = lexer_lexLine(currentBuffer->fileType, line_chars(typed), line_length(typed), lexState, &tokens);
+                depth += lexer_countBraces(line_chars(typed), line_length(typed), tokens);
+            }
+            buf_free(tokens);
         }
-        if (scopeOpeningCount < 0) scopeOpeningCount = 0;
-        whitespaceCount += scopeOpeningCount;
-        
-        chars = NULL;
-        
-        // If C, C++, or C_HEADER files, autoindent
-        if (currentBuffer->fileType == FT_C || currentBuffer->fileType == FT_CPP || currentBuffer->fileType == FT_C_HEADER || currentBuffer->fileType == FT_UNKNOWN) {
-            for (int i = 0; i < whitespaceCount; i++) {
+        if (pasteRest != NULL) {
+            // Pasted text isn't indented
+            buf_free(chars);
+            chars = pasteRest;
+        } else if (autoIndent) {
+            for (int i = 0; i < depth; i++) {
                 buf_push(chars, '\t');
             }
         }
@@ -961,6 +1403,8 @@ internal Line *multiLineEditor(int previousLine, Line *insertLines, bool *cancel
     
     if (inputCanceled) {
         buf_free(chars);
+        buffer_releaseLines(currentBuffer, insertLines);
+        buf_free(insertLines);
         // Cancel the operation by returning
         (*canceled) = true;
         return NULL;
@@ -985,7 +1429,12 @@ internal void editorState_printHelpScreen() {
     /* Edit - rewrite a specific line, group of lines, group of characters in a line (given column numbers), and word/group of words */
     //printf(" * 'e' - Edit\n");
     printf(" * '#' - Gives back information on the file, including number of lines, filename, number of characters, filetype, etc.\n");
+    printf(" * '@' or 'stats' - Shows how much memory each open buffer uses (in KB) for its lines, lexer tokens, outline, bookmarks, undo history, and indexes\n");
+    printf(" * 'compact' - Gives back the memory the open buffers aren't using, like what's left over after deleting lines\n");
     printf(" * 'j (line#)' - Set's current line to line number (no output). Use 'j$' to set last line as current line.\n");
+    printf(" * '%% (line#)' - Jumps to the line with the brace that matches the one opened or closed on the line\n");
+    printf(" * 'J (symbol)' - Jumps to the definition of a function, class, namespace, or heading in the outline. If it's not in the current file, the symbol database is used and the file it's in is opened.\n");
+    printf(" * 'tags (directory)' - Creates or updates the symbol database for all C/C++ files in the directory (the current directory by default)\n");
     printf(" * 'a (line#)' - Insert after the line number\n");
     printf(" * 'i (line#)' - Insert before the line number\n");
     printf(" * 'A (line#)' - Appends to a line\n");
@@ -997,7 +1446,12 @@ internal void editorState_printHelpScreen() {
     printf(" * 'M (line#)' - Move the line down by one\n");
     printf(" * 'f (string)' - Finds the first occurance of the string in the file and prints the line it's on out\n");
     printf(" * 'F (line#) (string)' - Find the first occurance of the string in the line and print the line out showing you where the occurance is\n");
-    printf(" * 'u' - Undo the last operation, cannot undo an undo, cannot undo past 1 operation - UNIMPLEMENTED\n"); // TODO
+    printf(" * 'u (count)' - Undo the last change (or the last count changes)\n");
+    printf(" * 'U (count)' - Redo the last change that was undone (or the last count of them)\n");
+    printf(" * 'checkpoint (name)' - Save the current state of the buffer as a named checkpoint. Lists the checkpoints if no name given.\n");
+    printf(" * 'checkout (name)' - Restore the buffer to a checkpoint\n");
+    printf(" * 'compare (name) (name)' - List the changes from one checkpoint to another (or to the current state)\n");
+    printf(" * 'forget (name)' - Remove a checkpoint\n");
     printf(" * 'c' - Continue from last line; Append to end of file\n");
     printf(" * 'p (line#:start)' - Preview whole file (optionally starting at given line)\n");
     printf(" * 'P (line#:start):(line#:end)' - Preview a line or set of lines, including the line before and after\n");
@@ -1006,15 +1460,17 @@ internal void editorState_printHelpScreen() {
     printf(" * 'bn' - Switch current buffer to next buffer. Will wrap around when hits end.\n");
     printf(" * 'bp' - Switch current buffer to previous buffer. Will wrap around when hits beginning.\n");
     printf(" * 'd(line#:start):(line#:end) (string)' - Create bookmark with line range start:end and name string\n");
+    printf(" * 'D (string)' - Delete the bookmark with name string\n");
     printf(" * 'w (string)' - Print out line range of bookmark with name string\n");
     printf(" * 'g' - List out all bookmarks\n");
-    printf(" * 'o' - Open file in new buffer\n");
+    printf(" * 'o' - Open file in new buffer. Use 'o '(symbol)' to open the file a symbol is defined in.\n");
     printf(" * 'n' - Create new file in new buffer\n");
     printf(" * 's' - Save current buffer\n");
     //printf(" * 'S' - Save all buffers\n"); // TODO
     printf(" * 'e / E' - Exit current buffer / Exit current buffer (without save)\n");
     printf(" * 'q / Q' - Quit, closing all buffers / Quit, closing all buffers (without save)\n");
     printf("\nAny command that accepts a line number or line range - denoted by '(line#:start):(line#:end)' - can also accept a bookmark. Bookmarks are prefixed with '#'. Example: 'P #test'.\n");
+    printf("A line number can also be the name of a definition in the outline, prefixed with a single quote. On its own, it stands for all of the definition's lines. Example: 'P 'main'.\n");
 }
 
 // Editor - will allow user to type in anything, showing line number at start of new lines. To exit the editor, press Ctrl-D on Linux or Ctrl-Z+Enter on Windows. As each new line is entered, the characters will be added to a char pointer streatchy buffer (dynamic array). Then, this line will be added to the streatchy buffer of lines (called 'lines').
@@ -1029,10 +1485,14 @@ void editorState_editor(void) {
     //}
     
     bool canceled = false;
-    currentBuffer->lines = multiLineEditor(0, NULL, &canceled, 0);
+    Line *insertLines = multiLineEditor(0, NULL, &canceled, 0);
     if (canceled) {
         // TODO: close the buffer?
+    } else if (buf_len(insertLines) > 0) {
+        // Go through the buffer so the new lines are given ids
+        buffer_insertAfterLine(currentBuffer, 0, insertLines);
     }
+    buf_free(insertLines);
     printf("\n");
     
     // Set cursor to end of file
@@ -1055,7 +1515,7 @@ internal void editorState_insertAfter(lineRange line_range) {
     Line *insertLines = multiLineEditor(currentLine - 1, NULL, &canceled, InsertAfter);
     if (canceled) {
         for (int i = 0; i < buf_len(insertLines); i++) {
-            buf_free(insertLines[i].chars);
+            buf_free(insertLines[i].text.chars);
         }
         buf_free(insertLines);
         return;
@@ -1100,7 +1560,7 @@ internal void editorState_insertBefore(lineRange line_range) {
     Line *insertLines = multiLineEditor(currentLine - 1, NULL, &canceled, InsertBefore);
     if (canceled) {
         for (int i = 0; i < buf_len(insertLines); i++) {
-            buf_free(insertLines[i].chars);
+            buf_free(insertLines[i].text.chars);
         }
         buf_free(insertLines);
         return;
@@ -1520,6 +1980,8 @@ void printText(int startLine) {
     int offset = startLine;
     char c;
     
+    // Each page (with the prompt after it) goes out in one write
+    output_beginFrame();
     for (int line = offset; line < linesAtATime + offset + 1 && line <= buf_len(currentBuffer->lines); line++) {
         if (line == buf_len(currentBuffer->lines)) {
             if (line + 1 == currentBuffer->currentLine)
@@ -1531,59 +1993,65 @@ void printText(int startLine) {
     }
     offset = linesAtATime + offset + 1;
     if (offset >= buf_len(currentBuffer->lines)) {
-        printf("\n");
+        output_char('\n');
+        output_endFrame();
         return;
     }
     printPrompt("\n<%d: %s|preview> ", currentBuffer - buffers, currentBuffer->openedFilename);
+    output_endFrame();
     
     bool forward = true;
     while ((c = getch()) != EOF && offset < buf_len(currentBuffer->lines))
     {
+        output_beginFrame();
         if (c == '?') {
             // Print help info about preview command here
-            printf("\nPreviewing '%s'\n", currentBuffer->openedFilename);
-            printf(" * 'q' or Ctrl-X to stop previewing\n");
-            printf(" * 'Q' to exit the whole program\n");
-            printf(" * Enter/'n' to show the next lines\n");
-            printf(" * 'p' to show previous lines");
-            printf(" * 'j' start showing lines from given line number (TODO)"); // TODO
-            printf(" * 'f' find first occurance of string in file and jump there (TODO)"); // TODO
+            output_printf("\nPreviewing '%s'\n", currentBuffer->openedFilename);
+            output_string(" * 'q' or Ctrl-X to stop previewing\n");
+            output_string(" * 'Q' to exit the whole program\n");
+            output_string(" * Enter/'n' to show the next lines\n");
+            output_string(" * 'p' to show previous lines");
+            output_string(" * 'j' start showing lines from given line number (TODO)"); // TODO
+            output_string(" * 'f' find first occurance of string in file and jump there (TODO)"); // TODO
             
             printPrompt("\n<%d: %s|preview> ", currentBuffer - buffers, currentBuffer->openedFilename);
+            output_endFrame();
             continue;
         } else if (c == 'p') {
             if (forward) {
-                printf("\r");
+                output_char('\r');
                 for (int i = 0; i < 45; i++) { // TODO: Hacky
-                    printf(" ");
+                    output_char(' ');
                 }
-                printf("\r");
-                printf("--^-^-^-^-^--\n\n");
+                output_char('\r');
+                output_string("--^-^-^-^-^--\n\n");
             }
             offset = offset - (linesAtATime * 2) - 2;
             if (offset < 0) offset = 0;
             forward = false;
         } else if (c == 'q' || c == 24) { // 26 is Ctrl-X, aka CANCEL
+            output_endFrame();
             break;
         } else if (c == 'Q') {
+            output_endFrame();
             exit(0);
         } else {
             if (!forward) {
-                printf("\r");
+                output_char('\r');
                 for (int i = 0; i < 45; i++) { // TODO: Hacky
-                    printf(" ");
+                    output_char(' ');
                 }
-                printf("\r");
-                printf("--v-v-v-v-v--\n\n");
+                output_char('\r');
+                output_string("--v-v-v-v-v--\n\n");
             }
             forward = true;
         }
         
-        printf("\r");
+        output_char('\r');
         for (int i = 0; i < 45; i++) { // TODO: Hacky
-            printf(" ");
+            output_char(' ');
         }
-        printf("\r");
+        output_char('\r');
         for (int line = offset; line < linesAtATime + offset + 1 && line <= buf_len(currentBuffer->lines); line++) {
             if (line == buf_len(currentBuffer->lines)) {
                 if (line + 1 == currentBuffer->currentLine)
@@ -1596,9 +2064,11 @@ void printText(int startLine) {
         
         offset = offset + linesAtATime + 1;
         if (offset >= buf_len(currentBuffer->lines)) {
+            output_endFrame();
             break;
         }
         printPrompt("\n<%d: %s|preview> ", currentBuffer - buffers, currentBuffer->openedFilename);
+        output_endFrame();
     }
     
     printf("\n");
@@ -1610,6 +2080,7 @@ Pass false into printNewLine so the new line at the end is not printed
 */
 void printLine(int line, char operation, int printNewLine) {
     if (line == -1) line = currentBuffer->currentLine;
+    output_beginFrame();
     // If no lines in buffer and line is 0, show one line.
     if (buf_len(currentBuffer->lines) <= 0 && line == 0) {
         if (operation != 0)
@@ -1617,7 +2088,8 @@ void printLine(int line, char operation, int printNewLine) {
         else {
             printLineNumber("%5d ", 1);
         }
-        printf("\n");
+        output_char('\n');
+        output_endFrame();
         return;
     }
     
@@ -1630,9 +2102,11 @@ void printLine(int line, char operation, int printNewLine) {
                 printLineNumber("%c%4d ", '*', line + 1);
             else printLineNumber("%5d ", line + 1);
         }
+        output_endFrame();
         return;
     } else if (line > buf_len(currentBuffer->lines)) {
         // Error!
+        output_endFrame();
         return;
     }
     
@@ -1644,18 +2118,63 @@ void printLine(int line, char operation, int printNewLine) {
         else printLineNumber("%5d ", line + 1);
     }
     
-    int length = buf_len(currentBuffer->lines[line].chars);
+    char *chars = line_chars(&(currentBuffer->lines[line]));
+    int length = line_length(&(currentBuffer->lines[line]));
     // It shouldn't print new line and end of line is a new line, subtract it off from the length
-    if (!printNewLine && currentBuffer->lines[line].chars[length - 1] == '\n')
+    if (!printNewLine && length > 0 && chars[length - 1] == '\n')
         --length;
     
-    //printf("%.*s", length, currentBuffer->lines[line].chars);
+    // Syntax highlighting. Only this line gets lexed (after the states of the lines before it, which are cached).
+    Token *tokens = lexer_getTokens(currentBuffer, line);
+    int token_i = 0;
+    int color = -1;
+    
+    //printf("%.*s", length, chars);
     for (int i = 0; i < length; i++) {
-        if (currentBuffer->lines[line].chars[i] == '\t')
-            printf("    "); // 4 spaces // TODO: Add setting for this
-        else if (currentBuffer->lines[line].chars[i] == INPUT_ESC)
+        if (color != -1 && i >= tokens[token_i].start + tokens[token_i].length) {
+            resetColor();
+            color = -1;
+        }
+        while (token_i < buf_len(tokens) && tokens[token_i].start + tokens[token_i].length <= i)
+            ++token_i;
+        if (color == -1 && token_i < buf_len(tokens) && tokens[token_i].start <= i) {
+            color = tokenColor(&tokens[token_i]);
+            if (color != -1) setColor(color);
+        }
+        
+        if (chars[i] == '\t')
+            output_write("    ", 4); // 4 spaces // TODO: Add setting for this
+        else if (chars[i] == INPUT_ESC) {
             colors_printf(COLOR_RED, "$");
-        else putchar(currentBuffer->lines[line].chars[i]);
+            if (color != -1) setColor(color);
+        } else output_char(chars[i]);
+    }
+    if (color != -1)
+        resetColor();
+    output_endFrame();
+}
+
+// Color a token is highlighted with, -1 for none
+internal int tokenColor(Token *token) {
+    switch (token->kind) {
+        case TOKEN_KEYWORD:
+        case TOKEN_PREPROCESSOR:
+        return COLOR_MAGENTA;
+        case TOKEN_TYPE:
+        case TOKEN_HEADING:
+        case TOKEN_VARIABLE:
+        return COLOR_CYAN;
+        case TOKEN_NUMBER:
+        case TOKEN_EMPHASIS:
+        return COLOR_YELLOW;
+        case TOKEN_STRING:
+        case TOKEN_CHAR:
+        return COLOR_GREEN;
+        case TOKEN_COMMENT:
+        case TOKEN_LINK:
+        return COLOR_BLUE;
+        default:
+        return (token->flags & TOKEN_FLAG_PREPROCESSOR) ? COLOR_MAGENTA : -1;
     }
 }
 
@@ -1668,20 +2187,15 @@ void printFileInfo(void) {
     if (numOfLines != 0) {
         // If last character of last line ends with a new line, add one to the number of lines
         Line lastLine = currentBuffer->lines[buf_len(currentBuffer->lines) - 1];
-        char lastChar = lastLine.chars[buf_len(lastLine.chars) - 1];
+        char lastChar = line_chars(&lastLine)[line_length(&lastLine) - 1];
         if (lastChar == '\n') {
             numOfLines++;
         }
     }
     printf("Number of Lines: %d\n", numOfLines);
     
-    // If markdown file, print outline
-    if (currentBuffer->fileType == FT_MARKDOWN) {
-        if (buf_len(currentBuffer->outline.markdown_nodes) > 0)
-            printf("Outline:\n");
-    } else if (currentBuffer->fileType == FT_C) {
-        if (buf_len(currentBuffer->outline.c_nodes) > 0)
-            printf("Outline:\n");
-    }
+    // Print outline, if the filetype has one
+    if (buf_len(currentBuffer->outline) > 0)
+        printf("Outline:\n");
     showOutline();
 }
@@ -0,0 +1,349 @@
+#ifndef _WIN32
+#define _XOPEN_SOURCE 700 // realpath isn't declared in plain C99 mode
+#endif
+
+#include "edimcoder.h"
+
+// Per-file state store. When a buffer is closed, its bookmarks and current line are saved to ~/.edimstate
+// (or the file in EDIM_STATE_FILE), keyed by the file's absolute path, and they're restored when the file is opened again.
+//
+// The store is one file, so it doesn't leave anything next to the files, and it's laid out so that a lookup only
+// reads a few small pieces of it no matter how many files it has:
+//   FileStateHeader
+//   FileStateSlot[slotCount] - open addressing hash table of path hashes, probed linearly
+//   Records, each a FileStateRecord followed by the path, and then each bookmark as a FileStateBookmark and its name
+// Saving appends the file's new record and points its slot at it. The old record is left behind until the
+// store is rewritten, which happens when the table gets half full or most of the records are old ones.
+
+#define FILESTATE_VERSION 2
+#define FILESTATE_FILENAME ".edimstate"
+#define FILESTATE_MIN_SLOTS 64
+
+typedef struct FileStateHeader {
+    char magic[8]; // "EDIMSTAT"
+    uint32_t version;
+    uint32_t slotCount; // Power of two
+    uint32_t usedCount;
+    uint32_t reserved;
+    uint64_t dataSize; // Bytes of records after the slots, including the old ones
+    uint64_t liveSize; // Bytes of the records the slots point to
+} FileStateHeader;
+
+typedef struct FileStateSlot {
+    uint64_t pathHash; // 0 if the slot is empty
+    uint64_t offset; // Of the record, from the start of the store
+} FileStateSlot;
+
+typedef struct FileStateRecord {
+    uint32_t size; // Of the whole record
+    uint32_t pathLength;
+    int32_t currentLine;
+    uint32_t bookmarkCount;
+} FileStateRecord;
+
+typedef struct FileStateBookmark {
+    int32_t start;
+    int32_t end;
+    uint32_t nameLength;
+} FileStateBookmark;
+
+// Returns a zero-terminated char stretchy buffer, or NULL if there's nowhere to put the store
+internal char *storePath(void) {
+    char *path = NULL;
+    char *override = getenv("EDIM_STATE_FILE");
+    if (override != NULL && *override != '\0') {
+        memcpy(buf_add(path, strlen(override) + 1), override, strlen(override) + 1);
+        return path;
+    }
+
+    char *home = getenv("HOME");
+#ifdef _WIN32
+    if (home == NULL || *home == '\0')
+        home = getenv("USERPROFILE");
+#endif
+    if (home == NULL || *home == '\0')
+        return NULL;
+    int homeLength = (int) strlen(home);
+    memcpy(buf_add(path, homeLength), home, homeLength);
+    if (home[homeLength - 1] != '/' && home[homeLength - 1] != '\\')
+        buf_push(path, '/');
+    memcpy(buf_add(path, sizeof(FILESTATE_FILENAME)), FILESTATE_FILENAME, sizeof(FILESTATE_FILENAME)); // Includes the '\0'
+    return path;
+}
+
+// The key for the buffer's file: its absolute path, as a char stretchy buffer (not zero-terminated).
+// NULL if the buffer isn't from a file, or the file doesn't exist (it was never saved).
+internal char *keyOfBuffer(Buffer *buffer) {
+    int length = buf_len(buffer->openedFilename);
+    if (length <= 1 || buffer->openedFilename[length - 1] != '\0')
+        return NULL;
+
+#ifdef _WIN32
+    char *absolute = _fullpath(NULL, buffer->openedFilename, 0);
+#else
+    char *absolute = realpath(buffer->openedFilename, NULL);
+#endif
+    if (absolute == NULL)
+        return NULL;
+    char *key = NULL;
+    memcpy(buf_add(key, strlen(absolute)), absolute, strlen(absolute));
+    free(absolute);
+    return key;
+}
+
+internal uint64_t hashKey(char *key) {
+    uint64_t hash = hash_bytes(key, buf_len(key));
+    return hash ? hash : 1; // 0 marks an empty slot
+}
+
+internal size_t slotsOffset(uint32_t index) {
+    return sizeof(FileStateHeader) + (size_t) index * sizeof(FileStateSlot);
+}
+
+internal bool readAt(FILE *fp, size_t offset, void *data, size_t size) {
+    return fseek(fp, (long) offset, SEEK_SET) == 0 && fread(data, 1, size, fp) == size;
+}
+
+internal bool writeAt(FILE *fp, size_t offset, const void *data, size_t size) {
+    return fseek(fp, (long) offset, SEEK_SET) == 0 && fwrite(data, 1, size, fp) == size;
+}
+
+internal bool readHeader(FILE *fp, FileStateHeader *header) {
+    return readAt(fp, 0, header, sizeof(FileStateHeader)) && memcmp(header->magic, "EDIMSTAT", 8) == 0
+        && header->version == FILESTATE_VERSION && IS_POW2(header->slotCount);
+}
+
+// Reads the whole record at offset into a stretchy buffer, or returns NULL if it's not a valid record
+internal char *readRecord(FILE *fp, uint64_t offset) {
+    FileStateRecord record;
+    if (!readAt(fp, offset, &record, sizeof(record)) || record.size < sizeof(record) + record.pathLength)
+        return NULL;
+    char *data = NULL;
+    if (!readAt(fp, offset, buf_add(data, record.size), record.size)) {
+        buf_free(data);
+        return NULL;
+    }
+    return data;
+}
+
+// Returns the index of the key's slot, or of the empty slot where it would go. Sets record to its current record (if it has one).
+internal int64_t findSlot(FILE *fp, FileStateHeader *header, char *key, uint64_t hash, FileStateSlot *slot, char **record) {
+    *record = NULL;
+    uint32_t mask = header->slotCount - 1;
+    for (uint32_t probes = 0, i = (uint32_t) hash & mask; probes < header->slotCount; probes++, i = (i + 1) & mask) {
+        if (!readAt(fp, slotsOffset(i), slot, sizeof(FileStateSlot)))
+            return -1;
+        if (slot->pathHash == 0)
+            return i;
+        if (slot->pathHash != hash)
+            continue;
+
+        // Different paths can have the same hash
+        char *data = readRecord(fp, slot->offset);
+        FileStateRecord *found = (FileStateRecord *) data;
+        if (data != NULL && found->pathLength == buf_len(key) && memcmp(data + sizeof(FileStateRecord), key, buf_len(key)) == 0) {
+            *record = data;
+            return i;
+        }
+        buf_free(data);
+    }
+    return -1;
+}
+
+// Builds the record for the buffer's state
+internal char *makeRecord(Buffer *buffer, char *key) {
+    char *data = NULL;
+    FileStateRecord record = {0};
+    record.pathLength = buf_len(key);
+    record.currentLine = buffer->currentLine;
+    record.bookmarkCount = buf_len(buffer->bookmarks);
+    memcpy(buf_add(data, sizeof(record)), &record, sizeof(record));
+    memcpy(buf_add(data, buf_len(key)), key, buf_len(key));
+
+    bookmarks_updateRanges(buffer);
+    for (int i = 0; i < buf_len(buffer->bookmarks); i++) {
+        Bookmark *bookmark = &buffer->bookmarks[i];
+        FileStateBookmark saved;
+        saved.start = bookmark->range.start;
+        saved.end = bookmark->range.end;
+        saved.nameLength = (uint32_t) strlen(bookmark->name);
+        memcpy(buf_add(data, sizeof(saved)), &saved, sizeof(saved));
+        if (saved.nameLength > 0)
+            memcpy(buf_add(data, saved.nameLength), bookmark->name, saved.nameLength);
+    }
+    ((FileStateRecord *) data)->size = buf_len(data);
+    return data;
+}
+
+// Writes a new store with the records of the old one (fp, if not NULL) in a table of slotCount slots.
+// fp is always closed, whether or not the new store could be written.
+internal bool rewriteStore(const char *path, FILE *fp, FileStateHeader *old, uint32_t slotCount) {
+    char *tempPath = NULL;
+    int pathLength = (int) strlen(path);
+    memcpy(buf_add(tempPath, pathLength), path, pathLength);
+    memcpy(buf_add(tempPath, sizeof(".tmp")), ".tmp", sizeof(".tmp"));
+
+    FILE *out = fopen(tempPath, "wb");
+    bool success = (out != NULL);
+    if (success) {
+        FileStateHeader header = {0};
+        memcpy(header.magic, "EDIMSTAT", 8);
+        header.version = FILESTATE_VERSION;
+        header.slotCount = slotCount;
+        FileStateSlot *slots = xcalloc(slotCount, sizeof(FileStateSlot));
+        size_t offset = slotsOffset(slotCount);
+        fseek(out, (long) offset, SEEK_SET);
+
+        for (uint32_t i = 0; fp != NULL && i < old->slotCount; i++) {
+            FileStateSlot slot;
+            if (!readAt(fp, slotsOffset(i), &slot, sizeof(slot)) || slot.pathHash == 0)
+                continue;
+            char *record = readRecord(fp, slot.offset);
+            if (record == NULL)
+                continue;
+            uint32_t j = (uint32_t) slot.pathHash & (slotCount - 1);
+            while (slots[j].pathHash != 0)
+                j = (j + 1) & (slotCount - 1);
+            slots[j].pathHash = slot.pathHash;
+            slots[j].offset = offset;
+            fwrite(record, 1, buf_len(record), out);
+            offset += buf_len(record);
+            header.usedCount++;
+            header.dataSize += buf_len(record);
+            buf_free(record);
+        }
+        header.liveSize = header.dataSize;
+
+        success = writeAt(out, 0, &header, sizeof(header)) && writeAt(out, slotsOffset(0), slots, slotCount * sizeof(FileStateSlot));
+        xfree(slots);
+        success = !ferror(out) && success;
+        success = (fclose(out) == 0) && success;
+    }
+    // Closed before the rename, which can't replace a file that's open on Windows
+    if (fp != NULL)
+        fclose(fp);
+    if (success) {
+#ifdef _WIN32
+        remove(path); // rename doesn't replace existing files on Windows
+#endif
+        success = (rename(tempPath, path) == 0);
+    }
+    if (!success)
+        remove(tempPath);
+    buf_free(tempPath);
+    return success;
+}
+
+// Sets the buffer's current line and bookmarks to what they were the last time the file was closed
+void fileState_restore(Buffer *buffer) {
+    char *path = storePath();
+    char *key = (path != NULL) ? keyOfBuffer(buffer) : NULL;
+    FILE *fp = (key != NULL) ? fopen(path, "rb") : NULL;
+    buf_free(path);
+    if (fp == NULL) {
+        buf_free(key);
+        return;
+    }
+
+    FileStateHeader header;
+    FileStateSlot slot;
+    char *data = NULL;
+    if (readHeader(fp, &header))
+        findSlot(fp, &header, key, hashKey(key), &slot, &data);
+    fclose(fp);
+    buf_free(key);
+    if (data == NULL)
+        return;
+
+    // The file could have been changed by something else since, so everything is clamped to its lines
+    int lineCount = buf_len(buffer->lines);
+    FileStateRecord *record = (FileStateRecord *) data;
+    buffer->currentLine = CLAMP_MIN(CLAMP_MAX(record->currentLine, lineCount), 0);
+
+    char *current = data + sizeof(FileStateRecord) + record->pathLength;
+    char *end = data + record->size;
+    for (uint32_t i = 0; i < record->bookmarkCount && current + sizeof(FileStateBookmark) <= end; i++) {
+        FileStateBookmark saved;
+        memcpy(&saved, current, sizeof(saved));
+        current += sizeof(saved);
+        if (saved.nameLength > (size_t) (end - current))
+            break;
+
+        pString name = { current, current + saved.nameLength };
+        lineRange range;
+        range.start = CLAMP_MIN(CLAMP_MAX(saved.start, lineCount), 0);
+        range.end = CLAMP_MIN(CLAMP_MAX(saved.end, lineCount), 0);
+        if (saved.nameLength > 0)
+            add_bookmark(buffer, name, range);
+        current += saved.nameLength;
+    }
+    buf_free(data);
+}
+
+// Saves the buffer's current line and bookmarks for the next time the file is opened.
+// Nothing is saved if the buffer has unsaved changes, since the lines wouldn't match the file.
+void fileState_save(Buffer *buffer) {
+    if (buffer->modified)
+        return;
+    char *path = storePath();
+    char *key = (path != NULL) ? keyOfBuffer(buffer) : NULL;
+    if (key == NULL) {
+        buf_free(path);
+        return;
+    }
+    uint64_t hash = hashKey(key);
+    char *record = makeRecord(buffer, key);
+
+    for (int attempt = 0; attempt < 2; attempt++) {
+        FILE *fp = fopen(path, "r+b");
+        FileStateHeader header;
+        if (fp == NULL || !readHeader(fp, &header)) {
+            // No store yet (or one from another version)
+            FileStateHeader empty = {0};
+            if (fp != NULL)
+                fclose(fp);
+            if (!rewriteStore(path, NULL, &empty, FILESTATE_MIN_SLOTS))
+                break;
+            continue;
+        }
+
+        FileStateSlot slot;
+        char *oldRecord = NULL;
+        int64_t index = findSlot(fp, &header, key, hash, &slot, &oldRecord);
+        bool isNew = (oldRecord == NULL);
+        uint64_t oldSize = isNew ? 0 : buf_len(oldRecord);
+        buf_free(oldRecord);
+
+        // Grow the table before it gets more than half full, and drop the old records once they're most of the store
+        bool tooFull = isNew && 2 * (header.usedCount + 1) > header.slotCount;
+        bool tooSparse = header.dataSize > 64 * 1024 && header.liveSize * 2 < header.dataSize;
+        if (attempt == 0 && (index < 0 || tooFull || tooSparse)) {
+            uint32_t slotCount = header.slotCount;
+            while (2 * (header.usedCount + 1) > slotCount)
+                slotCount *= 2;
+            rewriteStore(path, fp, &header, slotCount);
+            continue;
+        }
+        if (index < 0) {
+            fclose(fp);
+            break;
+        }
+
+        // The record goes at the end, then the slot points to it, then the header counts it
+        slot.pathHash = hash;
+        slot.offset = slotsOffset(header.slotCount) + header.dataSize;
+        header.dataSize += buf_len(record);
+        header.liveSize += buf_len(record) - oldSize;
+        if (isNew)
+            header.usedCount++;
+        writeAt(fp, slot.offset, record, buf_len(record));
+        writeAt(fp, slotsOffset((uint32_t) index), &slot, sizeof(slot));
+        writeAt(fp, 0, &header, sizeof(header));
+        fclose(fp);
+        break;
+    }
+
+    buf_free(record);
+    buf_free(key);
+    buf_free(path);
+}
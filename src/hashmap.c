@@ -1,4 +1,10 @@
 #include "edimcoder.h"
+#include <time.h>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define SWISSMAP_SSE2
+#include <emmintrin.h>
+#endif
 
 uint64_t hash_uint64(uint64_t x) {
     x *= 0xff51afd7ed558ccd;
@@ -17,15 +23,77 @@ uint64_t hash_mix(uint64_t x, uint64_t y) {
     return x;
 }
 
+// Multiplies a and b into 128 bits and folds the halves together
+internal uint64_t hash_mum(uint64_t a, uint64_t b) {
+#if defined(__SIZEOF_INT128__)
+    __uint128_t r = (__uint128_t) a * b;
+    return (uint64_t) r ^ (uint64_t) (r >> 64);
+#else
+    uint64_t aHigh = a >> 32, aLow = (uint32_t) a;
+    uint64_t bHigh = b >> 32, bLow = (uint32_t) b;
+    uint64_t lowLow = aLow * bLow, lowHigh = aLow * bHigh, highLow = aHigh * bLow, highHigh = aHigh * bHigh;
+    uint64_t middle = (lowLow >> 32) + (uint32_t) lowHigh + (uint32_t) highLow;
+    uint64_t low = (middle << 32) | (uint32_t) lowLow;
+    uint64_t high = highHigh + (lowHigh >> 32) + (highLow >> 32) + (middle >> 32);
+    return low ^ high;
+#endif
+}
+
+internal uint64_t hash_read64(const uint8_t *p) {
+    uint64_t x;
+    memcpy(&x, p, 8);
+    return x;
+}
+
+internal uint64_t hash_read32(const uint8_t *p) {
+    uint32_t x;
+    memcpy(&x, p, 4);
+    return x;
+}
+
+// Hashes 8 bytes at a time (in the style of wyhash): each pair of words is multiplied together into 128 bits and
+// folded, and long inputs run three of those in parallel. Keys of up to 16 bytes (most identifiers) take a
+// couple of overlapping reads and no loop at all.
 uint64_t hash_bytes(const void *ptr, size_t len) {
-    uint64_t x = 0xcbf29ce484222325;
-    const char *buf = (const char *)ptr;
-    for (size_t i = 0; i < len; i++) {
-        x ^= buf[i];
-        x *= 0x100000001b3;
-        x ^= x >> 32;
+    static const uint64_t secret[4] = { 0x2d358dccaa6c78a5ull, 0x8bb84b93962eacc9ull, 0x4b33a62ed433d4a3ull, 0x4d5a2da51de1aa47ull };
+    const uint8_t *p = (const uint8_t *)ptr;
+    uint64_t seed = hash_mum(secret[0] ^ 0xcbf29ce484222325ull, secret[1]);
+    uint64_t a, b;
+    if (len <= 16) {
+        if (len >= 4) {
+            // Two overlapping 4-byte reads from each end
+            size_t offset = (len >> 3) << 2;
+            a = (hash_read32(p) << 32) | hash_read32(p + offset);
+            b = (hash_read32(p + len - 4) << 32) | hash_read32(p + len - 4 - offset);
+        } else if (len > 0) {
+            a = ((uint64_t)p[0] << 16) | ((uint64_t)p[len >> 1] << 8) | p[len - 1];
+            b = 0;
+        } else {
+            a = b = 0;
+        }
+    } else {
+        size_t i = len;
+        if (i > 48) {
+            uint64_t seed1 = seed, seed2 = seed;
+            do {
+                seed = hash_mum(hash_read64(p) ^ secret[1], hash_read64(p + 8) ^ seed);
+                seed1 = hash_mum(hash_read64(p + 16) ^ secret[2], hash_read64(p + 24) ^ seed1);
+                seed2 = hash_mum(hash_read64(p + 32) ^ secret[3], hash_read64(p + 40) ^ seed2);
+                p += 48;
+                i -= 48;
+            } while (i > 48);
+            seed ^= seed1 ^ seed2;
+        }
+        while (i > 16) {
+            seed = hash_mum(hash_read64(p) ^ secret[1], hash_read64(p + 8) ^ seed);
+            p += 16;
+            i -= 16;
+        }
+        // The last 16 bytes, overlapping what was already hashed if needed
+        a = hash_read64(p + i - 16);
+        b = hash_read64(p + i - 8);
     }
-    return x;
+    return hash_mum(hash_mum(a ^ secret[1], b ^ seed) ^ secret[0] ^ len, secret[1]);
 }
 
 // ----------------------
@@ -61,11 +129,16 @@ void map_grow(Map *map, size_t new_cap) {
             map_put_uint64_from_uint64(&new_map, map->keys[i], map->vals[i]);
         }
     }
-    free((void *)map->keys);
-    free(map->vals);
+    xfree((void *)map->keys);
+    xfree(map->vals);
     *map = new_map;
 }
 
+// Bytes allocated for the map
+size_t map_memory(Map *map) {
+    return map->cap * 2 * sizeof(uint64_t);
+}
+
 void map_put_uint64_from_uint64(Map *map, uint64_t key, uint64_t val) {
     assert(key);
     if (!val) {
@@ -116,14 +189,696 @@ void map_put_uint64(Map *map, void *key, uint64_t val) {
     map_put_uint64_from_uint64(map, (uint64_t)(uintptr_t)key, val);
 }
 
+// Random numbers for map_test and map_benchmark (never 0, which Map can't have as a key)
+internal uint64_t map_random(uint64_t *state) {
+    *state += 0x9e3779b97f4a7c15ull;
+    uint64_t x = *state;
+    x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ull;
+    x = (x ^ (x >> 27)) * 0x94d049bb133111ebull;
+    x ^= x >> 31;
+    return x ? x : 1;
+}
+
+// Checks Map and SwissMap against what was put in them, with sequential and random keys, overwrites, misses,
+// and (for SwissMap) keys being removed and put back while it grows. Stops with fatal on the first mismatch.
 void map_test(void) {
+    enum { N = 1 << 16 };
+    uint64_t random = 1;
+    // Odd indices get sequential keys (which are even), even indices random odd keys, so they never collide
+    uint64_t *keys = xmalloc(N * sizeof(uint64_t));
+    for (size_t i = 0; i < N; i++) {
+        keys[i] = (i & 1) ? i + 1 : (map_random(&random) | 1);
+    }
+    
+    Map map = {0};
+    SwissMap swiss;
+    swissmap_init(&swiss, sizeof(uint64_t), sizeof(uint64_t), NULL, NULL);
+    for (size_t i = 0; i < N; i++) {
+        uint64_t val = i + 1;
+        map_put_uint64_from_uint64(&map, keys[i], val);
+        swissmap_put(&swiss, &keys[i], &val);
+    }
+    if (map.len != N || swiss.len != N)
+        fatal("map_test: %zu keys in Map and %zu in SwissMap, expected %d", map.len, swiss.len, N);
+    
+    for (size_t i = 0; i < N; i++) {
+        uint64_t *val = (uint64_t *) swissmap_get(&swiss, &keys[i]);
+        if (map_get_uint64_from_uint64(&map, keys[i]) != i + 1 || val == NULL || *val != i + 1)
+            fatal("map_test: wrong value for key %zu", i);
+        // Even keys past the sequential ones were never put
+        uint64_t missing = (N + 1 + i) * 2;
+        if (map_get_uint64_from_uint64(&map, missing) != 0 || swissmap_get(&swiss, &missing) != NULL)
+            fatal("map_test: found key %zu that was never put", i);
+    }
+    
+    // Overwrites don't add keys
+    for (size_t i = 0; i < N; i += 3) {
+        uint64_t val = i + 2;
+        map_put_uint64_from_uint64(&map, keys[i], val);
+        swissmap_put(&swiss, &keys[i], &val);
+    }
+    for (size_t i = 0; i < N; i++) {
+        uint64_t expected = (i % 3 == 0) ? i + 2 : i + 1;
+        uint64_t *val = (uint64_t *) swissmap_get(&swiss, &keys[i]);
+        if (map_get_uint64_from_uint64(&map, keys[i]) != expected || val == NULL || *val != expected)
+            fatal("map_test: wrong value for overwritten key %zu", i);
+    }
+    if (map.len != N || swiss.len != N)
+        fatal("map_test: overwriting changed the number of keys");
+    
+    // Churn: remove and put back random keys, while the map also grows with twice as many keys
+    bool *present = xmalloc(2 * N * sizeof(bool));
+    uint64_t *churnKeys = xmalloc(2 * N * sizeof(uint64_t));
+    size_t count = 0;
+    swissmap_clear(&swiss);
+    for (size_t i = 0; i < 2 * N; i++) {
+        churnKeys[i] = map_random(&random);
+        present[i] = false;
+    }
+    for (size_t op = 0; op < 8 * N; op++) {
+        size_t limit = MIN(2 * N, N / 4 + op / 4); // The keys that can be used grow over time
+        size_t i = (size_t)(map_random(&random) % limit);
+        if (present[i]) {
+            if (!swissmap_remove(&swiss, &churnKeys[i]) || swissmap_get(&swiss, &churnKeys[i]) != NULL)
+                fatal("map_test: couldn't remove key %zu", i);
+            present[i] = false;
+            count--;
+        } else {
+            uint64_t val = i;
+            swissmap_put(&swiss, &churnKeys[i], &val);
+            present[i] = true;
+            count++;
+        }
+        if (swiss.len != count)
+            fatal("map_test: %zu keys in SwissMap after churn, expected %zu", swiss.len, count);
+    }
+    for (size_t i = 0; i < 2 * N; i++) {
+        uint64_t *val = (uint64_t *) swissmap_get(&swiss, &churnKeys[i]);
+        if (present[i] ? (val == NULL || *val != i) : (val != NULL))
+            fatal("map_test: key %zu is wrong after churn", i);
+    }
+    
+    // SwissMap can have 0 as a key and a value
+    uint64_t zero = 0;
+    swissmap_put(&swiss, &zero, &zero);
+    uint64_t *zeroVal = (uint64_t *) swissmap_get(&swiss, &zero);
+    if (zeroVal == NULL || *zeroVal != 0 || !swissmap_remove(&swiss, &zero))
+        fatal("map_test: key 0 doesn't work in SwissMap");
+    
+    xfree(map.keys);
+    xfree(map.vals);
+    swissmap_free(&swiss);
+    xfree(keys);
+    xfree(churnKeys);
+    xfree(present);
+}
+
+// Byte-at-a-time FNV-1a, which hash_bytes used to be; kept as the baseline for hash_benchmark
+internal uint64_t hash_bytesFnv(const void *ptr, size_t len) {
+    uint64_t x = 0xcbf29ce484222325;
+    const char *buf = (const char *)ptr;
+    for (size_t i = 0; i < len; i++) {
+        x ^= buf[i];
+        x *= 0x100000001b3;
+        x ^= x >> 32;
+    }
+    return x;
+}
+
+internal void hash_benchmarkKeys(const char *name, char **keys, int keyCount, int rounds) {
+    size_t bytes = 0;
+    for (int i = 0; i < keyCount; i++) {
+        bytes += buf_len(keys[i]);
+    }
+    bytes *= rounds;
+
+    uint64_t (*hashes[2])(const void *, size_t) = { hash_bytes, hash_bytesFnv };
+    const char *hashNames[2] = { "hash_bytes", "fnv" };
+    for (int h = 0; h < 2; h++) {
+        // The sum of all the hashes is printed so the compiler can't drop the loop
+        uint64_t check = 0;
+        clock_t start = clock();
+        for (int round = 0; round < rounds; round++) {
+            for (int i = 0; i < keyCount; i++) {
+                check += hashes[h](keys[i], buf_len(keys[i]));
+            }
+        }
+        double seconds = (double)(clock() - start) / CLOCKS_PER_SEC;
+        double count = (double) keyCount * rounds;
+        printf("%-6s %-10s %8.2f ns/hash %9.1f MB/s  (%016llx)\n", name, hashNames[h],
+               seconds * 1e9 / count, seconds > 0 ? bytes / seconds / (1024 * 1024) : 0.0, (unsigned long long) check);
+    }
+}
+
+// Measures hash_bytes against the old byte-at-a-time hash on short keys (identifiers, 3-24 bytes), whole
+// lines (40-200 bytes) and long 4KB blocks. Run with 'edim --benchmark hash'.
+void hash_benchmark(void) {
+    enum { KEY_COUNT = 4096 };
+    static const char alphabet[] = "abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789_";
+    struct { const char *name; int minLength; int maxLength; int rounds; } kinds[] = {
+        { "short", 3, 24, 2000 },
+        { "line", 40, 200, 200 },
+        { "4k", 4096, 4096, 8 },
+    };
+    uint64_t random = 0x9e3779b97f4a7c15ull;
+    char *keys[KEY_COUNT];
+
+    for (int k = 0; k < (int)(sizeof(kinds) / sizeof(kinds[0])); k++) {
+        for (int i = 0; i < KEY_COUNT; i++) {
+            random = hash_uint64(random);
+            int length = kinds[k].minLength + (int)(random % (kinds[k].maxLength - kinds[k].minLength + 1));
+            keys[i] = NULL;
+            for (int j = 0; j < length; j++) {
+                random = hash_uint64(random);
+                buf_push(keys[i], alphabet[random % (sizeof(alphabet) - 1)]);
+            }
+        }
+        hash_benchmarkKeys(kinds[k].name, keys, KEY_COUNT, kinds[k].rounds);
+        for (int i = 0; i < KEY_COUNT; i++) {
+            buf_free(keys[i]);
+        }
+    }
+}
+
+// ----------------------
+
+// SwissMap keeps a control byte for each slot: SWISSMAP_EMPTY, or the low 7 bits of the key's hash (the rest of the
+// hash picks the slot). A lookup compares SWISSMAP_GROUP control bytes at once (with SSE2 where available) and only
+// compares the keys of the slots whose 7 bits match, so a miss rarely touches a key.
+// Keys go in the first empty slot at or after the one their hash picks (linear probing, a group at a time).
+// Deleting shifts the keys after it back instead of leaving a tombstone, so a table with a lot of churn never
+// gets slower to search and never has to be rebuilt to clean up.
+// The bits of the hash that pick a key's home slot are kept for each full slot, so neither shifting keys
+// back nor growing calls the hash function again.
+
+#define SWISSMAP_GROUP 16
+#define SWISSMAP_EMPTY 0x80
+
+internal inline uint64_t swissmap_hashKey(SwissMap *map, const void *key) {
+    // One multiply for the keys that fit in two words, rather than a call through hash_bytes
+    const uint8_t *p = (const uint8_t *) key;
+    switch (map->keyWords) {
+    case 1:
+        return hash_mum(hash_read64(p) ^ 0x2d358dccaa6c78a5ull, 0x8bb84b93962eacc9ull);
+    case 2:
+        return hash_mum(hash_read64(p) ^ 0x2d358dccaa6c78a5ull, hash_read64(p + 8) ^ 0x8bb84b93962eacc9ull);
+    }
+    return map->hash ? map->hash(key) : hash_bytes(key, map->keySize);
+}
+
+internal bool swissmap_keysEqual(SwissMap *map, const void *a, const void *b) {
+    return map->equal ? map->equal(a, b) : memcmp(a, b, map->keySize) == 0;
+}
+
+internal uint32_t swissmap_home(uint64_t hash) {
+    return (uint32_t) (hash >> 7);
+}
+
+internal char *swissmap_slot(SwissMap *map, size_t i) {
+    return map->slots + i * map->slotSize;
+}
+
+internal void *swissmap_value(SwissMap *map, char *slot) {
+    return slot + ((map->keySize + 7) & ~(size_t) 7);
+}
+
+// Index of the lowest set bit, x can't be 0
+internal int swissmap_lowestBit(uint32_t x) {
+#if defined(__GNUC__) || defined(__clang__)
+    return __builtin_ctz(x);
+#else
+    int bit = 0;
+    while (!(x & 1)) {
+        x >>= 1;
+        bit++;
+    }
+    return bit;
+#endif
+}
+
+// Bit i is set if the control byte at ctrl[i] is byte
+internal uint32_t swissmap_match(const uint8_t *ctrl, uint8_t byte) {
+#ifdef SWISSMAP_SSE2
+    __m128i group = _mm_loadu_si128((const __m128i *) ctrl);
+    return (uint32_t) _mm_movemask_epi8(_mm_cmpeq_epi8(group, _mm_set1_epi8((char) byte)));
+#else
+    // Eight bytes at a time: a byte of x is 0 where the control byte matches
+    uint32_t mask = 0;
+    for (int half = 0; half < 2; half++) {
+        uint64_t word;
+        memcpy(&word, ctrl + half * 8, 8);
+        uint64_t x = word ^ (0x0101010101010101ull * byte);
+        uint64_t zeroes = ~(((x & 0x7f7f7f7f7f7f7f7full) + 0x7f7f7f7f7f7f7f7full) | x | 0x7f7f7f7f7f7f7f7full);
+        // Gather the high bit of each byte into one byte. Assumes a little-endian word.
+        mask |= (uint32_t) (((zeroes >> 7) * 0x0102040810204080ull) >> 56) << (half * 8);
+    }
+    return mask;
+#endif
+}
+
+internal void swissmap_setCtrl(SwissMap *map, size_t i, uint8_t byte) {
+    map->ctrl[i] = byte;
+    // The copy at the end lets a group that starts near the end be loaded without wrapping around
+    if (i < SWISSMAP_GROUP)
+        map->ctrl[map->cap + i] = byte;
+}
+
+// swissmap_find for 8- and 16-byte keys: the key is read once, and each candidate is one or two word compares
+internal inline char *swissmap_findWords(SwissMap *map, const void *key, uint64_t hash) {
+    size_t mask = map->cap - 1;
+    uint8_t h2 = (uint8_t) (hash & 0x7f);
+    uint64_t first = hash_read64((const uint8_t *) key);
+    uint64_t second = (map->keyWords == 2) ? hash_read64((const uint8_t *) key + 8) : 0;
+    for (size_t pos = swissmap_home(hash) & mask;; pos = (pos + SWISSMAP_GROUP) & mask) {
+        const uint8_t *ctrl = map->ctrl + pos;
+        for (uint32_t matches = swissmap_match(ctrl, h2); matches; matches &= matches - 1) {
+            size_t i = (pos + swissmap_lowestBit(matches)) & mask;
+            char *slot = swissmap_slot(map, i);
+            if (hash_read64((uint8_t *) slot) == first && (map->keyWords == 1 || hash_read64((uint8_t *) slot + 8) == second))
+                return slot;
+        }
+        if (swissmap_match(ctrl, SWISSMAP_EMPTY))
+            return NULL;
+    }
+}
+
+// swissmap_find for any other keys
+internal char *swissmap_findBytes(SwissMap *map, const void *key, uint64_t hash) {
+    size_t mask = map->cap - 1;
+    uint8_t h2 = (uint8_t) (hash & 0x7f);
+    for (size_t pos = swissmap_home(hash) & mask;; pos = (pos + SWISSMAP_GROUP) & mask) {
+        const uint8_t *ctrl = map->ctrl + pos;
+        for (uint32_t matches = swissmap_match(ctrl, h2); matches; matches &= matches - 1) {
+            size_t i = (pos + swissmap_lowestBit(matches)) & mask;
+            char *slot = swissmap_slot(map, i);
+            if (swissmap_keysEqual(map, slot, key))
+                return slot;
+        }
+        if (swissmap_match(ctrl, SWISSMAP_EMPTY))
+            return NULL;
+    }
+}
+
+// Returns the slot with the key, or NULL if it's not in the map. A pointer rather than an index, so a caller
+// that only wants the value doesn't have to work out where the slot is again.
+internal inline char *swissmap_find(SwissMap *map, const void *key, uint64_t hash) {
+    return map->keyWords ? swissmap_findWords(map, key, hash) : swissmap_findBytes(map, key, hash);
+}
+
+// Returns the first empty slot at or after the home slot
+internal size_t swissmap_findEmpty(SwissMap *map, uint32_t home) {
+    size_t mask = map->cap - 1;
+    for (size_t pos = home & mask;; pos = (pos + SWISSMAP_GROUP) & mask) {
+        uint32_t empties = swissmap_match(map->ctrl + pos, SWISSMAP_EMPTY);
+        if (empties)
+            return (pos + swissmap_lowestBit(empties)) & mask;
+    }
+}
+
+internal void swissmap_allocate(SwissMap *map, size_t cap) {
+    map->cap = cap;
+    map->len = 0;
+    map->ctrl = xmalloc(cap + SWISSMAP_GROUP);
+    memset(map->ctrl, SWISSMAP_EMPTY, cap + SWISSMAP_GROUP);
+    map->slots = xmalloc(cap * map->slotSize);
+    map->homes = xmalloc(cap * sizeof(uint32_t));
+}
+
+internal void swissmap_grow(SwissMap *map, size_t new_cap) {
+    SwissMap old = *map;
+    swissmap_allocate(map, CLAMP_MIN(new_cap, SWISSMAP_GROUP));
+    for (size_t i = 0; i < old.cap; i++) {
+        if (old.ctrl[i] != SWISSMAP_EMPTY) {
+            size_t j = swissmap_findEmpty(map, old.homes[i]);
+            swissmap_setCtrl(map, j, old.ctrl[i]);
+            map->homes[j] = old.homes[i];
+            memcpy(swissmap_slot(map, j), swissmap_slot(&old, i), map->slotSize);
+            map->len++;
+        }
+    }
+    xfree(old.ctrl);
+    xfree(old.slots);
+    xfree(old.homes);
+}
+
+void swissmap_init(SwissMap *map, size_t keySize, size_t valSize, SwissMapHash hash, SwissMapEqual equal) {
+    memset(map, 0, sizeof(SwissMap));
+    map->keySize = keySize;
+    map->valSize = valSize;
+    // Keep the keys and values aligned to 8 bytes
+    map->slotSize = ((keySize + 7) & ~(size_t) 7) + ((valSize + 7) & ~(size_t) 7);
+    if (hash == NULL && equal == NULL && (keySize == 8 || keySize == 16))
+        map->keyWords = (int) (keySize / 8);
+    map->hash = hash;
+    map->equal = equal;
+}
+
+// Returns a pointer to the key's value (valid until the map changes), or NULL if it's not in the map
+void *swissmap_get(SwissMap *map, const void *key) {
+    if (map->len == 0)
+        return NULL;
+    char *slot = swissmap_find(map, key, swissmap_hashKey(map, key));
+    return slot ? swissmap_value(map, slot) : NULL;
+}
+
+// Adds the key or replaces its value. val can be NULL to leave the value for the caller to fill in through the returned pointer.
+void *swissmap_put(SwissMap *map, const void *key, const void *val) {
+    // At most 7/8 full, so there's always an empty slot to stop a search
+    if (map->cap == 0 || 8 * (map->len + 1) > 7 * map->cap)
+        swissmap_grow(map, 2 * map->cap);
+
+    uint64_t hash = swissmap_hashKey(map, key);
+    char *slot = (map->len > 0) ? swissmap_find(map, key, hash) : NULL;
+    if (slot == NULL) {
+        size_t i = swissmap_findEmpty(map, swissmap_home(hash));
+        swissmap_setCtrl(map, i, (uint8_t) (hash & 0x7f));
+        map->homes[i] = swissmap_home(hash);
+        slot = swissmap_slot(map, i);
+        memcpy(slot, key, map->keySize);
+        map->len++;
+    }
+    void *valPtr = swissmap_value(map, slot);
+    if (val != NULL)
+        memcpy(valPtr, val, map->valSize);
+    return valPtr;
+}
+
+// Returns false if the key wasn't in the map
+bool swissmap_remove(SwissMap *map, const void *key) {
+    if (map->len == 0)
+        return false;
+    char *found = swissmap_find(map, key, swissmap_hashKey(map, key));
+    if (found == NULL)
+        return false;
+
+    // Every slot between a key's home slot and the slot it's in is full. Move keys back into the hole as long
+    // as that stays true, until the next empty slot.
+    size_t mask = map->cap - 1;
+    size_t hole = (size_t) (found - map->slots) / map->slotSize;
+    for (size_t i = (hole + 1) & mask; map->ctrl[i] != SWISSMAP_EMPTY; i = (i + 1) & mask) {
+        size_t home = map->homes[i] & mask;
+        if (((i - home) & mask) >= ((i - hole) & mask)) {
+            swissmap_setCtrl(map, hole, map->ctrl[i]);
+            map->homes[hole] = map->homes[i];
+            memcpy(swissmap_slot(map, hole), swissmap_slot(map, i), map->slotSize);
+            hole = i;
+        }
+    }
+    swissmap_setCtrl(map, hole, SWISSMAP_EMPTY);
+    map->len--;
+    return true;
+}
+
+// Removes all of the keys, keeping the memory
+void swissmap_clear(SwissMap *map) {
+    if (map->ctrl != NULL)
+        memset(map->ctrl, SWISSMAP_EMPTY, map->cap + SWISSMAP_GROUP);
+    map->len = 0;
+}
+
+void swissmap_free(SwissMap *map) {
+    xfree(map->ctrl);
+    xfree(map->slots);
+    xfree(map->homes);
+    swissmap_init(map, map->keySize, map->valSize, map->hash, map->equal);
+}
+
+// Bytes allocated for the map
+size_t swissmap_memory(SwissMap *map) {
+    return map->cap == 0 ? 0 : map->cap + SWISSMAP_GROUP + map->cap * (map->slotSize + sizeof(uint32_t));
+}
+
+// ----------------------
+
+typedef struct InternKey {
+    const char *str;
+    size_t length;
+} InternKey;
+
+internal Arena internArena;
+internal SwissMap interns; // InternKey -> the interned string (the same pointer as the key's str once it's in the map)
+
+internal uint64_t intern_hash(const void *key) {
+    const InternKey *internKey = (const InternKey *) key;
+    return hash_bytes(internKey->str, internKey->length);
+}
+
+internal bool intern_equal(const void *a, const void *b) {
+    const InternKey *keyA = (const InternKey *) a;
+    const InternKey *keyB = (const InternKey *) b;
+    return keyA->length == keyB->length && memcmp(keyA->str, keyB->str, keyA->length) == 0;
+}
+
+// Returns the interned copy of the string, or NULL if it was never interned
+const char *str_intern_find(const char *start, const char *end) {
+    InternKey key = { start, (size_t)(end - start) };
+    const char **interned = (const char **) swissmap_get(&interns, &key);
+    return interned ? *interned : NULL;
+}
+
+const char *str_intern_range(const char *start, const char *end) {
+    const char *interned = str_intern_find(start, end);
+    if (interned != NULL)
+        return interned;
+    if (interns.keySize == 0)
+        swissmap_init(&interns, sizeof(InternKey), sizeof(const char *), intern_hash, intern_equal);
+    
+    size_t length = end - start;
+    char *str = arena_alloc(&internArena, length + 1);
+    memcpy(str, start, length);
+    str[length] = '\0';
+    InternKey key = { str, length };
+    swissmap_put(&interns, &key, &str);
+    return str;
+}
+
+const char *str_intern(const char *str) {
+    return str_intern_range(str, str + strlen(str));
+}
+
+// ----------------------
+
+internal uint64_t benchmarkSink; // Everything that's looked up is added here and printed, so the compiler can't drop the lookups
+
+internal void map_reportTime(const char *name, clock_t start, size_t ops) {
+    double seconds = (double)(clock() - start) / CLOCKS_PER_SEC;
+    printf("  %-34s %8.2f ns/op\n", name, seconds * 1e9 / ops);
+}
+
+internal void map_reportMemory(size_t bytes, size_t len, size_t cap) {
+    printf("  %-34s %8.2f bytes/entry (%zu entries, %.0f%% full)\n", "memory", (double) bytes / len, len, 100.0 * len / cap);
+}
+
+// Inserts count keys and then looks all of them up (in a different order than they were put in), and looks up
+// as many keys that aren't there. misses can't have any of keys in it.
+internal void map_benchmarkMap(const char *title, uint64_t *keys, uint64_t *misses, size_t count) {
+    printf("Map, %s\n", title);
     Map map = {0};
-    enum { N = 1024 };
-    for (size_t i = 1; i < N; i++) {
-        map_put(&map, (void *)i, (void *)(i+1));
+    clock_t start = clock();
+    for (size_t i = 0; i < count; i++) {
+        map_put_uint64_from_uint64(&map, keys[i], i + 1);
+    }
+    map_reportTime("insert", start, count);
+    
+    start = clock();
+    for (size_t i = 0; i < count; i++) {
+        benchmarkSink += map_get_uint64_from_uint64(&map, keys[(i * 7919) % count]);
     }
-    for (size_t i = 1; i < N; i++) {
-        void *val = map_get(&map, (void *)i);
-        assert(val == (void *)(i+1));
+    map_reportTime("get (hit)", start, count);
+    
+    start = clock();
+    for (size_t i = 0; i < count; i++) {
+        benchmarkSink += map_get_uint64_from_uint64(&map, misses[i]);
+    }
+    map_reportTime("get (miss)", start, count);
+    map_reportMemory(map_memory(&map), map.len, map.cap);
+    xfree(map.keys);
+    xfree(map.vals);
+}
+
+internal void map_benchmarkSwissMap(const char *title, uint64_t *keys, uint64_t *misses, size_t count) {
+    printf("SwissMap, %s\n", title);
+    SwissMap map;
+    swissmap_init(&map, sizeof(uint64_t), sizeof(uint64_t), NULL, NULL);
+    clock_t start = clock();
+    for (size_t i = 0; i < count; i++) {
+        uint64_t val = i + 1;
+        swissmap_put(&map, &keys[i], &val);
+    }
+    map_reportTime("insert", start, count);
+    
+    start = clock();
+    for (size_t i = 0; i < count; i++) {
+        benchmarkSink += *(uint64_t *) swissmap_get(&map, &keys[(i * 7919) % count]);
+    }
+    map_reportTime("get (hit)", start, count);
+    
+    start = clock();
+    for (size_t i = 0; i < count; i++) {
+        benchmarkSink += swissmap_get(&map, &misses[i]) != NULL;
+    }
+    map_reportTime("get (miss)", start, count);
+    map_reportMemory(swissmap_memory(&map), map.len, map.cap);
+    swissmap_free(&map);
+}
+
+// Stress tests the maps (map_test), then times them with different kinds of keys. Run with 'edim --benchmark map'.
+void map_benchmark(void) {
+    enum { N = 1 << 20 };
+    // SwissMap grows past 7/8 full, so this many keys fill one as much as it can be before it grows (Map only gets half full)
+    size_t highLoad = (size_t) N / 8 * 7;
+    uint64_t random = 1;
+    
+    clock_t start = clock();
+    map_test();
+    printf("map_test passed (%.2f s)\n\n", (double)(clock() - start) / CLOCKS_PER_SEC);
+    
+    // Misses are even, the random keys odd
+    uint64_t *sequential = xmalloc(N * sizeof(uint64_t));
+    uint64_t *randomKeys = xmalloc(N * sizeof(uint64_t));
+    uint64_t *misses = xmalloc(N * sizeof(uint64_t));
+    for (size_t i = 0; i < N; i++) {
+        sequential[i] = i + 1;
+        randomKeys[i] = map_random(&random) | 1;
+        misses[i] = (map_random(&random) & ~(uint64_t) 1) | ((uint64_t) 1 << 63);
+    }
+    
+    map_benchmarkMap("sequential keys", sequential, misses, N);
+    map_benchmarkMap("random keys", randomKeys, misses, N);
+    map_benchmarkSwissMap("sequential keys", sequential, misses, N);
+    map_benchmarkSwissMap("random keys", randomKeys, misses, N);
+    map_benchmarkSwissMap("random keys, high load", randomKeys, misses, highLoad);
+    
+    // Growing under churn: each step puts a new key, and then looks up an older one (Map) or removes one (SwissMap)
+    printf("Growing under churn\n");
+    {
+        Map map = {0};
+        start = clock();
+        for (size_t i = 0; i < N; i++) {
+            map_put_uint64_from_uint64(&map, randomKeys[i], i + 1);
+            benchmarkSink += map_get_uint64_from_uint64(&map, randomKeys[(size_t)(map_random(&random) % (i + 1))]);
+        }
+        map_reportTime("Map: put + get", start, N);
+        xfree(map.keys);
+        xfree(map.vals);
+        
+        SwissMap swiss;
+        swissmap_init(&swiss, sizeof(uint64_t), sizeof(uint64_t), NULL, NULL);
+        start = clock();
+        for (size_t i = 0; i < N; i++) {
+            swissmap_put(&swiss, &randomKeys[i], &i);
+            // Removes every other key, half a step behind
+            if (i & 1)
+                swissmap_remove(&swiss, &randomKeys[i / 2]);
+        }
+        map_reportTime("SwissMap: put + remove", start, N);
+        map_reportMemory(swissmap_memory(&swiss), swiss.len, swiss.cap);
+        
+        // Steady state: the same number of keys, each step removes one and puts it back
+        start = clock();
+        for (size_t i = 0; i < N; i++) {
+            uint64_t *key = &randomKeys[N / 2 + (size_t)(map_random(&random) % (N / 2))];
+            swissmap_remove(&swiss, key);
+            swissmap_put(&swiss, key, &i);
+        }
+        map_reportTime("SwissMap: remove + put", start, N);
+        swissmap_free(&swiss);
+    }
+    
+    // Small tables looked up over and over, so everything is in the cache and only the lookups themselves are timed
+    enum { SMALL = 1024, SMALL_ROUNDS = 4096 };
+    printf("%d random keys, hot cache\n", SMALL);
+    {
+        size_t ops = (size_t) SMALL * SMALL_ROUNDS;
+        Map map = {0};
+        SwissMap swiss;
+        swissmap_init(&swiss, sizeof(uint64_t), sizeof(uint64_t), NULL, NULL);
+        for (size_t i = 0; i < SMALL; i++) {
+            map_put_uint64_from_uint64(&map, randomKeys[i], i + 1);
+            swissmap_put(&swiss, &randomKeys[i], &i);
+        }
+        
+        start = clock();
+        for (size_t i = 0; i < ops; i++) {
+            benchmarkSink += map_get_uint64_from_uint64(&map, randomKeys[(i * 7919) % SMALL]);
+        }
+        map_reportTime("Map: get (hit)", start, ops);
+        
+        start = clock();
+        for (size_t i = 0; i < ops; i++) {
+            benchmarkSink += *(uint64_t *) swissmap_get(&swiss, &randomKeys[(i * 7919) % SMALL]);
+        }
+        map_reportTime("SwissMap: get (hit)", start, ops);
+        
+        start = clock();
+        for (size_t i = 0; i < ops; i++) {
+            uint64_t *key = &randomKeys[(i * 7919) % SMALL];
+            swissmap_remove(&swiss, key);
+            swissmap_put(&swiss, key, &i);
+        }
+        map_reportTime("SwissMap: remove + put", start, ops);
+        xfree(map.keys);
+        xfree(map.vals);
+        swissmap_free(&swiss);
+    }
+    
+    // String keys, like the intern table's: identifiers of 4-16 chars
+    printf("SwissMap, string keys\n");
+    {
+        static const char alphabet[] = "abcdefghijklmnopqrstuvwxyz_0123456789";
+        enum { STRING_COUNT = 1 << 18 };
+        Arena arena = {0};
+        InternKey *strings = xmalloc(2 * STRING_COUNT * sizeof(InternKey));
+        size_t stringBytes = 0;
+        for (size_t i = 0; i < 2 * STRING_COUNT; i++) {
+            size_t length = 4 + (size_t)(map_random(&random) % 13);
+            char *str = arena_alloc(&arena, length);
+            for (size_t j = 0; j < length; j++) {
+                str[j] = alphabet[map_random(&random) % (sizeof(alphabet) - 1)];
+            }
+            // The second half are the misses, which start with a char the first half can't
+            if (i >= STRING_COUNT)
+                str[0] = 'A';
+            strings[i] = (InternKey) { str, length };
+            if (i < STRING_COUNT)
+                stringBytes += length;
+        }
+        
+        SwissMap map;
+        swissmap_init(&map, sizeof(InternKey), sizeof(uint64_t), intern_hash, intern_equal);
+        start = clock();
+        for (size_t i = 0; i < STRING_COUNT; i++) {
+            swissmap_put(&map, &strings[i], &i);
+        }
+        map_reportTime("insert", start, STRING_COUNT);
+        
+        start = clock();
+        for (size_t i = 0; i < STRING_COUNT; i++) {
+            benchmarkSink += *(uint64_t *) swissmap_get(&map, &strings[(i * 7919) % STRING_COUNT]);
+        }
+        map_reportTime("get (hit)", start, STRING_COUNT);
+        
+        start = clock();
+        for (size_t i = 0; i < STRING_COUNT; i++) {
+            benchmarkSink += swissmap_get(&map, &strings[STRING_COUNT + i]) != NULL;
+        }
+        map_reportTime("get (miss)", start, STRING_COUNT);
+        // Duplicate strings are overwritten, so there can be a few less entries than strings
+        map_reportMemory(swissmap_memory(&map), map.len, map.cap);
+        printf("  %-34s %8.2f bytes/entry\n", "memory, with the strings", (double)(swissmap_memory(&map) + stringBytes) / map.len);
+        swissmap_free(&map);
+        xfree(strings);
+        arena_free(&arena);
     }
+    
+    // The tradeoff the numbers above show, so it isn't mistaken for a regression
+    printf("\nSwissMap hits on tables bigger than the cache cost about twice as much as Map's: the slot to compare is only\n"
+           "known once its control bytes are loaded, where Map loads the key and the value at the same time. In return\n"
+           "SwissMap takes keys of any size, removes keys without tombstones, stays fast up to 7/8 full, and its misses\n"
+           "only read the control bytes.\n");
+    
+    printf("\n(%llx)\n", (unsigned long long) benchmarkSink);
+    xfree(sequential);
+    xfree(randomKeys);
+    xfree(misses);
 }
@@ -0,0 +1,725 @@
+#include "edimcoder.h"
+
+// Table-driven lexer for C and C++ (plus simpler ones for Markdown and shell scripts). Each line
+// is lexed on its own, starting from the state the previous line ended in (inside a block comment,
+// a continued string, etc.). The entry/exit states are cached on the Line, so after an edit only
+// the changed lines are relexed, plus the lines after them until the states line up again.
+//
+// Tokens are kept for every line of C/C++ files, since the outline looks at all of them. For the
+// other filetypes only the states are kept, and the tokens of a line are lexed when it's printed.
+
+typedef enum CharClass {
+    CC_OTHER, CC_SPACE, CC_NEWLINE, CC_IDENT, CC_DIGIT, CC_QUOTE, CC_SLASH, CC_HASH, CC_PUNCT
+} CharClass;
+
+static const uint8_t charClasses[256] = {
+    CC_OTHER, CC_OTHER, CC_OTHER, CC_OTHER, CC_OTHER, CC_OTHER, CC_OTHER, CC_OTHER,
+    CC_OTHER, CC_SPACE, CC_NEWLINE, CC_SPACE, CC_SPACE, CC_SPACE, CC_OTHER, CC_OTHER,
+    CC_OTHER, CC_OTHER, CC_OTHER, CC_OTHER, CC_OTHER, CC_OTHER, CC_OTHER, CC_OTHER,
+    CC_OTHER, CC_OTHER, CC_OTHER, CC_OTHER, CC_OTHER, CC_OTHER, CC_OTHER, CC_OTHER,
+    CC_SPACE, CC_PUNCT, CC_QUOTE, CC_HASH, CC_PUNCT, CC_PUNCT, CC_PUNCT, CC_QUOTE,
+    CC_PUNCT, CC_PUNCT, CC_PUNCT, CC_PUNCT, CC_PUNCT, CC_PUNCT, CC_PUNCT, CC_SLASH,
+    CC_DIGIT, CC_DIGIT, CC_DIGIT, CC_DIGIT, CC_DIGIT, CC_DIGIT, CC_DIGIT, CC_DIGIT,
+    CC_DIGIT, CC_DIGIT, CC_PUNCT, CC_PUNCT, CC_PUNCT, CC_PUNCT, CC_PUNCT, CC_PUNCT,
+    CC_PUNCT, CC_IDENT, CC_IDENT, CC_IDENT, CC_IDENT, CC_IDENT, CC_IDENT, CC_IDENT,
+    CC_IDENT, CC_IDENT, CC_IDENT, CC_IDENT, CC_IDENT, CC_IDENT, CC_IDENT, CC_IDENT,
+    CC_IDENT, CC_IDENT, CC_IDENT, CC_IDENT, CC_IDENT, CC_IDENT, CC_IDENT, CC_IDENT,
+    CC_IDENT, CC_IDENT, CC_IDENT, CC_PUNCT, CC_PUNCT, CC_PUNCT, CC_PUNCT, CC_IDENT,
+    CC_PUNCT, CC_IDENT, CC_IDENT, CC_IDENT, CC_IDENT, CC_IDENT, CC_IDENT, CC_IDENT,
+    CC_IDENT, CC_IDENT, CC_IDENT, CC_IDENT, CC_IDENT, CC_IDENT, CC_IDENT, CC_IDENT,
+    CC_IDENT, CC_IDENT, CC_IDENT, CC_IDENT, CC_IDENT, CC_IDENT, CC_IDENT, CC_IDENT,
+    CC_IDENT, CC_IDENT, CC_IDENT, CC_PUNCT, CC_PUNCT, CC_PUNCT, CC_PUNCT, CC_OTHER,
+    // Bytes of UTF-8 sequences are treated as identifier characters
+    CC_IDENT, CC_IDENT, CC_IDENT, CC_IDENT, CC_IDENT, CC_IDENT, CC_IDENT, CC_IDENT,
+    CC_IDENT, CC_IDENT, CC_IDENT, CC_IDENT, CC_IDENT, CC_IDENT, CC_IDENT, CC_IDENT,
+    CC_IDENT, CC_IDENT, CC_IDENT, CC_IDENT, CC_IDENT, CC_IDENT, CC_IDENT, CC_IDENT,
+    CC_IDENT, CC_IDENT, CC_IDENT, CC_IDENT, CC_IDENT, CC_IDENT, CC_IDENT, CC_IDENT,
+    CC_IDENT, CC_IDENT, CC_IDENT, CC_IDENT, CC_IDENT, CC_IDENT, CC_IDENT, CC_IDENT,
+    CC_IDENT, CC_IDENT, CC_IDENT, CC_IDENT, CC_IDENT, CC_IDENT, CC_IDENT, CC_IDENT,
+    CC_IDENT, CC_IDENT, CC_IDENT, CC_IDENT, CC_IDENT, CC_IDENT, CC_IDENT, CC_IDENT,
+    CC_IDENT, CC_IDENT, CC_IDENT, CC_IDENT, CC_IDENT, CC_IDENT, CC_IDENT, CC_IDENT,
+    CC_IDENT, CC_IDENT, CC_IDENT, CC_IDENT, CC_IDENT, CC_IDENT, CC_IDENT, CC_IDENT,
+    CC_IDENT, CC_IDENT, CC_IDENT, CC_IDENT, CC_IDENT, CC_IDENT, CC_IDENT, CC_IDENT,
+    CC_IDENT, CC_IDENT, CC_IDENT, CC_IDENT, CC_IDENT, CC_IDENT, CC_IDENT, CC_IDENT,
+    CC_IDENT, CC_IDENT, CC_IDENT, CC_IDENT, CC_IDENT, CC_IDENT, CC_IDENT, CC_IDENT,
+    CC_IDENT, CC_IDENT, CC_IDENT, CC_IDENT, CC_IDENT, CC_IDENT, CC_IDENT, CC_IDENT,
+    CC_IDENT, CC_IDENT, CC_IDENT, CC_IDENT, CC_IDENT, CC_IDENT, CC_IDENT, CC_IDENT,
+    CC_IDENT, CC_IDENT, CC_IDENT, CC_IDENT, CC_IDENT, CC_IDENT, CC_IDENT, CC_IDENT,
+    CC_IDENT, CC_IDENT, CC_IDENT, CC_IDENT, CC_IDENT, CC_IDENT, CC_IDENT, CC_IDENT,
+};
+
+#define charClass(c) (charClasses[(unsigned char) (c)])
+
+typedef struct Keyword {
+    const char *name;
+    TokenKind kind;
+    bool control;
+} Keyword;
+
+// These tables must stay sorted (by strcmp) - they're searched with a binary search.
+static const Keyword cKeywords[] = {
+    { "NULL", TOKEN_KEYWORD, false },
+    { "_Bool", TOKEN_TYPE, false },
+    { "auto", TOKEN_KEYWORD, false },
+    { "bool", TOKEN_TYPE, false },
+    { "break", TOKEN_KEYWORD, true },
+    { "case", TOKEN_KEYWORD, true },
+    { "char", TOKEN_TYPE, false },
+    { "const", TOKEN_KEYWORD, false },
+    { "continue", TOKEN_KEYWORD, true },
+    { "default", TOKEN_KEYWORD, true },
+    { "do", TOKEN_KEYWORD, true },
+    { "double", TOKEN_TYPE, false },
+    { "else", TOKEN_KEYWORD, true },
+    { "enum", TOKEN_TYPE, false },
+    { "extern", TOKEN_KEYWORD, false },
+    { "false", TOKEN_KEYWORD, false },
+    { "float", TOKEN_TYPE, false },
+    { "for", TOKEN_KEYWORD, true },
+    { "goto", TOKEN_KEYWORD, true },
+    { "if", TOKEN_KEYWORD, true },
+    { "inline", TOKEN_KEYWORD, false },
+    { "int", TOKEN_TYPE, false },
+    { "int16_t", TOKEN_TYPE, false },
+    { "int32_t", TOKEN_TYPE, false },
+    { "int64_t", TOKEN_TYPE, false },
+    { "int8_t", TOKEN_TYPE, false },
+    { "internal", TOKEN_KEYWORD, false },
+    { "intptr_t", TOKEN_TYPE, false },
+    { "long", TOKEN_TYPE, false },
+    { "ptrdiff_t", TOKEN_TYPE, false },
+    { "register", TOKEN_KEYWORD, false },
+    { "restrict", TOKEN_KEYWORD, false },
+    { "return", TOKEN_KEYWORD, true },
+    { "short", TOKEN_TYPE, false },
+    { "signed", TOKEN_TYPE, false },
+    { "size_t", TOKEN_TYPE, false },
+    { "sizeof", TOKEN_KEYWORD, true },
+    { "static", TOKEN_KEYWORD, false },
+    { "struct", TOKEN_TYPE, false },
+    { "switch", TOKEN_KEYWORD, true },
+    { "true", TOKEN_KEYWORD, false },
+    { "typedef", TOKEN_KEYWORD, false },
+    { "uint16_t", TOKEN_TYPE, false },
+    { "uint32_t", TOKEN_TYPE, false },
+    { "uint64_t", TOKEN_TYPE, false },
+    { "uint8_t", TOKEN_TYPE, false },
+    { "uintptr_t", TOKEN_TYPE, false },
+    { "union", TOKEN_TYPE, false },
+    { "unsigned", TOKEN_TYPE, false },
+    { "void", TOKEN_TYPE, false },
+    { "volatile", TOKEN_KEYWORD, false },
+    { "while", TOKEN_KEYWORD, true },
+};
+
+// Only the keywords C++ adds on top of C
+static const Keyword cppKeywords[] = {
+    { "alignas", TOKEN_KEYWORD, false },
+    { "alignof", TOKEN_KEYWORD, false },
+    { "catch", TOKEN_KEYWORD, true },
+    { "char16_t", TOKEN_TYPE, false },
+    { "char32_t", TOKEN_TYPE, false },
+    { "class", TOKEN_TYPE, false },
+    { "const_cast", TOKEN_KEYWORD, false },
+    { "constexpr", TOKEN_KEYWORD, false },
+    { "decltype", TOKEN_KEYWORD, false },
+    { "delete", TOKEN_KEYWORD, false },
+    { "dynamic_cast", TOKEN_KEYWORD, false },
+    { "explicit", TOKEN_KEYWORD, false },
+    { "export", TOKEN_KEYWORD, false },
+    { "final", TOKEN_KEYWORD, false },
+    { "friend", TOKEN_KEYWORD, false },
+    { "mutable", TOKEN_KEYWORD, false },
+    { "namespace", TOKEN_TYPE, false },
+    { "new", TOKEN_KEYWORD, false },
+    { "noexcept", TOKEN_KEYWORD, false },
+    { "nullptr", TOKEN_KEYWORD, false },
+    { "operator", TOKEN_KEYWORD, false },
+    { "override", TOKEN_KEYWORD, false },
+    { "private", TOKEN_KEYWORD, false },
+    { "protected", TOKEN_KEYWORD, false },
+    { "public", TOKEN_KEYWORD, false },
+    { "reinterpret_cast", TOKEN_KEYWORD, false },
+    { "static_assert", TOKEN_KEYWORD, false },
+    { "static_cast", TOKEN_KEYWORD, false },
+    { "template", TOKEN_KEYWORD, false },
+    { "this", TOKEN_KEYWORD, false },
+    { "throw", TOKEN_KEYWORD, true },
+    { "try", TOKEN_KEYWORD, true },
+    { "typeid", TOKEN_KEYWORD, false },
+    { "typename", TOKEN_KEYWORD, false },
+    { "using", TOKEN_KEYWORD, false },
+    { "virtual", TOKEN_KEYWORD, false },
+    { "wchar_t", TOKEN_TYPE, false },
+};
+
+internal const Keyword *findKeyword(const Keyword *keywords, int count, const char *str, int length) {
+    int low = 0;
+    int high = count - 1;
+    while (low <= high) {
+        int mid = (low + high) / 2;
+        int cmp = strncmp(keywords[mid].name, str, length);
+        if (cmp == 0 && keywords[mid].name[length] != '\0')
+            cmp = 1; // Keyword is longer than str
+        if (cmp == 0)
+            return &keywords[mid];
+        else if (cmp < 0)
+            low = mid + 1;
+        else high = mid - 1;
+    }
+    return NULL;
+}
+
+internal const Keyword *lookupKeyword(FileType ft, const char *str, int length) {
+    const Keyword *keyword = findKeyword(cKeywords, sizeof(cKeywords) / sizeof(cKeywords[0]), str, length);
+    if (keyword == NULL && ft == FT_CPP)
+        keyword = findKeyword(cppKeywords, sizeof(cppKeywords) / sizeof(cppKeywords[0]), str, length);
+    return keyword;
+}
+
+// Only the keywords used for highlighting, the control flag isn't used
+static const Keyword shellKeywords[] = {
+    { "case", TOKEN_KEYWORD, false },
+    { "do", TOKEN_KEYWORD, false },
+    { "done", TOKEN_KEYWORD, false },
+    { "elif", TOKEN_KEYWORD, false },
+    { "else", TOKEN_KEYWORD, false },
+    { "esac", TOKEN_KEYWORD, false },
+    { "exit", TOKEN_KEYWORD, false },
+    { "export", TOKEN_KEYWORD, false },
+    { "fi", TOKEN_KEYWORD, false },
+    { "for", TOKEN_KEYWORD, false },
+    { "function", TOKEN_KEYWORD, false },
+    { "if", TOKEN_KEYWORD, false },
+    { "in", TOKEN_KEYWORD, false },
+    { "local", TOKEN_KEYWORD, false },
+    { "readonly", TOKEN_KEYWORD, false },
+    { "return", TOKEN_KEYWORD, false },
+    { "select", TOKEN_KEYWORD, false },
+    { "then", TOKEN_KEYWORD, false },
+    { "until", TOKEN_KEYWORD, false },
+    { "while", TOKEN_KEYWORD, false },
+};
+
+bool lexer_isSupported(FileType ft) {
+    return ft == FT_C || ft == FT_CPP || ft == FT_C_HEADER || ft == FT_MARKDOWN || ft == FT_SHELL;
+}
+
+// C, C++, and C headers
+bool lexer_isC(FileType ft) {
+    return ft == FT_C || ft == FT_CPP || ft == FT_C_HEADER;
+}
+
+internal void pushToken(Token **tokens, int start, int length, TokenKind kind, uint8_t flags) {
+    Token token;
+    token.start = start;
+    token.length = length;
+    token.kind = (uint8_t) kind;
+    token.flags = flags;
+    buf_push(*tokens, token);
+}
+
+// Returns true if the line (not counting the new line at the end) ends with a backslash
+internal bool endsWithContinuation(const char *chars, int length) {
+    while (length > 0 && (chars[length - 1] == '\n' || chars[length - 1] == '\r'))
+        --length;
+    return length > 0 && chars[length - 1] == '\\';
+}
+
+// Lexes one line of C/C++, pushing the tokens onto tokens (which should be empty). Returns the state at the end of the line.
+internal uint8_t lexCLine(FileType ft, const char *chars, int length, uint8_t state, Token **tokens) {
+    uint8_t exitState = LEX_STATE_NORMAL;
+    uint8_t ppFlag = (state & LEX_STATE_PREPROCESSOR) ? TOKEN_FLAG_PREPROCESSOR : 0;
+    bool seenToken = false;
+    bool afterInclude = false;
+    int i = 0;
+
+    // Continue whatever the previous line left open
+    if (state & LEX_STATE_LINE_COMMENT) {
+        pushToken(tokens, 0, length, TOKEN_COMMENT, ppFlag);
+        return endsWithContinuation(chars, length) ? state : LEX_STATE_NORMAL;
+    }
+    if (state & LEX_STATE_BLOCK_COMMENT) {
+        while (i < length && !(chars[i] == '*' && i + 1 < length && chars[i + 1] == '/'))
+            ++i;
+        if (i >= length) {
+            pushToken(tokens, 0, length, TOKEN_COMMENT, ppFlag);
+            return state;
+        }
+        i += 2;
+        pushToken(tokens, 0, i, TOKEN_COMMENT, ppFlag);
+    } else if (state & LEX_STATE_STRING) {
+        while (i < length && chars[i] != '"') {
+            if (chars[i] == '\\') ++i;
+            ++i;
+        }
+        if (i >= length) {
+            pushToken(tokens, 0, length, TOKEN_STRING, ppFlag);
+            return endsWithContinuation(chars, length) ? state : (state & LEX_STATE_PREPROCESSOR);
+        }
+        ++i;
+        pushToken(tokens, 0, i, TOKEN_STRING, ppFlag);
+    }
+
+    while (i < length) {
+        char c = chars[i];
+        int start = i;
+        switch (charClass(c)) {
+            case CC_SPACE:
+            case CC_NEWLINE:
+            case CC_OTHER:
+            {
+                ++i;
+            } break;
+            case CC_IDENT:
+            {
+                while (i < length && (charClass(chars[i]) == CC_IDENT || charClass(chars[i]) == CC_DIGIT))
+                    ++i;
+                TokenKind kind = TOKEN_IDENTIFIER;
+                uint8_t flags = ppFlag;
+                const Keyword *keyword = lookupKeyword(ft, &chars[start], i - start);
+                if (keyword) {
+                    kind = keyword->kind;
+                    if (keyword->control) flags |= TOKEN_FLAG_CONTROL;
+                }
+                pushToken(tokens, start, i - start, kind, flags);
+            } break;
+            case CC_DIGIT:
+            {
+                // Covers hex, floats, suffixes, and digit separators
+                while (i < length && (charClass(chars[i]) == CC_IDENT || charClass(chars[i]) == CC_DIGIT || chars[i] == '.' || chars[i] == '\''
+                                      || ((chars[i] == '+' || chars[i] == '-') && (chars[i - 1] == 'e' || chars[i - 1] == 'E' || chars[i - 1] == 'p' || chars[i - 1] == 'P'))))
+                    ++i;
+                pushToken(tokens, start, i - start, TOKEN_NUMBER, ppFlag);
+            } break;
+            case CC_QUOTE:
+            {
+                ++i;
+                while (i < length && chars[i] != c && chars[i] != '\n') {
+                    if (chars[i] == '\\') ++i;
+                    ++i;
+                }
+                if (i >= length || chars[i] == '\n') {
+                    // Unterminated. Strings can be continued onto the next line with a backslash
+                    if (c == '"' && endsWithContinuation(chars, length))
+                        exitState |= LEX_STATE_STRING;
+                    if (i > length) i = length;
+                } else ++i;
+                pushToken(tokens, start, i - start, c == '"' ? TOKEN_STRING : TOKEN_CHAR, ppFlag);
+            } break;
+            case CC_SLASH:
+            {
+                if (i + 1 < length && chars[i + 1] == '/') {
+                    pushToken(tokens, start, length - start, TOKEN_COMMENT, ppFlag);
+                    if (endsWithContinuation(chars, length))
+                        exitState |= LEX_STATE_LINE_COMMENT;
+                    i = length;
+                } else if (i + 1 < length && chars[i + 1] == '*') {
+                    i += 2;
+                    while (i < length && !(chars[i] == '*' && i + 1 < length && chars[i + 1] == '/'))
+                        ++i;
+                    if (i >= length) {
+                        exitState |= LEX_STATE_BLOCK_COMMENT;
+                        i = length;
+                    } else i += 2;
+                    pushToken(tokens, start, i - start, TOKEN_COMMENT, ppFlag);
+                } else {
+                    ++i;
+                    pushToken(tokens, start, 1, TOKEN_PUNCTUATION, ppFlag);
+                }
+            } break;
+            case CC_HASH:
+            {
+                if (!seenToken && !ppFlag) {
+                    // Start of a preprocessor directive: '#', optional whitespace, then the directive name
+                    ppFlag = TOKEN_FLAG_PREPROCESSOR;
+                    ++i;
+                    while (i < length && charClass(chars[i]) == CC_SPACE)
+                        ++i;
+                    int nameStart = i;
+                    while (i < length && charClass(chars[i]) == CC_IDENT)
+                        ++i;
+                    if (i - nameStart == 7 && strncmp(&chars[nameStart], "include", 7) == 0)
+                        afterInclude = true;
+                    pushToken(tokens, start, i - start, TOKEN_PREPROCESSOR, ppFlag);
+                } else {
+                    ++i;
+                    pushToken(tokens, start, 1, TOKEN_PUNCTUATION, ppFlag);
+                }
+            } break;
+            case CC_PUNCT:
+            {
+                if (c == '<' && afterInclude) {
+                    // Header name
+                    while (i < length && chars[i] != '>' && chars[i] != '\n')
+                        ++i;
+                    if (i < length && chars[i] == '>') ++i;
+                    pushToken(tokens, start, i - start, TOKEN_STRING, ppFlag);
+                } else if (c == ':' && i + 1 < length && chars[i + 1] == ':') {
+                    i += 2;
+                    pushToken(tokens, start, 2, TOKEN_PUNCTUATION, ppFlag);
+                } else {
+                    ++i;
+                    pushToken(tokens, start, 1, TOKEN_PUNCTUATION, ppFlag);
+                }
+            } break;
+        }
+        if (buf_len(*tokens) > 0) {
+            seenToken = true;
+            afterInclude = afterInclude && (*tokens)[buf_len(*tokens) - 1].kind == TOKEN_PREPROCESSOR;
+        }
+    }
+
+    if (ppFlag && !(exitState & (LEX_STATE_BLOCK_COMMENT)) && endsWithContinuation(chars, length))
+        exitState |= LEX_STATE_PREPROCESSOR;
+    else if (ppFlag && (exitState & LEX_STATE_STRING))
+        exitState |= LEX_STATE_PREPROCESSOR;
+
+    return exitState;
+}
+
+// Skips over an inline Markdown span that starts at i with the given marker ('`', '*', '_', "**", ...).
+// Returns the index just after the closing marker, or -1 if it isn't closed on this line.
+internal int skipMarkdownSpan(const char *chars, int length, int i, char marker, int markerLength) {
+    for (int j = i + markerLength; j + markerLength <= length; j++) {
+        if (chars[j] == '\n') break;
+        int k = 0;
+        while (k < markerLength && chars[j + k] == marker)
+            ++k;
+        if (k == markerLength && j > i + markerLength)
+            return j + markerLength;
+    }
+    return -1;
+}
+
+// Lexes one line of Markdown: headings, fenced code blocks, block quotes, list markers, and inline code, emphasis, and links.
+internal uint8_t lexMarkdownLine(const char *chars, int length, uint8_t state, Token **tokens) {
+    int i = 0;
+    while (i < length && (chars[i] == ' ' || chars[i] == '\t'))
+        ++i;
+    bool fence = i + 2 < length && ((chars[i] == '`' && chars[i + 1] == '`' && chars[i + 2] == '`')
+                                    || (chars[i] == '~' && chars[i + 1] == '~' && chars[i + 2] == '~'));
+    
+    // Inside a code block, everything up to (and including) the closing fence is code
+    if (state & LEX_STATE_CODE_BLOCK) {
+        pushToken(tokens, 0, length, TOKEN_STRING, 0);
+        return fence ? LEX_STATE_NORMAL : state;
+    }
+    if (fence) {
+        pushToken(tokens, 0, length, TOKEN_STRING, 0);
+        return LEX_STATE_CODE_BLOCK;
+    }
+    
+    // Block level
+    if (i < length && chars[i] == '#') {
+        pushToken(tokens, 0, length, TOKEN_HEADING, 0);
+        return LEX_STATE_NORMAL;
+    }
+    if (i < length && chars[i] == '>') {
+        pushToken(tokens, i, length - i, TOKEN_COMMENT, 0);
+        return LEX_STATE_NORMAL;
+    }
+    if (i + 1 < length && (chars[i] == '-' || chars[i] == '*' || chars[i] == '+') && chars[i + 1] == ' ') {
+        pushToken(tokens, i, 1, TOKEN_PUNCTUATION, 0);
+        i += 2;
+    } else if (i < length && charClass(chars[i]) == CC_DIGIT) {
+        int j = i;
+        while (j < length && charClass(chars[j]) == CC_DIGIT)
+            ++j;
+        if (j + 1 < length && chars[j] == '.' && chars[j + 1] == ' ') {
+            pushToken(tokens, i, j + 1 - i, TOKEN_PUNCTUATION, 0);
+            i = j + 2;
+        }
+    }
+    
+    // Inline spans
+    while (i < length) {
+        char c = chars[i];
+        int end = -1;
+        if (c == '`') {
+            end = skipMarkdownSpan(chars, length, i, '`', 1);
+            if (end != -1) pushToken(tokens, i, end - i, TOKEN_STRING, 0);
+        } else if ((c == '*' || c == '_') && i + 1 < length) {
+            int markerLength = (chars[i + 1] == c) ? 2 : 1;
+            // A '_' inside of a word isn't emphasis
+            if (c == '*' || i == 0 || charClass(chars[i - 1]) != CC_IDENT)
+                end = skipMarkdownSpan(chars, length, i, c, markerLength);
+            if (end != -1) pushToken(tokens, i, end - i, TOKEN_EMPHASIS, 0);
+        } else if (c == '[') {
+            // [text](url)
+            int j = i + 1;
+            while (j < length && chars[j] != ']' && chars[j] != '\n')
+                ++j;
+            if (j + 1 < length && chars[j] == ']' && chars[j + 1] == '(') {
+                j += 2;
+                while (j < length && chars[j] != ')' && chars[j] != '\n')
+                    ++j;
+                if (j < length && chars[j] == ')') {
+                    end = j + 1;
+                    pushToken(tokens, i, end - i, TOKEN_LINK, 0);
+                }
+            }
+        }
+        i = (end != -1) ? end : i + 1;
+    }
+    return LEX_STATE_NORMAL;
+}
+
+// Lexes one line of a shell script: comments, quoted strings (which can continue onto the next lines), variables, keywords, and numbers.
+internal uint8_t lexShellLine(const char *chars, int length, uint8_t state, Token **tokens) {
+    int i = 0;
+    
+    // Continue a string from the previous line
+    if (state & (LEX_STATE_STRING | LEX_STATE_SINGLE_QUOTE)) {
+        char quote = (state & LEX_STATE_STRING) ? '"' : '\'';
+        while (i < length && chars[i] != quote) {
+            if (quote == '"' && chars[i] == '\\') ++i;
+            ++i;
+        }
+        if (i >= length) {
+            pushToken(tokens, 0, length, TOKEN_STRING, 0);
+            return state;
+        }
+        ++i;
+        pushToken(tokens, 0, i, TOKEN_STRING, 0);
+    }
+    
+    while (i < length) {
+        char c = chars[i];
+        int start = i;
+        bool wordStart = (i == 0 || charClass(chars[i - 1]) == CC_SPACE || chars[i - 1] == ';' || chars[i - 1] == '(' || chars[i - 1] == '|' || chars[i - 1] == '&');
+        if (c == '#' && wordStart) {
+            pushToken(tokens, start, length - start, TOKEN_COMMENT, 0);
+            break;
+        } else if (c == '"' || c == '\'') {
+            ++i;
+            while (i < length && chars[i] != c) {
+                if (c == '"' && chars[i] == '\\') ++i;
+                ++i;
+            }
+            if (i >= length) {
+                pushToken(tokens, start, length - start, TOKEN_STRING, 0);
+                return (c == '"') ? LEX_STATE_STRING : LEX_STATE_SINGLE_QUOTE;
+            }
+            ++i;
+            pushToken(tokens, start, i - start, TOKEN_STRING, 0);
+        } else if (c == '\\') {
+            i += 2; // Escaped character
+        } else if (c == '$' && i + 1 < length) {
+            ++i;
+            if (chars[i] == '{') {
+                while (i < length && chars[i] != '}' && chars[i] != '\n')
+                    ++i;
+                if (i < length && chars[i] == '}') ++i;
+            } else if (charClass(chars[i]) == CC_IDENT) {
+                while (i < length && (charClass(chars[i]) == CC_IDENT || charClass(chars[i]) == CC_DIGIT))
+                    ++i;
+            } else if (charClass(chars[i]) == CC_DIGIT || strchr("@*#?$!-", chars[i])) {
+                ++i;
+            }
+            if (i - start > 1)
+                pushToken(tokens, start, i - start, TOKEN_VARIABLE, 0);
+        } else if (charClass(c) == CC_IDENT) {
+            while (i < length && (charClass(chars[i]) == CC_IDENT || charClass(chars[i]) == CC_DIGIT || chars[i] == '-'))
+                ++i;
+            const Keyword *keyword = wordStart ? findKeyword(shellKeywords, sizeof(shellKeywords) / sizeof(shellKeywords[0]), &chars[start], i - start) : NULL;
+            pushToken(tokens, start, i - start, keyword ? TOKEN_KEYWORD : TOKEN_IDENTIFIER, 0);
+        } else if (charClass(c) == CC_DIGIT) {
+            while (i < length && charClass(chars[i]) == CC_DIGIT)
+                ++i;
+            pushToken(tokens, start, i - start, TOKEN_NUMBER, 0);
+        } else {
+            ++i;
+        }
+    }
+    return LEX_STATE_NORMAL;
+}
+
+// Lexes one line starting in the given state. tokens should be an empty stretchy buffer (or NULL).
+// Returns the state at the end of the line.
+uint8_t lexer_lexLine(FileType ft, const char *chars, int length, uint8_t state, Token **tokens) {
+    switch (ft) {
+        case FT_C:
+        case FT_CPP:
+        case FT_C_HEADER:
+        return lexCLine(ft, chars, length, state, tokens);
+        case FT_MARKDOWN:
+        return lexMarkdownLine(chars, length, state, tokens);
+        case FT_SHELL:
+        return lexShellLine(chars, length, state, tokens);
+        default:
+        return LEX_STATE_NORMAL;
+    }
+}
+
+// Forget everything that was cached. Only lines that get looked at are relexed after this.
+void lexer_reset(Buffer *buffer) {
+    for (int i = 0; i < buf_len(buffer->lines); i++) {
+        buffer->lines[i].lexFlags &= ~(LINE_LEXED | LINE_HAS_TOKENS);
+    }
+    buffer->lexFileType = buffer->fileType;
+    buffer->lexedUpTo = 0;
+    buffer->lexHighWater = 0;
+    buffer->lexDirtyMax = -1;
+}
+
+// Lexes the line into scratch, and then copies the tokens into the line's tokens, which are only grown to exactly
+// their size. Most lines are lexed once and their tokens kept, so growing them as they're pushed would leave up to
+// half of every line's tokens unused. Returns the state at the end of the line.
+internal uint8_t lexTokensOfLine(Buffer *buffer, Line *line, uint8_t state, Token **scratch) {
+    if (*scratch) buf_pop_all(*scratch);
+    uint8_t exitState = lexer_lexLine(buffer->fileType, line_chars(line), line_length(line), state, scratch);
+    if (line->tokens) buf_pop_all(line->tokens);
+    int count = buf_len(*scratch);
+    if (count > 0) {
+        buf_reserve(line->tokens, count, BUF_GROW_EXACT);
+        memcpy(buf_add(line->tokens, count), *scratch, count * sizeof(Token));
+    }
+    return exitState;
+}
+
+// Makes sure the states of every line up to (and including) lastIndex are up to date, along with
+// the tokens of the lines that keep them (see the top of the file). Use lexer_getTokens for the rest.
+// Lines whose contents didn't change and whose entry state still matches aren't relexed.
+// Once the walk gets past the last changed line and the states line up again, all the
+// lines that were lexed before the edit are known to still be valid, so it can stop there.
+void lexer_ensureLexed(Buffer *buffer, int lastIndex) {
+    if (buffer->lexFileType != buffer->fileType)
+        lexer_reset(buffer);
+    if (!lexer_isSupported(buffer->fileType))
+        return;
+    if (lastIndex >= buf_len(buffer->lines))
+        lastIndex = buf_len(buffer->lines) - 1;
+
+    bool keepAllTokens = lexer_isC(buffer->fileType);
+    Token *scratch = NULL; // Tokens are lexed into this, and only copied to the lines that keep them
+    int i = buffer->lexedUpTo;
+    while (i <= lastIndex) {
+        uint8_t state = (i == 0) ? LEX_STATE_NORMAL : buffer->lines[i - 1].lexExit;
+        Line *line = &(buffer->lines[i]);
+
+        if ((line->lexFlags & LINE_LEXED) && line->lexEntry == state) {
+            // Converged: everything up to the old high water mark is still valid
+            if (i > buffer->lexDirtyMax && buffer->lexHighWater > i) {
+                i = buffer->lexHighWater;
+                buffer->lexDirtyMax = -1;
+                continue;
+            }
+        } else {
+            // Lexed before but with a different entry state, the tokens can be different now
+            if (line->lexFlags & LINE_LEXED)
+                buffer_markChanged(buffer, i, i);
+            line->lexEntry = state;
+            if (keepAllTokens || (line->lexFlags & LINE_HAS_TOKENS)) {
+                line->lexExit = lexTokensOfLine(buffer, line, state, &scratch);
+                line->lexFlags |= LINE_LEXED | LINE_HAS_TOKENS;
+                buffer_setBraceDelta(buffer, i, lexer_countBraces(line_chars(line), line_length(line), line->tokens));
+            } else {
+                if (scratch) buf_pop_all(scratch);
+                line->lexExit = lexer_lexLine(buffer->fileType, line_chars(line), line_length(line), state, &scratch);
+                line->lexFlags |= LINE_LEXED;
+                buffer_setBraceDelta(buffer, i, lexer_countBraces(line_chars(line), line_length(line), scratch));
+            }
+        }
+        ++i;
+    }
+    buf_free(scratch);
+
+    if (i > buffer->lexedUpTo)
+        buffer->lexedUpTo = i;
+    if (buffer->lexedUpTo > buffer->lexHighWater)
+        buffer->lexHighWater = buffer->lexedUpTo;
+    if (buffer->lexDirtyMax < buffer->lexedUpTo)
+        buffer->lexDirtyMax = -1;
+}
+
+// Returns the tokens of the line at index (starting at 0), lexing them if the line only had its states cached.
+// Returns NULL if the line has no tokens.
+Token *lexer_getTokens(Buffer *buffer, int index) {
+    if (index < 0 || index >= buf_len(buffer->lines))
+        return NULL;
+    lexer_ensureLexed(buffer, index);
+    if (!lexer_isSupported(buffer->fileType))
+        return NULL;
+    
+    Line *line = &(buffer->lines[index]);
+    if (!(line->lexFlags & LINE_HAS_TOKENS)) {
+        Token *scratch = NULL;
+        lexTokensOfLine(buffer, line, line->lexEntry, &scratch);
+        buf_free(scratch);
+        line->lexFlags |= LINE_HAS_TOKENS;
+    }
+    return line->tokens;
+}
+
+// The contents of count lines starting at index changed
+void lexer_linesChanged(Buffer *buffer, int index, int count) {
+    for (int i = index; i < index + count && i < buf_len(buffer->lines); i++) {
+        buffer->lines[i].lexFlags &= ~LINE_LEXED;
+    }
+    if (index < buffer->lexedUpTo)
+        buffer->lexedUpTo = index;
+    if (index + count - 1 > buffer->lexDirtyMax)
+        buffer->lexDirtyMax = index + count - 1;
+}
+
+// count lines were inserted at index. The new lines start out not lexed.
+void lexer_linesInserted(Buffer *buffer, int index, int count) {
+    // Lines put back by an undo still have what they were lexed with before
+    for (int i = index; i < index + count && i < buf_len(buffer->lines); i++) {
+        buffer->lines[i].lexFlags &= ~LINE_LEXED;
+    }
+    if (index < buffer->lexedUpTo)
+        buffer->lexedUpTo = index;
+    if (buffer->lexHighWater > index)
+        buffer->lexHighWater += count;
+    if (buffer->lexDirtyMax >= index)
+        buffer->lexDirtyMax += count;
+    if (index + count - 1 > buffer->lexDirtyMax)
+        buffer->lexDirtyMax = index + count - 1;
+}
+
+// count lines were removed starting at index. The tokens of the removed lines should already be freed.
+void lexer_linesRemoved(Buffer *buffer, int index, int count) {
+    if (index < buffer->lexedUpTo)
+        buffer->lexedUpTo = index;
+    if (buffer->lexHighWater > index + count)
+        buffer->lexHighWater -= count;
+    else if (buffer->lexHighWater > index)
+        buffer->lexHighWater = index;
+    if (buffer->lexDirtyMax >= index + count)
+        buffer->lexDirtyMax -= count;
+    else if (buffer->lexDirtyMax >= index)
+        buffer->lexDirtyMax = index;
+    // The line now at index has a different line before it
+    if (index > buffer->lexDirtyMax)
+        buffer->lexDirtyMax = index;
+}
+
+bool lexer_tokenEquals(Line *line, Token *token, const char *str) {
+    int length = (int) strlen(str);
+    return token->length == length && strncmp(&(line_chars(line)[token->start]), str, length) == 0;
+}
+
+// Returns the number of '{' minus the number of '}' in the line, not counting the ones in the strings, chars, and
+// comments of tokens (sorted by start). With no tokens, every brace is counted.
+int lexer_countBraces(const char *chars, int length, Token *tokens) {
+    int count = 0;
+    int token_i = 0;
+    for (int i = 0; i < length; i++) {
+        while (token_i < buf_len(tokens) && tokens[token_i].start + tokens[token_i].length <= i)
+            ++token_i;
+        if (token_i < buf_len(tokens) && tokens[token_i].start <= i) {
+            TokenKind kind = tokens[token_i].kind;
+            if (kind == TOKEN_STRING || kind == TOKEN_CHAR || kind == TOKEN_COMMENT) {
+                i = tokens[token_i].start + tokens[token_i].length - 1;
+                continue;
+            }
+        }
+        if (chars[i] == '{')
+            ++count;
+        else if (chars[i] == '}')
+            --count;
+    }
+    return count;
+}
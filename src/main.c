@@ -1,3 +1,7 @@
+#ifndef _WIN32
+#define _POSIX_C_SOURCE 200809L // sigaction and poll aren't declared in plain C99 mode
+#endif
+
 #include "edimcoder.h"
 
 #ifdef _WIN32
@@ -15,50 +19,181 @@ void clrscr() {
 
 #include <unistd.h>
 #include <termios.h>
-char getch() {
-    /*#include <unistd.h>   //_getch*/
-    /*#include <termios.h>  //_getch*/
-    char buf=0;
-    struct termios old={0};
+#include <signal.h>
+#include <poll.h>
+#include <errno.h>
+
+// -- Terminal session --
+// The terminal is put in raw mode (no line buffering or echo) once at startup, instead of around every key that's
+// read, and is put back the way it was when the program exits or is killed or stopped by a signal. Keys are read
+// into inputQueue as many at a time as are there, so pasting doesn't take a read per character either.
+// Input that isn't a terminal (like a pipe) is read the same way, just without changing any modes.
+// Bracketed paste is on while in raw mode, so that pasted text can be told apart from typed keys.
+internal struct termios originalTermios;
+internal bool terminalIsTty;
+internal bool terminalCanPaste; // Output is a terminal too, so it can be asked to bracket pastes
+internal volatile sig_atomic_t terminalIsRaw;
+internal char inputQueue[4096];
+internal int inputQueueStart;
+internal int inputQueueEnd;
+
+internal void terminal_handleSignal(int sig);
+
+#define PASTE_MODE_ON "\x1b[?2004h"
+#define PASTE_MODE_OFF "\x1b[?2004l"
+
+// write instead of stdio, so it can be used from the signal handler
+internal void terminal_setPasteMode(bool on) {
+    if (!terminalCanPaste)
+        return;
+    ssize_t result = on ? write(STDOUT_FILENO, PASTE_MODE_ON, sizeof(PASTE_MODE_ON) - 1)
+        : write(STDOUT_FILENO, PASTE_MODE_OFF, sizeof(PASTE_MODE_OFF) - 1);
+    (void) result;
+}
+
+internal void terminal_setRaw(bool raw) {
+    if (!terminalIsTty || terminalIsRaw == raw)
+        return;
+    struct termios mode = originalTermios;
+    if (raw) {
+        mode.c_lflag &= ~(ICANON | ECHO);
+        mode.c_cc[VMIN] = 1;
+        mode.c_cc[VTIME] = 0;
+    }
+    // TCSADRAIN so that output that's already been written is shown in the mode it was written in
+    if (tcsetattr(STDIN_FILENO, TCSADRAIN, &mode) == 0)
+        terminalIsRaw = raw;
     fflush(stdout);
-    if(tcgetattr(0, &old)<0)
-        perror("tcsetattr()");
-    old.c_lflag&=~ICANON;
-    old.c_lflag&=~ECHO;
-    old.c_cc[VMIN]=1;
-    old.c_cc[VTIME]=0;
-    if(tcsetattr(0, TCSANOW, &old)<0)
-        perror("tcsetattr ICANON");
-    if(read(0,&buf,1)<0)
-        perror("read()");
-    old.c_lflag|=ICANON;
-    old.c_lflag|=ECHO;
-    if(tcsetattr(0, TCSADRAIN, &old)<0)
-        perror ("tcsetattr ~ICANON");
-    return buf;
+    terminal_setPasteMode(terminalIsRaw);
+}
+
+internal void terminal_restore(void) {
+    terminal_setRaw(false);
+}
+
+internal void terminal_installHandler(int sig) {
+    struct sigaction action = {0};
+    action.sa_handler = terminal_handleSignal;
+    sigemptyset(&action.sa_mask);
+    sigaction(sig, &action, NULL);
+}
+
+// Puts the terminal back before the signal does what it normally does. Only calls things that are safe in a handler.
+internal void terminal_handleSignal(int sig) {
+    int savedErrno = errno;
+    bool wasRaw = terminalIsRaw;
+    if (wasRaw && tcsetattr(STDIN_FILENO, TCSADRAIN, &originalTermios) == 0) {
+        terminalIsRaw = false;
+        terminal_setPasteMode(false);
+    }
+    
+    signal(sig, SIG_DFL);
+    sigset_t unblock;
+    sigemptyset(&unblock);
+    sigaddset(&unblock, sig);
+    sigprocmask(SIG_UNBLOCK, &unblock, NULL);
+    raise(sig);
+    
+    // Only gets here after a stop (Ctrl-Z) when the program is continued (like with fg)
+    terminal_installHandler(sig);
+    if (wasRaw) {
+        struct termios mode = originalTermios;
+        mode.c_lflag &= ~(ICANON | ECHO);
+        mode.c_cc[VMIN] = 1;
+        mode.c_cc[VTIME] = 0;
+        if (tcsetattr(STDIN_FILENO, TCSADRAIN, &mode) == 0) {
+            terminalIsRaw = true;
+            terminal_setPasteMode(true);
+        }
+    }
+    errno = savedErrno;
+}
+
+void terminal_begin(void) {
+    terminalIsTty = isatty(STDIN_FILENO) && tcgetattr(STDIN_FILENO, &originalTermios) == 0;
+    if (!terminalIsTty)
+        return;
+    terminalCanPaste = isatty(STDOUT_FILENO);
+    atexit(terminal_restore);
+    int signals[] = { SIGINT, SIGTERM, SIGHUP, SIGQUIT, SIGTSTP };
+    for (int i = 0; i < sizeof(signals) / sizeof(signals[0]); i++)
+        terminal_installHandler(signals[i]);
+    terminal_setRaw(true);
+}
+
+// Line mode lets the terminal echo and edit a line before it's read, for the prompts that read whole lines
+void terminal_lineMode(bool on) {
+    terminal_setRaw(!on);
+}
+
+// Returns the next byte of input, or -1 at the end of the input (or, if wait is false, when there's none yet)
+internal int terminal_readByte(bool wait) {
+    if (inputQueueStart == inputQueueEnd) {
+        if (!wait) {
+            struct pollfd pollInput = { STDIN_FILENO, POLLIN, 0 };
+            if (poll(&pollInput, 1, 0) <= 0)
+                return -1;
+        }
+        // Whatever was printed before waiting for a key should be seen first
+        fflush(stdout);
+        ssize_t result;
+        do {
+            result = read(STDIN_FILENO, inputQueue, sizeof(inputQueue));
+        } while (result < 0 && errno == EINTR);
+        if (result <= 0)
+            return -1;
+        inputQueueStart = 0;
+        inputQueueEnd = (int) result;
+    }
+    return (unsigned char) inputQueue[inputQueueStart++];
+}
+
+// Like getchar, for reading from the same queue as getch
+int terminal_getchar(void) {
+    int c = terminal_readByte(true);
+    return (c == -1) ? EOF : c;
+}
+
+// Reads a bracketed paste, after the sequence that starts it, up to the sequence that ends it. The pasted text is
+// appended to *text, with its line endings (which terminals send as '\r') turned into '\n'.
+void terminal_readPaste(char **text) {
+    static const char endSequence[] = "\x1b[201~";
+    int matched = 0;
+    bool afterReturn = false;
+    for (;;) {
+        int c = terminal_readByte(true);
+        if (c == -1)
+            return;
+        if (c == endSequence[matched]) {
+            if (++matched == sizeof(endSequence) - 1)
+                return;
+            continue;
+        }
+        if (matched > 0) {
+            // Only looked like the end
+            memcpy(buf_add(*text, matched), endSequence, matched);
+            afterReturn = false;
+            matched = (c == endSequence[0]);
+            if (matched)
+                continue;
+        }
+        if (c == '\n' && afterReturn) {
+            afterReturn = false;
+            continue;
+        }
+        afterReturn = (c == '\r');
+        buf_push(*text, afterReturn ? '\n' : (char) c);
+    }
+}
+
+char getch() {
+    int c = terminal_readByte(true);
+    return (c == -1) ? 0 : (char) c;
 }
 
 char getch_nonblocking() {
-    /*#include <unistd.h>   //_getch*/
-    /*#include <termios.h>  //_getch*/
-    char buf=0;
-    struct termios old={0};
-    fflush(stdout);
-    if(tcgetattr(0, &old)<0)
-        perror("tcsetattr()");
-    old.c_lflag&=~ICANON;
-    old.c_lflag&=~ECHO;
-    old.c_cc[VMIN]=0;
-    old.c_cc[VTIME]=0;
-    if(tcsetattr(0, TCSANOW, &old)<0)
-        perror("tcsetattr ICANON");
-    if(read(0,&buf,1)<0)
-        perror("read()");
-    old.c_lflag|=ICANON;
-    old.c_lflag|=ECHO;
-    if(tcsetattr(0, TCSADRAIN, &old)<0)
-        perror ("tcsetattr ~ICANON");
-    return buf;
+    int c = terminal_readByte(false);
+    return (c == -1) ? 0 : (char) c;
 }
 
 // Hack for clearing screen for Linux and Mac // TODO: Improve this
@@ -69,6 +204,13 @@ void clrscr() {
 
 #endif
 
+// Quitting doesn't close the buffers, so their bookmarks and current lines are saved here
+internal void saveFileStates(void) {
+    for (int i = 0; i < buf_len(buffers); i++) {
+        fileState_save(&buffers[i]);
+    }
+}
+
 int main(int argc, char **argv) {
 #ifdef _WIN32
     // Used for printing in color on Windows
@@ -96,10 +238,28 @@ int main(int argc, char **argv) {
         return 0;
     }*/
     
+    buffer_internExtensions();
+    editorState_internCommands();
+    
+    // 'edim --benchmark hash' times the hash functions instead of starting the editor, 'edim --benchmark map' the hash maps
+    if (argc > 2 && strcmp(argv[1], "--benchmark") == 0) {
+        if (strcmp(argv[2], "hash") == 0) {
+            hash_benchmark();
+            return 0;
+        } else if (strcmp(argv[2], "map") == 0) {
+            map_benchmark();
+            return 0;
+        }
+        fprintf(stderr, "Unknown benchmark '%s'\n", argv[2]);
+        return 1;
+    }
+    
     char args[MAXLENGTH] = { 0 };
     int argsLength = 0;
     int running = true;
     
+    terminal_begin();
+    
     printf("Edim - Ed Improved\n");
     printf("Copyright (c) Christian Seibold. All Rights Reserved.\n\n");
     
@@ -113,6 +273,10 @@ int main(int argc, char **argv) {
     
     buffers = NULL;
     
+    char *budget = getenv("EDIM_UNDO_BUDGET");
+    if (budget != NULL && *budget != '\0')
+        undoBudget = (size_t) strtoull(budget, NULL, 10);
+    
     {
         Buffer buffer;
         buffer_initEmptyBuffer(&buffer);
@@ -150,6 +314,9 @@ int main(int argc, char **argv) {
         }
     }
     
+    // Symbol database for the current directory, if it has been indexed
+    symbolDb_load(".");
+    
     while (running) {
         State state = editorState_menu();
         
@@ -226,10 +393,14 @@ int main(int argc, char **argv) {
                 
                 if (!canQuit) {
                     printError("There are unsaved changes in at least one of the open buffers. Use 'E' or 'Q' to close without changes.");
-                } else exit(0);
+                } else {
+                    saveFileStates();
+                    exit(0);
+                }
             } break;
             case FORCE_QUIT:
             {
+                saveFileStates();
                 exit(0);
             } break;
         }
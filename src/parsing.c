@@ -46,12 +46,23 @@ char *skipNumbers(char *start, char *endBound) {
     return current;
 }
 
+// Identifiers of C-like languages: letters, numbers, and underscores
+char *skipIdentifier(char *start, char *endBound) {
+    char *current = start;
+    while ((*current >= 'A' && *current <= 'Z') || (*current >= 'a' && *current <= 'z')
+           || (*current >= '0' && *current <= '9') || *current == '_') {
+        ++current;
+        if (current > endBound) break;
+    }
+    return current;
+}
+
 // Specific to Edim Command Language
 char *skipLineNumber(char *start, char *endBound) {
     char *current = start;
-    if (*current == '\'') {
+    if (*current == '\'') { // Symbol name, like 'main
         ++current;
-        current = skipWord(current, endBound, true, false);
+        current = skipIdentifier(current, endBound);
     } else {
         // If symbol
         if ((*current >= '!' && *current <= '/')
@@ -78,6 +89,14 @@ long parseLineNumber(Buffer *buffer, char *start, char *endBound) {
     if (current == lineNumber.start) return 0; // No number found
     lineNumber.end = current;
     
+    // Definition of a symbol in the outline
+    if (lineNumber.start[0] == '\'') {
+        int lineIndex;
+        if (outline_findSymbol(buffer, lineNumber.start + 1, (int) (lineNumber.end - lineNumber.start - 1), &lineIndex, 1) == 0)
+            return 0;
+        return lineIndex + 1;
+    }
+    
     // Special Line Number Symbols
     if (lineNumber.end - lineNumber.start == 1) {
         switch (lineNumber.start[0]) {
@@ -133,16 +152,18 @@ as long as it doesn't go over the max.
 int parsing_getLine(char *line, int max, int trimSpace) {
     int c;
     int i = 0;
+    terminal_lineMode(true);
     
     /* Trim whitespace */
-    while (trimSpace && ((c = getchar()) == ' ' || c == '\t'))
+    while (trimSpace && ((c = terminal_getchar()) == ' ' || c == '\t'))
         ;
     
-    if (!trimSpace) c = getchar();
+    if (!trimSpace) c = terminal_getchar();
     
     /* If there's nothing left, return */
     if (c == '\n') {
         line[i] = '\0';
+        terminal_lineMode(false);
         return 1; /* Including \0 */
     }
     
@@ -151,13 +172,14 @@ int parsing_getLine(char *line, int max, int trimSpace) {
     {
         line[i] = (char) c;
         ++i;
-        c = getchar();
+        c = terminal_getchar();
     }
     
     /* End of string */
     line[i] = '\0';
     ++i; /* Includes '\0' in the length */
     
+    terminal_lineMode(false);
     return i;
 }
 
@@ -165,35 +187,132 @@ int parsing_getLine(char *line, int max, int trimSpace) {
 // Returns the length of the buffer.
 int parsing_getLine_dynamic(char **chars, int trimSpace) {
     int c;
+    terminal_lineMode(true);
     
     /* Trim whitespace */
-    while (trimSpace && ((c = getchar()) == ' ' || c == '\t'))
+    while (trimSpace && ((c = terminal_getchar()) == ' ' || c == '\t'))
         ;
     
-    if (!trimSpace) c = getchar();
+    if (!trimSpace) c = terminal_getchar();
     
     /* If there's nothing left, return */
     if (c == '\n') {
+        terminal_lineMode(false);
         return 0;
     }
     
     /* Push input characters onto buffer */
     while (c != EOF && c != '\n') {
         buf_push(*chars, (char) c);
-        c = getchar();
+        c = terminal_getchar();
     }
     
+    terminal_lineMode(false);
     return buf_len(*chars);
 }
 
+#ifndef _WIN32
+// Prints input chars the way getInput shows them
+internal void echoInput(const char *chars, int length) {
+    for (int i = 0; i < length; i++) {
+        if (chars[i] == '\t')
+            output_write("    ", 4);
+        else if (chars[i] == INPUT_ESC)
+            colors_printf(COLOR_RED, "$");
+        else output_char(chars[i]);
+    }
+}
+
+// Puts a bracketed paste into the input at the cursor, all at once and with one write to the terminal. Returns true if
+// the paste ended the input. That's when it has a line break: with pasteRest, the input becomes every line the paste
+// completes and what's left after the last break goes in *pasteRest, for the next line. Without it, the input ends
+// at the first break and the rest of the paste is dropped, so that it isn't run as commands.
+internal bool insertPaste(char **inputBuffer, int *currentIndex, char **pasteRest) {
+    char *paste = NULL;
+    terminal_readPaste(&paste);
+    if (buf_len(paste) == 0)
+        return false;
+    char *firstBreak = memchr(paste, '\n', buf_len(paste));
+    
+    output_beginFrame();
+    if (firstBreak == NULL || pasteRest == NULL) {
+        int length = (firstBreak != NULL) ? (int) (firstBreak - paste) : buf_len(paste);
+        char *oldEnd = buf_add(*inputBuffer, length);
+        int after = (int) (oldEnd - (*inputBuffer + *currentIndex));
+        memmove(*inputBuffer + *currentIndex + length, *inputBuffer + *currentIndex, after);
+        memcpy(*inputBuffer + *currentIndex, paste, length);
+        echoInput(*inputBuffer + *currentIndex, length + after);
+        *currentIndex += length;
+        if (firstBreak == NULL) {
+            // Back to the cursor
+            for (int i = *currentIndex; i < buf_len(*inputBuffer); i++)
+                output_write("\b\b\b\b", (*inputBuffer)[i] == '\t' ? 4 : 1);
+            output_endFrame();
+            buf_free(paste);
+            return false;
+        }
+        output_char('\n');
+        buf_push(*inputBuffer, '\n');
+        if (firstBreak + 1 < buf_end(paste))
+            printError("Only the first line of the paste was used.\n");
+        output_endFrame();
+        buf_free(paste);
+        return true;
+    }
+    
+    // The paste keeps its own indentation, so what was put in front of it (like autoindent) goes if that's all there is
+    bool onlyIndent = true;
+    for (int i = 0; i < *currentIndex && onlyIndent; i++)
+        onlyIndent = ((*inputBuffer)[i] == '\t' || (*inputBuffer)[i] == ' ');
+    
+    char *lastBreak = buf_end(paste) - 1;
+    while (*lastBreak != '\n')
+        --lastBreak;
+    char *rest = NULL;
+    int afterCursor = buf_len(*inputBuffer) - *currentIndex;
+    int restLength = (int) (buf_end(paste) - (lastBreak + 1));
+    if (restLength + afterCursor > 0) {
+        memcpy(buf_add(rest, restLength), lastBreak + 1, restLength);
+        memcpy(buf_add(rest, afterCursor), *inputBuffer + *currentIndex, afterCursor);
+    }
+    *pasteRest = rest;
+    
+    if (*inputBuffer != NULL)
+        buf__hdr(*inputBuffer)->len = onlyIndent ? 0 : *currentIndex;
+    int length = (int) (lastBreak + 1 - paste);
+    memcpy(buf_add(*inputBuffer, length), paste, length);
+    *currentIndex = buf_len(*inputBuffer);
+    output_char('\n');
+    output_endFrame();
+    buf_free(paste);
+    return true;
+}
+#endif
+
 // TODO: Test on macOS and BSD!
 // TODO: bool printNewLine
 // TODO: Placeholder/Ghost text
 // TODO: Autocomplete?
+internal char *readInput(bool *canceled, char *inputBuffer, inputKeyCallback callback, bool prefillIsInput, char **pasteRest);
+
 char *getInput(bool *canceled, char *inputBuffer, inputKeyCallback callback) {
+    return readInput(canceled, inputBuffer, callback, false, NULL);
+}
+
+// Like getInput, except that a paste with more than one line gives back all of them at once (see insertPaste).
+// When inputBuffer is what the last paste left in *pasteRest, it counts as input, so ending the input right away
+// still gives it back instead of dropping it.
+char *getInputLines(bool *canceled, char *inputBuffer, char **pasteRest) {
+    bool prefillIsInput = (*pasteRest != NULL && *pasteRest == inputBuffer);
+    *pasteRest = NULL;
+    return readInput(canceled, inputBuffer, NULL, prefillIsInput, pasteRest);
+}
+
+// prefillIsInput - inputBuffer is input the user already gave, rather than a default (like autoindent) to type after
+internal char *readInput(bool *canceled, char *inputBuffer, inputKeyCallback callback, bool prefillIsInput, char **pasteRest) {
     (*canceled) = false;
     int currentIndex = 0;
-    int defaultLength = buf_len(inputBuffer);
+    int defaultLength = prefillIsInput ? 0 : buf_len(inputBuffer);
     
     if (inputBuffer != NULL && buf_len(inputBuffer) > 0) {
         for (int i = 0; i < buf_len(inputBuffer); i++) {
@@ -207,6 +326,7 @@ char *getInput(bool *canceled, char *inputBuffer, inputKeyCallback callback) {
     }
     
     char c;
+    bool pasted = false; // A paste ended the input
     while ((c = getch()) != INPUT_ENDINPUT) { // Ctrl-Z for Windows, Ctrl-D for Linux
 #ifdef _WIN32
         if (c == INPUT_SPECIAL1 || c == INPUT_SPECIAL2)
@@ -289,6 +409,16 @@ char *getInput(bool *canceled, char *inputBuffer, inputKeyCallback callback) {
                         else putchar('\b');
                     }
                     currentIndex = 0;
+#ifndef _WIN32
+                } else if (specialkey == INPUT_PASTE1) {
+                    // ESC [ 2 ~ is the Insert key
+                    if (getch() == '0' && getch() == '0' && getch() == '~') {
+                        if (insertPaste(&inputBuffer, &currentIndex, pasteRest)) {
+                            pasted = true;
+                            break;
+                        }
+                    }
+#endif
                     //} else if (special == 115) { // Ctrl+Left // TODO
                     //} else if (special == 116) { // Ctrl+Right // TODO
                 } else {
@@ -463,7 +593,7 @@ char *getInput(bool *canceled, char *inputBuffer, inputKeyCallback callback) {
     }
     
     // If no input was made, free the buffer and return;
-    if (buf_len(inputBuffer) - defaultLength <= 0) {
+    if (!pasted && buf_len(inputBuffer) - defaultLength <= 0) {
         if (inputBuffer != NULL)
             buf_free(inputBuffer);
     }
@@ -471,7 +601,7 @@ char *getInput(bool *canceled, char *inputBuffer, inputKeyCallback callback) {
     // If there's no new line - which there shouldn't be -
     // then add it.
     if (inputBuffer != NULL && *(buf_end(inputBuffer) - 1) != '\n') {
-        buf_add(inputBuffer, '\n');
+        buf_push(inputBuffer, '\n');
     }
     
     if (buf_len(inputBuffer) == 0) {
@@ -485,410 +615,703 @@ char *getInput(bool *canceled, char *inputBuffer, inputKeyCallback callback) {
     return inputBuffer;
 }
 
-void getFileTypeExtension(FileType ft, char **ftExt) {
-    switch (ft) {
-        case FT_TEXT:
-        {
-            (*ftExt) = malloc(sizeof(char) * 3);
-            (*ftExt)[0] = 't';
-            (*ftExt)[1] = 'x';
-            (*ftExt)[2] = 't';
-        } break;
-        case FT_MARKDOWN:
-        {
-            (*ftExt) = malloc(sizeof(char) * 2);
-            (*ftExt)[0] = 'm';
-            (*ftExt)[1] = 'd';
-        } break;
-        case FT_C:
-        {
-            (*ftExt) = malloc(sizeof(char) * 1);
-            (*ftExt)[0] = 'c';
-        } break;
-        case FT_CPP:
-        {
-            (*ftExt) = malloc(sizeof(char) * 3);
-            (*ftExt)[0] = 'c';
-            (*ftExt)[1] = 'p';
-            (*ftExt)[2] = 'p';
-        } break;
-        case FT_C_HEADER:
-        {
-            (*ftExt) = malloc(sizeof(char) * 1);
-            (*ftExt)[0] = 'h';
-        } break;
+// Returns the index of the next token after the given one that isn't a comment, or -1 if there are none left in the line
+internal int nextSignificantToken(Token *tokens, int index) {
+    for (int i = index + 1; i < buf_len(tokens); i++) {
+        if (tokens[i].kind != TOKEN_COMMENT)
+            return i;
     }
+    return -1;
 }
 
-void createOutline(void) {
-    switch (currentBuffer->fileType) {
-        case FT_MARKDOWN:
-        {
-            createMarkdownOutline();
-        } break;
-        case FT_C:
-        {
-            createCOutline();
-        } break;
+internal bool tokenIsChar(Line *line, Token *token, char c) {
+    return token->kind == TOKEN_PUNCTUATION && token->length == 1 && line_chars(line)[token->start] == c;
+}
+
+// Checks whether the line starts a function definition: a return type, a name, and the parameter list, followed by the '{' of the body on the same line or at the start of the next line.
+// The lines must already be lexed.
+internal bool isCFunctionDefinition(Buffer *buffer, int lineIndex, OutlineNode *node) {
+    Line *line = &(buffer->lines[lineIndex]);
+    Token *tokens = line->tokens;
+    
+    // Lines that start inside a comment, string, or directive aren't declarations
+    if (line->lexEntry != LEX_STATE_NORMAL)
+        return false;
+    
+    // Return type (including qualifiers like static/internal/inline/const) and then the name, which must be directly followed by '('
+    int typeTokens = 0;
+    int paren = -1;
+    for (int t = nextSignificantToken(tokens, -1); t != -1; t = nextSignificantToken(tokens, t)) {
+        Token *token = &tokens[t];
+        if (token->flags & (TOKEN_FLAG_PREPROCESSOR | TOKEN_FLAG_CONTROL))
+            return false;
+        if (token->kind == TOKEN_IDENTIFIER || token->kind == TOKEN_KEYWORD || token->kind == TOKEN_TYPE) {
+            int next = nextSignificantToken(tokens, t);
+            if (next != -1 && tokenIsChar(line, &tokens[next], '(')) {
+                if (token->kind != TOKEN_IDENTIFIER || typeTokens == 0)
+                    return false;
+                node->nameStart = token->start;
+                node->nameLength = token->length;
+                paren = next;
+                break;
+            }
+            ++typeTokens;
+        } else if (tokenIsChar(line, token, '*')) {
+            continue;
+        } else return false;
+    }
+    if (paren == -1)
+        return false;
+    
+    // Find the matching right parenthesis. The parameter list must be on one line.
+    int depth = 0;
+    int t = paren;
+    for (; t != -1; t = nextSignificantToken(tokens, t)) {
+        if (tokenIsChar(line, &tokens[t], '(')) {
+            ++depth;
+        } else if (tokenIsChar(line, &tokens[t], ')')) {
+            if (--depth == 0) break;
+        }
     }
+    if (t == -1)
+        return false;
+    
+    // The body has to start right after, otherwise it's just a declaration (or a call)
+    int next = nextSignificantToken(tokens, t);
+    if (next != -1)
+        return tokenIsChar(line, &tokens[next], '{');
+    
+    // Check next line
+    if (lineIndex + 1 >= buf_len(buffer->lines))
+        return false;
+    Line *nextLine = &(buffer->lines[lineIndex + 1]);
+    int first = nextSignificantToken(nextLine->tokens, -1);
+    return first != -1 && tokenIsChar(nextLine, &nextLine->tokens[first], '{');
 }
 
-// Currently, after every operation that modifies the file, the outline is recreated.
-// TODO: Perhaps it would be more efficient to only change the line a node points to when
-// that line is moved/changed by using some type of hash table for integer keys.
-void recreateOutline(void) {
-    switch (currentBuffer->fileType) {
-        case FT_MARKDOWN:
-        {
-            // Pop off all of the current nodes
-            if (buf_len(currentBuffer->outline.markdown_nodes) > 0)
-                buf_pop_all(currentBuffer->outline.markdown_nodes);
-            assert(buf_len(currentBuffer->outline.markdown_nodes) == 0);
-            createMarkdownOutline();
-        } break;
-        case FT_C:
-        {
-            // Pop off all of the current nodes
-            if (buf_len(currentBuffer->outline.c_nodes))
-                buf_pop_all(currentBuffer->outline.c_nodes);
-            assert(buf_len(currentBuffer->outline.c_nodes) == 0);
-            createCOutline();
-        } break;
+internal bool tokenIsKeyword(Line *line, Token *token, const char *keyword) {
+    return token->kind != TOKEN_IDENTIFIER && token->kind != TOKEN_PUNCTUATION && lexer_tokenEquals(line, token, keyword);
+}
+
+internal int firstSignificantToken(Line *line) {
+    return nextSignificantToken(line->tokens, -1);
+}
+
+internal int lastSignificantToken(Line *line) {
+    for (int i = buf_len(line->tokens) - 1; i >= 0; i--) {
+        if (line->tokens[i].kind != TOKEN_COMMENT)
+            return i;
     }
+    return -1;
 }
 
-void showOutline(void) {
-    switch (currentBuffer->fileType) {
-        case FT_MARKDOWN:
-        {
-            showMarkdownOutline();
-        } break;
-        case FT_C:
-        {
-            showCOutline();
-        } break;
+// Skips a balanced group of open/close punctuation starting at index (which must be the open char).
+// Returns the index of the closing token, or -1 if it isn't closed on this line.
+internal int skipGroup(Line *line, int index, char open, char close) {
+    int depth = 0;
+    for (int t = index; t != -1; t = nextSignificantToken(line->tokens, t)) {
+        if (tokenIsChar(line, &line->tokens[t], open)) {
+            ++depth;
+        } else if (tokenIsChar(line, &line->tokens[t], close)) {
+            if (--depth == 0) return t;
+        }
     }
+    return -1;
 }
 
-void createMarkdownOutline(void) {
-    assert(currentBuffer->fileType == FT_MARKDOWN);
-    
-    // Go through each line
-    for (int line = 0; line < buf_len(currentBuffer->lines); line++) {
-        // If starts with a hash, then it's a heading
-        if (currentBuffer->lines[line].chars[0] == '#') {
-            int level = 0;
-            // Increment level with each successive '#'
-            for (int i = 1; i < buf_len(currentBuffer->lines[line].chars); i++) {
-                if (currentBuffer->lines[line].chars[i] == '#') {
-                    level++;
-                } else break;
-            }
-            
-            // create the node and push it
-            MarkdownOutlineNode node;
-            node.line = &(currentBuffer->lines[line]);
-            node.lineNum = line;
-            node.level = level;
-            
-            buf_push(currentBuffer->outline.markdown_nodes, node);
+// Whether the body's '{' comes after the given token (-1 to check from the start of the next line).
+// A ';' or '=' before it means it's a declaration, not a definition.
+internal bool bodyFollows(Buffer *buffer, int lineIndex, int t, bool allowNextLineColon) {
+    Line *line = &(buffer->lines[lineIndex]);
+    for (t = nextSignificantToken(line->tokens, t); t != -1; t = nextSignificantToken(line->tokens, t)) {
+        if (tokenIsChar(line, &line->tokens[t], '{'))
+            return true;
+        if (tokenIsChar(line, &line->tokens[t], ';') || tokenIsChar(line, &line->tokens[t], '='))
+            return false;
+        // Constructor initializer list: the '{' ends the line, but member initializers can use braces too
+        if (tokenIsChar(line, &line->tokens[t], ':') && allowNextLineColon) {
+            int last = lastSignificantToken(line);
+            if (tokenIsChar(line, &line->tokens[last], '{'))
+                return true;
+            break;
         }
     }
+    if (t != -1)
+        return false;
+    
+    // Check next line
+    if (lineIndex + 1 >= buf_len(buffer->lines))
+        return false;
+    Line *nextLine = &(buffer->lines[lineIndex + 1]);
+    int first = firstSignificantToken(nextLine);
+    if (first == -1)
+        return false;
+    return tokenIsChar(nextLine, &nextLine->tokens[first], '{')
+        || (allowNextLineColon && tokenIsChar(nextLine, &nextLine->tokens[first], ':'));
+}
+
+// A line that holds only a template header, like 'template <typename T>'
+internal bool isTemplateHeaderLine(Line *line) {
+    int first = firstSignificantToken(line);
+    if (first == -1 || line->lexEntry != LEX_STATE_NORMAL || !tokenIsKeyword(line, &line->tokens[first], "template"))
+        return false;
+    int open = nextSignificantToken(line->tokens, first);
+    if (open == -1 || !tokenIsChar(line, &line->tokens[open], '<'))
+        return false;
+    int close = skipGroup(line, open, '<', '>');
+    return close != -1 && nextSignificantToken(line->tokens, close) == -1;
 }
 
-// TODO: This will be greatly improved once I have a lexer
-// and some general parser utils
-void createCOutline(void) {
-    assert(currentBuffer->fileType == FT_C);
+// Checks whether the line starts a C++ definition: a namespace, a class/struct/union/enum, or a function (including
+// member functions like 'Foo::bar', constructors/destructors and operator overloads). The lines must already be lexed.
+internal bool isCppDefinition(Buffer *buffer, int lineIndex, OutlineNode *node) {
+    Line *line = &(buffer->lines[lineIndex]);
+    Token *tokens = line->tokens;
     
-    // Go through each line
-    for (int line = 0; line < buf_len(currentBuffer->lines); line++) {
-        char *start = &(currentBuffer->lines[line].chars[0]);
-        char *current = start;
-        int lineLength = buf_len(currentBuffer->lines[line].chars);
-        
-        // Skip whitespace
-        while ((current - start < lineLength) && *current == ' ' || *current == '\t') {
-            ++current;
-        }
-        
-        // Support optional 'internal' or 'static' before function declaration
-        // TODO: This is hacky
-        if (*current == 'i' && *(current + 1) == 'n' && *(current + 2) == 't' && *(current + 3) == 'e' && *(current + 4) == 'r' && *(current + 5) == 'n' && *(current + 6) == 'a' && *(current + 7) == 'l' && *(current + 8) == ' ')
-        {
-            current += 8;
-            
-            // Skip whitespace
-            while (current - start < lineLength && (*current == ' ' || *current == '\t')) ++current;
-        } else if (*current == 'i' && *(current + 1) == 'n' && *(current + 2) == 'l' && *(current + 3) == 'i' && *(current + 4) == 'n' && *(current + 5) == 'e' && *(current + 6) == ' ') {
-            current += 7;
-            
-            // Skip whitespace
-            while (current - start < lineLength && (*current == ' ' || *current == '\t'))
-                ++current;
-        } else if (*current == 's') {
-            char str[7] = "static ";
-            int i = 0;
-            int startsWithStatic = true;
-            while (i < 7 && (current + i) - start < lineLength) {
-                if (*(current + i) != str[i]) {
-                    startsWithStatic = false;
-                    break;
-                }
-                ++i;
-            }
-            if (startsWithStatic) {
-                current += 7;
+    if (line->lexEntry != LEX_STATE_NORMAL)
+        return false;
+    
+    node->flags = 0;
+    node->level = 0;
+    
+    int t = firstSignificantToken(line);
+    if (t == -1)
+        return false;
+    
+    // Template header, either on this line or on the line before
+    if (tokenIsKeyword(line, &tokens[t], "template")) {
+        int open = nextSignificantToken(tokens, t);
+        if (open == -1 || !tokenIsChar(line, &tokens[open], '<'))
+            return false;
+        int close = skipGroup(line, open, '<', '>');
+        if (close == -1)
+            return false;
+        t = nextSignificantToken(tokens, close);
+        if (t == -1)
+            return false; // The declaration is on the next line
+        node->flags |= OUTLINE_FLAG_TEMPLATE;
+    } else if (lineIndex > 0 && isTemplateHeaderLine(&(buffer->lines[lineIndex - 1]))) {
+        node->flags |= OUTLINE_FLAG_TEMPLATE;
+    }
+    
+    // Specifiers that can come before anything else
+    while (t != -1 && (tokenIsKeyword(line, &tokens[t], "export") || tokenIsKeyword(line, &tokens[t], "inline")))
+        t = nextSignificantToken(tokens, t);
+    if (t == -1)
+        return false;
+    
+    // Namespaces: 'namespace a {', 'namespace a::b {', or an anonymous 'namespace {'
+    if (tokenIsKeyword(line, &tokens[t], "namespace")) {
+        // Anonymous namespaces have no name to look up
+        node->nameStart = 0;
+        node->nameLength = 0;
+        int n = nextSignificantToken(tokens, t);
+        while (n != -1 && (tokens[n].kind == TOKEN_IDENTIFIER || lexer_tokenEquals(line, &tokens[n], "::"))) {
+            if (tokens[n].kind == TOKEN_IDENTIFIER) {
+                node->nameStart = tokens[n].start;
+                node->nameLength = tokens[n].length;
             }
-            
-            // Skip whitespace
-            while (current - start < lineLength && (*current == ' ' || *current == '\t')) ++current;
-        } else if (*current == 'c') {
-            char str[6] = "const ";
-            int i = 0;
-            int startsWithConst = true;
-            while (i < 6 && (current + i) - start < lineLength) {
-                if (*(current + i) != str[i]) {
-                    startsWithConst = false;
-                    break;
-                }
-                ++i;
+            n = nextSignificantToken(tokens, n);
+        }
+        if (n != -1 && !tokenIsChar(line, &tokens[n], '{'))
+            return false; // Namespace alias or something else
+        node->kind = OUTLINE_NAMESPACE;
+        return n != -1 || bodyFollows(buffer, lineIndex, lastSignificantToken(line), false);
+    }
+    
+    // Class types. Anything with parentheses is a function returning one ('struct foo *make(...)'), so that falls through.
+    OutlineNodeKind kind = OUTLINE_FUNCTION;
+    if (tokenIsKeyword(line, &tokens[t], "class")) kind = OUTLINE_CLASS;
+    else if (tokenIsKeyword(line, &tokens[t], "struct")) kind = OUTLINE_STRUCT;
+    else if (tokenIsKeyword(line, &tokens[t], "union")) kind = OUTLINE_UNION;
+    else if (tokenIsKeyword(line, &tokens[t], "enum")) kind = OUTLINE_ENUM;
+    if (kind != OUTLINE_FUNCTION) {
+        bool named = false;
+        bool hasParen = false;
+        int n = nextSignificantToken(tokens, t);
+        for (; n != -1; n = nextSignificantToken(tokens, n)) {
+            // The first identifier is the name, the ones after the ':' are base classes
+            if (tokens[n].kind == TOKEN_IDENTIFIER && !named) {
+                named = true;
+                node->nameStart = tokens[n].start;
+                node->nameLength = tokens[n].length;
             }
-            if (startsWithConst) {
-                current += 6;
+            if (tokenIsChar(line, &tokens[n], '(') || tokenIsChar(line, &tokens[n], '=') || tokenIsChar(line, &tokens[n], ';')) {
+                hasParen = true;
+                break;
             }
-            
-            // Skip whitespace
-            if (current - start < lineLength && (*current == ' ' || *current == '\t'))
-                ++current;
+            if (tokenIsChar(line, &tokens[n], '{'))
+                break;
+        }
+        if (!hasParen) {
+            node->kind = kind;
+            if (!named) return false;
+            return n != -1 || bodyFollows(buffer, lineIndex, lastSignificantToken(line), false);
         }
+    }
+    
+    // Functions: return type (possibly none, for constructors and destructors), then the name directly followed by '('
+    int paren = -1;
+    for (; t != -1; t = nextSignificantToken(tokens, t)) {
+        Token *token = &tokens[t];
+        if (token->flags & (TOKEN_FLAG_PREPROCESSOR | TOKEN_FLAG_CONTROL))
+            return false;
         
-        int isDeclaration = true;
-        switch(*current) {
-            case 'v':
-            {
-                char str[5] = "void ";
-                int i = 0;
-                while (i < 5 && current - start < lineLength) {
-                    if (*current != str[i]) {
-                        isDeclaration = false;
-                        break;
-                    }
-                    ++current;
-                    ++i;
-                }
-            } break;
-            case 'i':
-            {
-                char str[4] = "int ";
-                int i = 0;
-                while (i < 4 && current - start < lineLength) {
-                    if (*current != str[i]) {
-                        isDeclaration = false;
-                        break;
-                    }
-                    ++current;
-                    ++i;
-                }
-            } break;
-            case 'f':
-            {
-                char str[6] = "float ";
-                int i = 0;
-                while (i < 6 && current - start < lineLength) {
-                    if (*current != str[i]) {
-                        isDeclaration = false;
-                        break;
-                    }
-                    ++current;
-                    ++i;
-                }
-            } break;
-            case 'd':
-            {
-                char str[7] = "double ";
-                int i = 0;
-                while (i < 7 && current - start < lineLength) {
-                    if (*current != str[i]) {
-                        isDeclaration = false;
-                        break;
-                    }
-                    ++current;
-                    ++i;
-                }
-            } break;
-            case 'b':
-            {
-                char str[5] = "bool ";
-                int i = 0;
-                while (i < 5 && current - start < lineLength) {
-                    if (*current != str[i]) {
-                        isDeclaration = false;
-                        break;
-                    }
-                    ++current;
-                    ++i;
-                }
-            } break;
-            case 'c':
-            {
-                char str[5] = "char ";
-                int i = 0;
-                while (i < 5 && current - start < lineLength) {
-                    if (*current != str[i]) {
-                        isDeclaration = false;
-                        break;
-                    }
-                    ++current;
-                    ++i;
-                }
-            } break;
-            default:
-            {
-                // Commented this because currently checking for parentheses to only allow function declarations, and this will allow us to show all functions that return types that aren't primitive
-                //isDeclaration = false;
-                
-                // Check that there's a space between the type and the function name
-                // Skip all characters except for space
-                while (current - start < lineLength) {
-                    if (*current == ' ' || *current == '\t') {
-                        break;
-                    }
-                    ++current;
-                }
-                // Make sure not at end of line
-                if (current - start >= lineLength)
-                    isDeclaration = false;
-                // Make sure there's at least one space
-                if (*current != ' ' && *current != '\t') isDeclaration = false;
-            } break;
+        if (tokenIsKeyword(line, token, "operator")) {
+            node->flags |= OUTLINE_FLAG_OPERATOR;
+            node->nameStart = token->start;
+            int n = nextSignificantToken(tokens, t);
+            // 'operator()' - the first pair of parentheses is part of the name
+            if (n != -1 && tokenIsChar(line, &tokens[n], '(')) {
+                n = nextSignificantToken(tokens, n);
+                if (n == -1 || !tokenIsChar(line, &tokens[n], ')'))
+                    return false;
+                n = nextSignificantToken(tokens, n);
+            }
+            // The operator itself (or the conversion type) runs up to the parameter list
+            // The name is everything up to the last token before the parameter list, like 'operator==' or 'operator()'
+            int last = t;
+            while (n != -1 && !tokenIsChar(line, &tokens[n], '(')) {
+                last = n;
+                n = nextSignificantToken(tokens, n);
+            }
+            node->nameLength = tokens[last].start + tokens[last].length - node->nameStart;
+            paren = n;
+            break;
         }
         
-        if (isDeclaration == true) {
-            int isFunctionDeclaration = false;
-            
-            // Skip whitespace
-            while (*current == ' ' || *current == '\t') ++current;
-            
-            // Make sure there's at least one character for the function name
-            if (*current != '(' && *current != ')' && *current != '=' && *current != '"' && *current != '\'' && *current != ',' && current - start < lineLength) {
-                ++current;
-                
-                // Skip all characters except for left parentheses and equals
-                // Don't skip whitespace, function names can't have whitespace
-                // TODO: There can be a whitespace between the function name and the left parentheses - this isn't checking for that yet.
-                while (current - start < lineLength) {
-                    if (*current == '(') {
-                        isFunctionDeclaration = true;
-                        break;
-                    } else if (*current == '=' || *current == ',' || *current == '"' || *current == '\'' || *current == ' ' || *current == '\t') { // Don't allow certain characters in function names
-                        isFunctionDeclaration = false;
-                        break;
-                    }
-                    ++current;
-                }
-                int foundRightParen = false;
-                // Skip all characters except for right parentheses
-                while (current - start < lineLength) {
-                    if(*current == ')') {
-                        foundRightParen = true;
-                        ++current;
-                        break;
-                    }
-                    if (*current == '=') {
-                        isFunctionDeclaration = false;
-                        break;
-                    }
-                    ++current;
-                }
-                
-                // If reached end without finding the right parentheses, it's (perhaps) not a function declaration
-                if (!foundRightParen) {
-                    isFunctionDeclaration = false;
-                } else {
-                    // Skip whitespace
-                    while (current - start < lineLength && (*current == ' ' || *current == '\t')) ++current;
-                    
-                    // Check if next character is '{', if not, check next line
-                    if (*current == '{' && current - start < lineLength) {
-                        isFunctionDeclaration = true;
-                    } else {
-                        // Check next line
-                        char *startNextLine = &(currentBuffer->lines[line + 1].chars[0]);
-                        char *currentNextLine = startNextLine;
-                        
-                        // Skip whitespace
-                        while (*currentNextLine == ' ' || *currentNextLine == '\t') ++currentNextLine;
-                        // Check that first non-whitespace character of next line is '{'
-                        if (*currentNextLine == '{') {
-                            isFunctionDeclaration = true;
-                        } else {
-                            isFunctionDeclaration = false;
-                        }
-                    }
-                }
+        if (token->kind == TOKEN_IDENTIFIER || token->kind == TOKEN_KEYWORD || token->kind == TOKEN_TYPE) {
+            int next = nextSignificantToken(tokens, t);
+            if (next != -1 && tokenIsChar(line, &tokens[next], '(')) {
+                if (token->kind != TOKEN_IDENTIFIER)
+                    return false;
+                node->nameStart = token->start;
+                node->nameLength = token->length;
+                paren = next;
+                break;
             }
-            
-            // Only add Function declarations
-            if (isFunctionDeclaration) {
-                COutlineNode node;
-                node.line = &(currentBuffer->lines[line]);
-                node.lineNum = line;
-                
-                buf_push(currentBuffer->outline.c_nodes, node);
+        } else if (lexer_tokenEquals(line, token, "::")) {
+            int next = nextSignificantToken(tokens, t);
+            // Only the last qualifier matters, 'a::b::c' is still a member of 'b'
+            if (next != -1) {
+                int after = nextSignificantToken(tokens, next);
+                if (tokenIsChar(line, &tokens[next], '~') || tokenIsKeyword(line, &tokens[next], "operator")
+                    || (after != -1 && tokenIsChar(line, &tokens[after], '(')))
+                    node->flags |= OUTLINE_FLAG_MEMBER;
+            }
+        } else if (tokenIsChar(line, token, '<')) {
+            // Template arguments in the return type or name
+            t = skipGroup(line, t, '<', '>');
+            if (t == -1) return false;
+        } else if (tokenIsChar(line, token, '[')) {
+            // Attributes, like [[nodiscard]]
+            t = skipGroup(line, t, '[', ']');
+            if (t == -1) return false;
+        } else if (tokenIsChar(line, token, '*') || tokenIsChar(line, token, '&') || tokenIsChar(line, token, '~')) {
+            continue;
+        } else return false;
+    }
+    if (paren == -1)
+        return false;
+    
+    // The parameter list must be on one line
+    int close = skipGroup(line, paren, '(', ')');
+    if (close == -1)
+        return false;
+    
+    node->kind = OUTLINE_FUNCTION;
+    return bodyFollows(buffer, lineIndex, close, true);
+}
+
+bool outline_isSupported(FileType ft) {
+    return ft == FT_MARKDOWN || ft == FT_C || ft == FT_C_HEADER || ft == FT_CPP;
+}
+
+// Checks whether the line at index should be in the outline. The lines must already be lexed for C/C++.
+internal bool scanOutlineLine(Buffer *buffer, int index, OutlineNode *node) {
+    Line *line = &(buffer->lines[index]);
+    switch (buffer->fileType) {
+        case FT_MARKDOWN:
+        {
+            char *chars = line_chars(line);
+            int length = line_length(line);
+            // If starts with a hash, then it's a heading
+            if (length == 0 || chars[0] != '#')
+                return false;
+            int level = 0;
+            // Increment level with each successive '#'
+            for (int i = 1; i < length; i++) {
+                if (chars[i] == '#') {
+                    level++;
+                } else break;
             }
+            node->kind = OUTLINE_HEADING;
+            node->level = level;
+            node->flags = 0;
+            
+            // The heading text, without the hashes and surrounding whitespace
+            int start = level + 1;
+            int end = length;
+            while (start < end && (chars[start] == ' ' || chars[start] == '\t'))
+                ++start;
+            while (end > start && (chars[end - 1] == ' ' || chars[end - 1] == '\t' || chars[end - 1] == '\n' || chars[end - 1] == '\r'))
+                --end;
+            node->nameStart = start;
+            node->nameLength = end - start;
+            return true;
+        } break;
+        case FT_C:
+        case FT_C_HEADER:
+        {
+            // Only add Function definitions
+            node->kind = OUTLINE_FUNCTION;
+            node->level = 0;
+            node->flags = 0;
+            return isCFunctionDefinition(buffer, index, node);
+        } break;
+        case FT_CPP:
+        {
+            return isCppDefinition(buffer, index, node);
+        } break;
+        default: return false;
+    }
+}
+
+internal void resetOutlineChanges(Buffer *buffer) {
+    buffer->changedStart = -1;
+    buffer->changedEnd = -1;
+    buffer->changedLineDelta = 0;
+}
+
+// Scans the lines from start to end (indices, inclusive) and pushes the nodes found onto outline
+internal void scanOutlineRange(Buffer *buffer, int start, int end, OutlineNode **outline) {
+    for (int i = start; i <= end; i++) {
+        OutlineNode node;
+        if (scanOutlineLine(buffer, i, &node)) {
+            node.line = buffer_anchorLine(buffer, i);
+            buf_push(*outline, node);
         }
     }
 }
 
-void showMarkdownOutline(void) {
-    assert(currentBuffer->fileType == FT_MARKDOWN);
+// Builds the whole outline from scratch. Only touches the given buffer, so it's safe to call from other threads on buffers that aren't open.
+void outline_build(Buffer *buffer) {
+    if (buffer->outline)
+        buf_pop_all(buffer->outline);
+    resetOutlineChanges(buffer);
+    buffer->symbolIndexStale = true;
+    if (!outline_isSupported(buffer->fileType))
+        return;
     
-    // Go though each node
-    for (int node_i = 0; node_i < buf_len(currentBuffer->outline.markdown_nodes); node_i++) {
-        int linenum = currentBuffer->outline.markdown_nodes[node_i].line - currentBuffer->lines;
-        printLine(linenum, 0, true);
-        // Print out the line
-        //printLine(currentBuffer->outline.markdown_nodes[node_i].lineNum, 0, true);
-    }
+    // The outline uses the lexer's cached tokens, so only the lines that changed since the last time get relexed
+    if (lexer_isC(buffer->fileType))
+        lexer_ensureLexed(buffer, buf_len(buffer->lines) - 1);
+    scanOutlineRange(buffer, 0, buf_len(buffer->lines) - 1, &buffer->outline);
+}
+
+void createOutline(void) {
+    outline_build(currentBuffer);
 }
 
-void showCOutline(void) {
-    assert(currentBuffer->fileType == FT_C);
+// Where the node's line is now. Nodes before the changed range kept their index, the ones after it moved by changedLineDelta,
+// so the hint is usually right without having to go through the line index.
+internal int resolveOutlineNode(Buffer *buffer, OutlineNode *node) {
+    if (buffer->changedStart != -1 && node->line.hint >= buffer->changedStart)
+        node->line.hint += buffer->changedLineDelta;
+    return buffer_resolveAnchor(buffer, &node->line);
+}
+
+// Called after every operation that modifies the file. Only the lines that changed since the last update
+// (plus one line on each side, since a definition can depend on the line before or after it) are scanned again.
+void recreateOutline(void) {
+    Buffer *buffer = currentBuffer;
+    if (!outline_isSupported(buffer->fileType)) {
+        resetOutlineChanges(buffer);
+        return;
+    }
     
+    // Relexing can change lines after the edited ones too (eg. opening a block comment), which widens the changed range
+    if (lexer_isC(buffer->fileType))
+        lexer_ensureLexed(buffer, buf_len(buffer->lines) - 1);
+    if (buffer->changedStart == -1)
+        return;
+    
+    int lineCount = buf_len(buffer->lines);
+    int scanStart = MAX(buffer->changedStart - 1, 0);
+    int scanEnd = MIN(buffer->changedEnd + 1, lineCount - 1);
+    
+    // Keep the nodes outside of the scanned range, in order, and rescan the range itself
+    OutlineNode *outline = NULL;
+    int node_i = 0;
+    for (; node_i < buf_len(buffer->outline); node_i++) {
+        OutlineNode node = buffer->outline[node_i];
+        int index = resolveOutlineNode(buffer, &node);
+        if (index == -1) continue; // Line was deleted
+        if (index >= scanStart) break;
+        buf_push(outline, node);
+    }
+    scanOutlineRange(buffer, scanStart, scanEnd, &outline);
+    for (; node_i < buf_len(buffer->outline); node_i++) {
+        OutlineNode node = buffer->outline[node_i];
+        int index = resolveOutlineNode(buffer, &node);
+        if (index == -1 || index <= scanEnd) continue;
+        buf_push(outline, node);
+    }
+    
+    buf_free(buffer->outline);
+    buffer->outline = outline;
+    resetOutlineChanges(buffer);
+    buffer->symbolIndexStale = true;
+}
+
+void showOutline(void) {
     // Go through each node
-    for (int node_i = 0; node_i < buf_len(currentBuffer->outline.c_nodes); node_i++) {
-        int linenum = currentBuffer->outline.c_nodes[node_i].line - currentBuffer->lines;
+    for (int node_i = 0; node_i < buf_len(currentBuffer->outline); node_i++) {
+        int linenum = buffer_resolveAnchor(currentBuffer, &currentBuffer->outline[node_i].line);
+        if (linenum == -1) continue; // Line was deleted
+        // Print out the line
         printLine(linenum, 0, true);
     }
 }
 
+internal void buildSymbolIndex(Buffer *buffer) {
+    swissmap_clear(&buffer->symbolIndex);
+    if (buffer->symbolNext)
+        buf_pop_all(buffer->symbolNext);
+    
+    int count = buf_len(buffer->outline);
+    if (count > 0)
+        buf_add(buffer->symbolNext, count);
+    
+    // Going backwards and putting each node at the head of its chain keeps the chains in file order
+    for (int i = count - 1; i >= 0; i--) {
+        OutlineNode *node = &(buffer->outline[i]);
+        buffer->symbolNext[i] = 0;
+        if (node->nameLength <= 0) continue;
+        int index = buffer_resolveAnchor(buffer, &node->line);
+        if (index == -1 || node->nameStart + node->nameLength > line_length(&(buffer->lines[index]))) continue;
+        
+        const char *name = &(line_chars(&(buffer->lines[index]))[node->nameStart]);
+        const char *interned = str_intern_range(name, name + node->nameLength);
+        int *first = (int *) swissmap_get(&buffer->symbolIndex, &interned);
+        if (first != NULL) {
+            buffer->symbolNext[i] = *first + 1;
+            *first = i;
+        } else {
+            swissmap_put(&buffer->symbolIndex, &interned, &i);
+        }
+    }
+    buffer->symbolIndexStale = false;
+}
+
+// Looks up the definitions named name in the buffer's outline. Fills lineIndices (indices, starting at 0) with up to max of them,
+// in file order, and returns how many were found.
+int outline_findSymbol(Buffer *buffer, const char *name, int length, int *lineIndices, int max) {
+    if (length <= 0)
+        return 0;
+    if (buffer->symbolIndexStale)
+        buildSymbolIndex(buffer);
+    
+    // Every name in the index is interned, so a name that isn't has no definitions
+    const char *interned = str_intern_find(name, name + length);
+    int *first = interned ? (int *) swissmap_get(&buffer->symbolIndex, &interned) : NULL;
+    if (first == NULL)
+        return 0;
+    
+    int found = 0;
+    for (int nodeIndex = *first + 1; nodeIndex != 0 && found < max; nodeIndex = buffer->symbolNext[nodeIndex - 1]) {
+        int index = buffer_resolveAnchor(buffer, &(buffer->outline[nodeIndex - 1].line));
+        if (index == -1) continue;
+        lineIndices[found++] = index;
+    }
+    return found;
+}
+
+// Returns the index of the last line of the definition in the outline that starts on the line at index (starting at 0):
+// the end of a function's or class's body, or the line before the next heading that isn't under a heading.
+int outline_definitionEnd(Buffer *buffer, int index) {
+    if (buffer->fileType != FT_MARKDOWN)
+        return buffer_blockEnd(buffer, index);
+    
+    int level = -1;
+    for (int node_i = 0; node_i < buf_len(buffer->outline); node_i++) {
+        OutlineNode *node = &(buffer->outline[node_i]);
+        int nodeIndex = buffer_resolveAnchor(buffer, &node->line);
+        if (nodeIndex == -1 || nodeIndex < index) continue;
+        if (level == -1) {
+            if (nodeIndex != index) break;
+            level = node->level;
+        } else if (node->level <= level) {
+            return nodeIndex - 1;
+        }
+    }
+    return (level == -1) ? index : buf_len(buffer->lines) - 1;
+}
+
 /* === Bookmarks === */
 
-bool get_bookmark(Buffer *buffer, pString name, Bookmark **result_bookmark) {
-    // Go through all bookmarks in array to see matching name
-    //Bookmark *result_bookmark;
-    int name_length = name.end - name.start;
-    bool found = false;
+// Bookmarks are kept in an array (for listing), and found by name through buffer->bookmarkIndex.
+// To keep them on the same lines while lines are inserted and deleted, their endpoints are sorted by line
+// (bookmarkEndpoints), and an edit adds a shift to every endpoint after it with one update to a Fenwick tree
+// (bookmarkShifts). The order of the endpoints never changes with edits, so they only need to be sorted
+// again after bookmarks are added or removed, on the next edit.
+
+// Line number of the endpoint at index, with the shifts of the edits since the endpoints were sorted
+internal int endpointLine(Buffer *buffer, int index) {
+    int line = buffer->bookmarkEndpoints[index].line;
+    for (int i = index + 1; i > 0; i -= i & -i) {
+        line += buffer->bookmarkShifts[i];
+    }
+    return line;
+}
+
+// Moves the endpoint at index, and every one after it, by delta lines
+internal void shiftEndpoints(Buffer *buffer, int index, int delta) {
+    int count = buf_len(buffer->bookmarkEndpoints);
+    for (int i = index + 1; i <= count; i += i & -i) {
+        buffer->bookmarkShifts[i] += delta;
+    }
+}
+
+// Index of the first endpoint at or after the line, or the number of endpoints if there's none
+internal int firstEndpointFrom(Buffer *buffer, int line) {
+    int low = 0;
+    int high = buf_len(buffer->bookmarkEndpoints);
+    while (low < high) {
+        int middle = low + (high - low) / 2;
+        if (endpointLine(buffer, middle) < line)
+            low = middle + 1;
+        else high = middle;
+    }
+    return low;
+}
+
+internal int compareEndpoints(const void *a, const void *b) {
+    const BookmarkEndpoint *endpointA = a;
+    const BookmarkEndpoint *endpointB = b;
+    if (endpointA->line != endpointB->line)
+        return (endpointA->line < endpointB->line) ? -1 : 1;
+    return (int) endpointB->isEnd - (int) endpointA->isEnd; // Ends first
+}
+
+internal void sortBookmarkEndpoints(Buffer *buffer) {
+    int bookmarkCount = buf_len(buffer->bookmarks);
+    if (buffer->bookmarkEndpoints)
+        buf__hdr(buffer->bookmarkEndpoints)->len = 0;
+    if (buffer->bookmarkShifts)
+        buf__hdr(buffer->bookmarkShifts)->len = 0;
+    buffer->bookmarkEndpointsStale = false;
+    if (bookmarkCount == 0)
+        return;
+    
+    for (int i = 0; i < bookmarkCount; i++) {
+        buf_push(buffer->bookmarkEndpoints, ((BookmarkEndpoint) { buffer->bookmarks[i].range.start, i, false }));
+        buf_push(buffer->bookmarkEndpoints, ((BookmarkEndpoint) { buffer->bookmarks[i].range.end, i, true }));
+    }
+    qsort(buffer->bookmarkEndpoints, buf_len(buffer->bookmarkEndpoints), sizeof(BookmarkEndpoint), compareEndpoints);
+    for (int i = 0; i < buf_len(buffer->bookmarkEndpoints); i++) {
+        BookmarkEndpoint *endpoint = &(buffer->bookmarkEndpoints[i]);
+        if (endpoint->isEnd)
+            buffer->bookmarks[endpoint->bookmark].endEndpoint = i;
+        else buffer->bookmarks[endpoint->bookmark].startEndpoint = i;
+    }
+    
+    int *shifts = buf_add(buffer->bookmarkShifts, buf_len(buffer->bookmarkEndpoints) + 1);
+    memset(shifts, 0, (buf_len(buffer->bookmarkEndpoints) + 1) * sizeof(int));
+}
+
+internal void updateBookmarkRange(Buffer *buffer, Bookmark *bookmark) {
+    if (buffer->bookmarkEndpointsStale || buf_len(buffer->bookmarkEndpoints) == 0)
+        return;
+    bookmark->range.start = endpointLine(buffer, bookmark->startEndpoint);
+    bookmark->range.end = endpointLine(buffer, bookmark->endEndpoint);
+    // All of the bookmark's lines were deleted
+    if (bookmark->range.end < bookmark->range.start)
+        bookmark->range.end = bookmark->range.start;
+}
+
+void bookmarks_updateRanges(Buffer *buffer) {
     for (int i = 0; i < buf_len(buffer->bookmarks); i++) {
-        Bookmark bookmark = buffer->bookmarks[i];
-        if (strncmp(bookmark.name, name.start, MAX(buf_len(bookmark.name), name_length)) == 0) { // strncmp(command.start, "clear", maxChars) == 0
-            (*result_bookmark) = &buffer->bookmarks[i];
-            found = true;
-            break;
-        }
+        updateBookmarkRange(buffer, &buffer->bookmarks[i]);
     }
+}
 
-    return found;
+// The endpoints have to be sorted again before the next edit. Until then the ranges in the bookmarks are the current ones.
+internal void invalidateBookmarkEndpoints(Buffer *buffer) {
+    if (buffer->bookmarkEndpointsStale)
+        return;
+    bookmarks_updateRanges(buffer);
+    buffer->bookmarkEndpointsStale = true;
 }
 
-// TODO: Accept the buffer to get bookmarks array
-bool add_bookmark(Buffer *buffer, pString name, lineRange range) {
-    int name_length = name.end - name.start;
+// count lines were inserted at index (starting at 0)
+void bookmarks_linesInserted(Buffer *buffer, int index, int count) {
+    if (buf_len(buffer->bookmarks) == 0)
+        return;
+    if (buffer->bookmarkEndpointsStale)
+        sortBookmarkEndpoints(buffer);
+    
+    // Line numbers after index + 1 (the first inserted line) move down
+    int first = firstEndpointFrom(buffer, index + 1);
+    if (first < buf_len(buffer->bookmarkEndpoints))
+        shiftEndpoints(buffer, first, count);
+}
+
+// count lines were removed starting at index (starting at 0)
+void bookmarks_linesRemoved(Buffer *buffer, int index, int count) {
+    if (buf_len(buffer->bookmarks) == 0)
+        return;
+    if (buffer->bookmarkEndpointsStale)
+        sortBookmarkEndpoints(buffer);
+    
+    int first = firstEndpointFrom(buffer, index + 1);
+    int after = firstEndpointFrom(buffer, index + count + 1);
+    if (after < buf_len(buffer->bookmarkEndpoints))
+        shiftEndpoints(buffer, after, -count);
+    
+    if (first == after)
+        return;
+    
+    // Endpoints on the deleted lines are moved to the edge of the deletion: starts to the line after it, and ends
+    // to the line before it. The ends go first so the endpoints stay sorted.
+    BookmarkEndpoint *deleted = NULL;
+    for (int i = first; i < after; i++) {
+        if (buffer->bookmarkEndpoints[i].isEnd)
+            buf_push(deleted, buffer->bookmarkEndpoints[i]);
+    }
+    for (int i = first; i < after; i++) {
+        if (!buffer->bookmarkEndpoints[i].isEnd)
+            buf_push(deleted, buffer->bookmarkEndpoints[i]);
+    }
+    for (int i = 0; i < buf_len(deleted); i++) {
+        int at = first + i;
+        BookmarkEndpoint *endpoint = &(buffer->bookmarkEndpoints[at]);
+        *endpoint = deleted[i];
+        endpoint->line = 0;
+        endpoint->line = (deleted[i].isEnd ? index : index + 1) - endpointLine(buffer, at);
+        if (endpoint->isEnd)
+            buffer->bookmarks[endpoint->bookmark].endEndpoint = at;
+        else buffer->bookmarks[endpoint->bookmark].startEndpoint = at;
+    }
+    buf_free(deleted);
+}
+bool get_bookmark(Buffer *buffer, pString name, Bookmark **result_bookmark) {
+    // A name that was never interned can't be a bookmark
+    const char *interned = str_intern_find(name.start, name.end);
+    int *index = interned ? (int *) swissmap_get(&buffer->bookmarkIndex, &interned) : NULL;
+    if (index == NULL)
+        return false;
 
+    (*result_bookmark) = &buffer->bookmarks[*index];
+    updateBookmarkRange(buffer, *result_bookmark);
+    return true;
+}
+
+bool add_bookmark(Buffer *buffer, pString name, lineRange range) {
     // Check if bookmark already exists
     Bookmark *result_bookmark;
     bool found = get_bookmark(buffer, name, &result_bookmark);
+    invalidateBookmarkEndpoints(buffer);
 
     if (found) {
         // If already exists, update the range
@@ -897,18 +1320,36 @@ bool add_bookmark(Buffer *buffer, pString name, lineRange range) {
     } else {
         // Otherwise, create and add the bookmark
         Bookmark bookmark;
-        bookmark.name = NULL;
-        buf_add(bookmark.name, name_length);
-        for (int i = 0; i < name_length; i++) {
-            bookmark.name[i] = name.start[i];
-            //buf_push(bookmark.name, name.start[i]);
-        }
+        bookmark.name = str_intern_range(name.start, name.end);
 
         bookmark.range.start = range.start;
         bookmark.range.end = range.end;
+        bookmark.startEndpoint = -1;
+        bookmark.endEndpoint = -1;
 
+        int index = buf_len(buffer->bookmarks);
         buf_push(buffer->bookmarks, bookmark);
+        swissmap_put(&buffer->bookmarkIndex, &bookmark.name, &index);
     }
 
     return found;
 }
+
+bool remove_bookmark(Buffer *buffer, pString name) {
+    Bookmark *bookmark;
+    if (!get_bookmark(buffer, name, &bookmark))
+        return false;
+
+    invalidateBookmarkEndpoints(buffer);
+    swissmap_remove(&buffer->bookmarkIndex, &bookmark->name);
+
+    // The last bookmark takes its place
+    Bookmark *last = buf_end(buffer->bookmarks) - 1;
+    if (bookmark != last) {
+        *bookmark = *last;
+        int index = (int)(bookmark - buffer->bookmarks);
+        swissmap_put(&buffer->bookmarkIndex, &bookmark->name, &index);
+    }
+    buf__hdr(buffer->bookmarks)->len -= 1;
+    return true;
+}
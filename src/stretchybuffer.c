@@ -1,8 +1,29 @@
 #include "edimcoder.h"
 
+#if defined(EDIM_ALLOC_STATS) && !defined(_WIN32)
+#include <pthread.h>
+#endif
+
 void *buf__grow(const void *buf, size_t new_len, size_t elem_size) {
+    return buf__growBy(buf, new_len, elem_size, BUF_GROW_DOUBLE);
+}
+
+void *buf__growBy(const void *buf, size_t new_len, size_t elem_size, BufGrowth growth) {
     assert(buf_cap(buf) <= (SIZE_MAX - 1) / 2);
-    size_t new_cap = MAX(1 + 2 * buf_cap(buf), new_len);
+    size_t new_cap = new_len;
+    switch (growth) {
+        case BUF_GROW_DOUBLE:
+        new_cap = MAX(1 + 2 * buf_cap(buf), new_len); break;
+        case BUF_GROW_HALF:
+        new_cap = MAX(buf_cap(buf) + buf_cap(buf) / 2, new_len); break;
+        case BUF_GROW_PAGES:
+        {
+            size_t pages = ALIGN_UP(offsetof(BufHdr, buf) + MAX(1 + 2 * buf_cap(buf), new_len) * elem_size, BUF_PAGE_SIZE);
+            new_cap = (pages - offsetof(BufHdr, buf)) / elem_size;
+        } break;
+        case BUF_GROW_EXACT:
+        break;
+    }
     assert(new_len <= new_cap);
     assert(new_cap <= (SIZE_MAX - offsetof(BufHdr, buf)) / elem_size);
     size_t new_size = offsetof(BufHdr, buf) + new_cap * elem_size;
@@ -18,7 +39,203 @@ void *buf__grow(const void *buf, size_t new_len, size_t elem_size) {
     return new_hdr->buf;
 }
 
+void *buf__shrink(void *buf, size_t elem_size) {
+    if (buf == NULL || buf_cap(buf) == buf_len(buf))
+        return buf;
+    if (buf_len(buf) == 0) {
+        xfree(buf__hdr(buf));
+        return NULL;
+    }
+    BufHdr *new_hdr = xrealloc(buf__hdr(buf), offsetof(BufHdr, buf) + buf_len(buf) * elem_size);
+    new_hdr->cap = new_hdr->len;
+    return new_hdr->buf;
+}
+
+
+// Arena allocator: hands out memory from big blocks and frees all of it at once
+void arena_grow(Arena *arena, size_t minSize) {
+    size_t size = ALIGN_UP(MAX(minSize, ARENA_BLOCK_SIZE), ARENA_ALIGNMENT);
+    arena->ptr = xmalloc(size);
+    arena->end = arena->ptr + size;
+    buf_push(arena->blocks, arena->ptr);
+}
+
+void *arena_alloc(Arena *arena, size_t size) {
+    if (size > (size_t)(arena->end - arena->ptr)) {
+        arena_grow(arena, size);
+        assert(size <= (size_t)(arena->end - arena->ptr));
+    }
+    void *ptr = arena->ptr;
+    arena->ptr = arena->ptr + ALIGN_UP(size, ARENA_ALIGNMENT);
+    assert(arena->ptr <= arena->end);
+    return ptr;
+}
+
+// Frees everything allocated from the arena. The newest block is kept to allocate from again, so an arena that's
+// reset after each use (and fits in a block) only allocates once.
+void arena_reset(Arena *arena) {
+    if (arena->blocks == NULL)
+        return;
+    char *newest = arena->blocks[buf_len(arena->blocks) - 1];
+    for (size_t i = 0; i + 1 < buf_len(arena->blocks); i++) {
+        xfree(arena->blocks[i]);
+    }
+    arena->blocks[0] = newest;
+    buf__hdr(arena->blocks)->len = 1;
+    arena->ptr = newest;
+}
 
+void arena_free(Arena *arena) {
+    for (char **it = arena->blocks; it != buf_end(arena->blocks); it++) {
+        xfree(*it);
+    }
+    buf_free(arena->blocks);
+    arena->ptr = NULL;
+    arena->end = NULL;
+}
+
+#ifdef EDIM_ALLOC_STATS
+// Each allocation starts with its size, so xfree knows how much is freed. 16 bytes keeps what's after it aligned.
+#define ALLOC_PREFIX 16
+#define ALLOC_MAX_SITES 1024 // Power of 2
+
+typedef struct GrowSite {
+    const char *file;
+    int line;
+    uint64_t count;
+    size_t bytes; // Total size of the buffers the grows allocated
+} GrowSite;
+
+internal AllocStats allocStats;
+internal GrowSite growSites[ALLOC_MAX_SITES];
+internal GrowSite sortedSites[ALLOC_MAX_SITES];
+
+// The symbol database's worker threads allocate too (they're only used on POSIX)
+#ifndef _WIN32
+internal pthread_mutex_t allocStatsLock = PTHREAD_MUTEX_INITIALIZER;
+#define allocStats_lock() pthread_mutex_lock(&allocStatsLock)
+#define allocStats_unlock() pthread_mutex_unlock(&allocStatsLock)
+#else
+#define allocStats_lock()
+#define allocStats_unlock()
+#endif
+
+// Counts a call that made block (with the size prefix) size bytes, from oldSize bytes. Returns the memory after the prefix.
+internal void *allocStats_count(void *block, size_t size, size_t oldSize, uint64_t *calls) {
+    allocStats_lock();
+    ++*calls;
+    allocStats.bytesLive = allocStats.bytesLive - oldSize + size;
+    allocStats.peakBytes = MAX(allocStats.peakBytes, allocStats.bytesLive);
+    allocStats_unlock();
+    *(size_t *) block = size;
+    return (char *) block + ALLOC_PREFIX;
+}
+
+void *buf__growAt(const void *buf, size_t new_len, size_t elem_size, BufGrowth growth, const char *file, int line) {
+    void *result = buf__growBy(buf, new_len, elem_size, growth);
+    size_t bytes = offsetof(BufHdr, buf) + buf_cap(result) * elem_size;
+    
+    allocStats_lock();
+    ++allocStats.growEvents;
+    // Sites are keyed by the __FILE__ pointer and line. When the table fills up, the grow is only counted in growEvents.
+    size_t i = (size_t) hash_mix(hash_ptr(file), (uint64_t) line);
+    for (size_t probe = 0; probe < ALLOC_MAX_SITES; probe++, i++) {
+        GrowSite *site = &growSites[i & (ALLOC_MAX_SITES - 1)];
+        if (site->file == NULL) {
+            site->file = file;
+            site->line = line;
+        }
+        if (site->file == file && site->line == line) {
+            ++site->count;
+            site->bytes += bytes;
+            break;
+        }
+    }
+    allocStats_unlock();
+    return result;
+}
+
+AllocStats allocStats_get(void) {
+    allocStats_lock();
+    AllocStats stats = allocStats;
+    allocStats_unlock();
+    return stats;
+}
+
+internal int compareGrowSites(const void *a, const void *b) {
+    uint64_t countA = ((const GrowSite *) a)->count;
+    uint64_t countB = ((const GrowSite *) b)->count;
+    return (countA < countB) - (countA > countB);
+}
+
+// Prints the counters and the maxSites places in the code where stretchy buffers grew the most often
+void allocStats_print(int maxSites) {
+    // Copied out first, since printing can allocate
+    allocStats_lock();
+    AllocStats stats = allocStats;
+    int siteCount = 0;
+    for (int i = 0; i < ALLOC_MAX_SITES; i++) {
+        if (growSites[i].file != NULL)
+            sortedSites[siteCount++] = growSites[i];
+    }
+    allocStats_unlock();
+    
+    printf("Allocations: %llu malloc, %llu calloc, %llu realloc, %llu free\n", (unsigned long long) stats.mallocCalls,
+           (unsigned long long) stats.callocCalls, (unsigned long long) stats.reallocCalls, (unsigned long long) stats.freeCalls);
+    printf("Live: %.1f KB, peak: %.1f KB\n", stats.bytesLive / 1024.0, stats.peakBytes / 1024.0);
+    printf("Stretchy buffer grows: %llu\n", (unsigned long long) stats.growEvents);
+    
+    qsort(sortedSites, siteCount, sizeof(GrowSite), compareGrowSites);
+    for (int i = 0; i < siteCount && i < maxSites; i++) {
+        printf("  %10llu grows %12.1f KB  %s:%d\n", (unsigned long long) sortedSites[i].count, sortedSites[i].bytes / 1024.0,
+               sortedSites[i].file, sortedSites[i].line);
+    }
+}
+
+void *xcalloc(size_t num_elems, size_t elem_size) {
+    assert(elem_size == 0 || num_elems <= (SIZE_MAX - ALLOC_PREFIX) / elem_size);
+    void *ptr = calloc(1, ALLOC_PREFIX + num_elems * elem_size);
+    if (!ptr) {
+        perror("xcalloc failed");
+        exit(1);
+    }
+    return allocStats_count(ptr, num_elems * elem_size, 0, &allocStats.callocCalls);
+}
+
+void *xrealloc(void *ptr, size_t num_bytes) {
+    size_t oldSize = 0;
+    if (ptr != NULL) {
+        ptr = (char *) ptr - ALLOC_PREFIX;
+        oldSize = *(size_t *) ptr;
+    }
+    ptr = realloc(ptr, ALLOC_PREFIX + num_bytes);
+    if (!ptr) {
+        perror("xrealloc failed");
+        exit(1);
+    }
+    return allocStats_count(ptr, num_bytes, oldSize, &allocStats.reallocCalls);
+}
+
+void *xmalloc(size_t num_bytes) {
+    void *ptr = malloc(ALLOC_PREFIX + num_bytes);
+    if (!ptr) {
+        perror("xmalloc failed");
+        exit(1);
+    }
+    return allocStats_count(ptr, num_bytes, 0, &allocStats.mallocCalls);
+}
+
+void xfree(void *ptr) {
+    if (ptr == NULL)
+        return;
+    char *block = (char *) ptr - ALLOC_PREFIX;
+    allocStats_lock();
+    ++allocStats.freeCalls;
+    allocStats.bytesLive -= *(size_t *) block;
+    allocStats_unlock();
+    free(block);
+}
+#else
 void *xcalloc(size_t num_elems, size_t elem_size) {
     void *ptr = calloc(num_elems, elem_size);
     if (!ptr) {
@@ -46,6 +263,12 @@ void *xmalloc(size_t num_bytes) {
     return ptr;
 }
 
+// Frees memory from xmalloc, xcalloc, and xrealloc
+void xfree(void *ptr) {
+    free(ptr);
+}
+#endif
+
 
 void fatal(const char *fmt, ...) {
     va_list args;
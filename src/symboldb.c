@@ -0,0 +1,599 @@
+#ifndef _WIN32
+#define _POSIX_C_SOURCE 200809L // stat, mmap, opendir, and pthreads aren't declared in plain C99 mode
+#endif
+
+#include "edimcoder.h"
+
+#ifndef _WIN32
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <pthread.h>
+#endif
+
+// Project-wide symbol database. The 'tags' command parses every C/C++ file under a directory (in parallel) and writes
+// the definitions in their outlines to <directory>/.edimtags. The database is loaded at startup, and 'J' falls back
+// to it when a name isn't defined in the current buffer.
+//
+// The file is laid out so it can be used directly from a read-only mmap, without parsing anything on load:
+//   SymbolDbHeader
+//   SymbolDbFile[fileCount]
+//   SymbolDbSymbol[symbolCount] - sorted by name hash, so a lookup is a binary search
+//   char strings[stringsSize] - file paths and symbol names, not zero-terminated
+//
+// Re-indexing only reads the files whose mtime or size changed, and only the ones whose contents hash changed
+// get parsed again. The symbols of all of the other files are copied over from the old database.
+
+#define SYMBOLDB_VERSION 2
+#define SYMBOLDB_MAX_THREADS 16
+
+typedef struct SymbolDbHeader {
+    char magic[8]; // "EDIMTAGS"
+    uint32_t version;
+    uint32_t fileCount;
+    uint32_t symbolCount;
+    uint32_t stringsSize;
+} SymbolDbHeader;
+
+typedef struct SymbolDbFile {
+    int64_t mtime;
+    int64_t size;
+    uint64_t hash; // Of the file's contents
+    uint32_t pathOffset;
+    uint32_t pathLength;
+} SymbolDbFile;
+
+typedef struct SymbolDbSymbol {
+    uint64_t nameHash;
+    uint32_t nameOffset;
+    uint32_t nameLength;
+    uint32_t file;
+    uint32_t line; // Starts at 1
+    uint8_t kind;
+    uint8_t flags;
+    uint8_t padding[6];
+} SymbolDbSymbol;
+
+typedef struct SymbolDb {
+    char *directory; // Zero-terminated char stretchy buffer
+    char *data;
+    size_t size;
+    bool mapped;
+    SymbolDbHeader *header;
+    SymbolDbFile *files;
+    SymbolDbSymbol *symbols;
+    char *strings;
+} SymbolDb;
+
+internal SymbolDb loadedDb;
+
+// A file found while walking the directory, and (if it had to be parsed) the definitions found in it
+typedef struct IndexJob {
+    char *path; // Relative to the indexed directory, zero-terminated char stretchy buffer
+    int64_t mtime;
+    int64_t size;
+    uint64_t hash;
+    int oldFile; // Index of the file in the old database, -1 if it wasn't in it
+    bool parse; // mtime or size changed, so the file has to be read
+    bool reuse; // Symbols are copied from the old database
+    bool failed;
+    SymbolDbSymbol *symbols; // nameOffset is into names, file is unused
+    char *names;
+} IndexJob;
+
+typedef struct IndexWork {
+    const char *directory;
+    SymbolDb *old;
+    IndexJob *jobs;
+    int next;
+#ifndef _WIN32
+    pthread_mutex_t lock;
+#endif
+} IndexWork;
+
+// Returns a zero-terminated char stretchy buffer of "a/b"
+internal char *joinPath(const char *a, const char *b) {
+    char *result = NULL;
+    int aLength = (int) strlen(a);
+    int bLength = (int) strlen(b);
+    memcpy(buf_add(result, aLength), a, aLength);
+    if (aLength > 0 && a[aLength - 1] != '/' && a[aLength - 1] != '\\')
+        buf_push(result, '/');
+    memcpy(buf_add(result, bLength), b, bLength);
+    buf_push(result, '\0');
+    return result;
+}
+
+internal char *copyString(const char *str) {
+    char *result = NULL;
+    int length = (int) strlen(str);
+    memcpy(buf_add(result, length + 1), str, length + 1);
+    return result;
+}
+
+internal bool getFileInfo(const char *path, int64_t *mtime, int64_t *size, bool *isDirectory) {
+#ifdef _WIN32
+    WIN32_FILE_ATTRIBUTE_DATA data;
+    if (!GetFileAttributesExA(path, GetFileExInfoStandard, &data))
+        return false;
+    *mtime = ((int64_t) data.ftLastWriteTime.dwHighDateTime << 32) | data.ftLastWriteTime.dwLowDateTime;
+    *size = ((int64_t) data.nFileSizeHigh << 32) | data.nFileSizeLow;
+    *isDirectory = (data.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) != 0;
+    return true;
+#else
+    // Don't follow symlinks, so a link back up the tree can't make the walk loop forever
+    struct stat st;
+    if (lstat(path, &st) != 0 || !(S_ISREG(st.st_mode) || S_ISDIR(st.st_mode)))
+        return false;
+    *mtime = (int64_t) st.st_mtime;
+    *size = (int64_t) st.st_size;
+    *isDirectory = S_ISDIR(st.st_mode);
+    return true;
+#endif
+}
+
+internal void collectSourceFiles(const char *directory, const char *relative, IndexJob **jobs);
+
+internal void addSourceFile(const char *directory, char *relative, IndexJob **jobs) {
+    char *fullPath = joinPath(directory, relative);
+    int64_t mtime, size;
+    bool isDirectory;
+    if (getFileInfo(fullPath, &mtime, &size, &isDirectory)) {
+        if (isDirectory) {
+            buf_free(fullPath);
+            collectSourceFiles(directory, relative, jobs);
+            buf_free(relative);
+            return;
+        }
+        if (lexer_isC(buffer_fileTypeFromFilename(relative))) {
+            IndexJob job = {0};
+            job.path = relative;
+            job.mtime = mtime;
+            job.size = size;
+            job.oldFile = -1;
+            buf_push(*jobs, job);
+            relative = NULL;
+        }
+    }
+    buf_free(fullPath);
+    buf_free(relative);
+}
+
+// Adds a job for each C/C++ file under directory/relative. Hidden files and directories (like .git) are skipped.
+internal void collectSourceFiles(const char *directory, const char *relative, IndexJob **jobs) {
+    char *dirPath = relative[0] ? joinPath(directory, relative) : copyString(directory);
+#ifdef _WIN32
+    char *pattern = joinPath(dirPath, "*");
+    WIN32_FIND_DATAA data;
+    HANDLE find = FindFirstFileA(pattern, &data);
+    buf_free(pattern);
+    if (find != INVALID_HANDLE_VALUE) {
+        do {
+            if (data.cFileName[0] == '.') continue;
+            addSourceFile(directory, relative[0] ? joinPath(relative, data.cFileName) : copyString(data.cFileName), jobs);
+        } while (FindNextFileA(find, &data));
+        FindClose(find);
+    }
+#else
+    DIR *dir = opendir(dirPath);
+    if (dir != NULL) {
+        struct dirent *entry;
+        while ((entry = readdir(dir)) != NULL) {
+            if (entry->d_name[0] == '.') continue;
+            addSourceFile(directory, relative[0] ? joinPath(relative, entry->d_name) : copyString(entry->d_name), jobs);
+        }
+        closedir(dir);
+    }
+#endif
+    buf_free(dirPath);
+}
+
+/* --- Loading --- */
+
+internal void closeDb(SymbolDb *db) {
+    if (db->data != NULL) {
+#ifndef _WIN32
+        if (db->mapped)
+            munmap(db->data, db->size);
+        else
+#endif
+            xfree(db->data);
+    }
+    buf_free(db->directory);
+    memset(db, 0, sizeof(SymbolDb));
+}
+
+internal bool openDb(const char *directory, SymbolDb *db) {
+    memset(db, 0, sizeof(SymbolDb));
+    char *path = joinPath(directory, SYMBOLDB_FILENAME);
+
+#ifdef _WIN32
+    // No mmap, read the whole thing in
+    FILE *fp = fopen(path, "rb");
+    buf_free(path);
+    if (fp == NULL)
+        return false;
+    fseek(fp, 0, SEEK_END);
+    long size = ftell(fp);
+    fseek(fp, 0, SEEK_SET);
+    if (size < (long) sizeof(SymbolDbHeader)) {
+        fclose(fp);
+        return false;
+    }
+    db->data = xmalloc(size);
+    db->size = size;
+    if (fread(db->data, 1, size, fp) != (size_t) size) {
+        fclose(fp);
+        closeDb(db);
+        return false;
+    }
+    fclose(fp);
+#else
+    int fd = open(path, O_RDONLY);
+    buf_free(path);
+    if (fd == -1)
+        return false;
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size < (off_t) sizeof(SymbolDbHeader)) {
+        close(fd);
+        return false;
+    }
+    void *data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED)
+        return false;
+    db->data = data;
+    db->size = st.st_size;
+    db->mapped = true;
+#endif
+
+    // Check the header and that the sections add up to the size of the file
+    db->header = (SymbolDbHeader *) db->data;
+    SymbolDbHeader *header = db->header;
+    uint64_t expectedSize = sizeof(SymbolDbHeader) + (uint64_t) header->fileCount * sizeof(SymbolDbFile)
+        + (uint64_t) header->symbolCount * sizeof(SymbolDbSymbol) + header->stringsSize;
+    if (memcmp(header->magic, "EDIMTAGS", 8) != 0 || header->version != SYMBOLDB_VERSION || expectedSize != db->size) {
+        closeDb(db);
+        return false;
+    }
+    db->files = (SymbolDbFile *) (db->data + sizeof(SymbolDbHeader));
+    db->symbols = (SymbolDbSymbol *) (db->files + header->fileCount);
+    db->strings = (char *) (db->symbols + header->symbolCount);
+    db->directory = copyString(directory);
+    return true;
+}
+
+bool symbolDb_load(const char *directory) {
+    closeDb(&loadedDb);
+    return openDb(directory, &loadedDb);
+}
+
+bool symbolDb_isLoaded(void) {
+    return loadedDb.data != NULL;
+}
+
+void symbolDb_close(void) {
+    closeDb(&loadedDb);
+}
+
+int symbolDb_find(const char *name, int length, SymbolLocation *results, int max) {
+    if (!symbolDb_isLoaded() || length <= 0)
+        return 0;
+    SymbolDb *db = &loadedDb;
+    uint64_t hash = hash_bytes(name, length);
+
+    // First symbol with the hash
+    int low = 0;
+    int high = db->header->symbolCount;
+    while (low < high) {
+        int mid = low + (high - low) / 2;
+        if (db->symbols[mid].nameHash < hash)
+            low = mid + 1;
+        else high = mid;
+    }
+
+    int found = 0;
+    for (int i = low; i < db->header->symbolCount && db->symbols[i].nameHash == hash && found < max; i++) {
+        SymbolDbSymbol *symbol = &db->symbols[i];
+        if (symbol->nameLength != length || symbol->file >= db->header->fileCount
+            || (uint64_t) symbol->nameOffset + symbol->nameLength > db->header->stringsSize)
+            continue;
+        // Different names can have the same hash
+        if (memcmp(db->strings + symbol->nameOffset, name, length) != 0)
+            continue;
+
+        SymbolDbFile *file = &db->files[symbol->file];
+        if ((uint64_t) file->pathOffset + file->pathLength > db->header->stringsSize)
+            continue;
+        SymbolLocation location;
+        location.directory = db->directory;
+        location.path = db->strings + file->pathOffset;
+        location.pathLength = file->pathLength;
+        location.line = symbol->line;
+        location.kind = symbol->kind;
+        results[found++] = location;
+    }
+    return found;
+}
+
+/* --- Indexing --- */
+
+// Reads the file, and if its contents changed since the old database was written, gets the definitions from its outline.
+// Only uses the job and a buffer of its own, so jobs can run on different threads.
+internal void parseJob(const char *directory, SymbolDb *old, IndexJob *job) {
+    char *fullPath = joinPath(directory, job->path);
+    FILE *fp = fopen(fullPath, "rb");
+    buf_free(fullPath);
+    if (fp == NULL) {
+        job->failed = true;
+        return;
+    }
+
+    Buffer buffer;
+    buffer_initEmptyBuffer(&buffer);
+    buffer.fileType = buffer_fileTypeFromFilename(job->path);
+    buffer_readLines(&buffer, fp);
+    fclose(fp);
+
+    uint64_t hash = buffer_contentHash(&buffer);
+    job->hash = hash;
+
+    // Only the mtime changed
+    if (job->oldFile != -1 && old->files[job->oldFile].hash == hash) {
+        job->reuse = true;
+        buffer_close(&buffer);
+        return;
+    }
+
+    outline_build(&buffer);
+    for (int i = 0; i < buf_len(buffer.outline); i++) {
+        OutlineNode *node = &buffer.outline[i];
+        int index = buffer_resolveAnchor(&buffer, &node->line);
+        if (index == -1 || node->nameLength <= 0) continue;
+
+        SymbolDbSymbol symbol = {0};
+        const char *name = &(line_chars(&buffer.lines[index])[node->nameStart]);
+        symbol.nameHash = hash_bytes(name, node->nameLength);
+        symbol.nameOffset = buf_len(job->names);
+        symbol.nameLength = node->nameLength;
+        symbol.line = index + 1;
+        symbol.kind = node->kind;
+        symbol.flags = node->flags;
+        memcpy(buf_add(job->names, node->nameLength), name, node->nameLength);
+        buf_push(job->symbols, symbol);
+    }
+    buffer_close(&buffer);
+}
+
+internal void *indexWorker(void *arg) {
+    IndexWork *work = (IndexWork *) arg;
+    forever {
+#ifndef _WIN32
+        pthread_mutex_lock(&work->lock);
+#endif
+        int i = work->next++;
+#ifndef _WIN32
+        pthread_mutex_unlock(&work->lock);
+#endif
+        if (i >= buf_len(work->jobs))
+            break;
+        if (work->jobs[i].parse)
+            parseJob(work->directory, work->old, &work->jobs[i]);
+    }
+    return NULL;
+}
+
+internal int compareSymbols(const void *a, const void *b) {
+    const SymbolDbSymbol *symbolA = (const SymbolDbSymbol *) a;
+    const SymbolDbSymbol *symbolB = (const SymbolDbSymbol *) b;
+    if (symbolA->nameHash != symbolB->nameHash)
+        return symbolA->nameHash < symbolB->nameHash ? -1 : 1;
+    if (symbolA->file != symbolB->file)
+        return symbolA->file < symbolB->file ? -1 : 1;
+    return (symbolA->line > symbolB->line) - (symbolA->line < symbolB->line);
+}
+
+internal bool writeDb(const char *directory, SymbolDbFile *files, SymbolDbSymbol *symbols, char *strings) {
+    SymbolDbHeader header = {0};
+    memcpy(header.magic, "EDIMTAGS", 8);
+    header.version = SYMBOLDB_VERSION;
+    header.fileCount = buf_len(files);
+    header.symbolCount = buf_len(symbols);
+    header.stringsSize = buf_len(strings);
+
+    // Write to a temporary file first, so a failed write doesn't lose the old database
+    char *path = joinPath(directory, SYMBOLDB_FILENAME);
+    char *tempPath = joinPath(directory, SYMBOLDB_FILENAME ".tmp");
+    FILE *fp = fopen(tempPath, "wb");
+    bool success = fp != NULL;
+    if (success) {
+        success = fwrite(&header, sizeof(header), 1, fp) == 1;
+        if (success && buf_len(files) > 0)
+            success = fwrite(files, sizeof(SymbolDbFile), buf_len(files), fp) == buf_len(files);
+        if (success && buf_len(symbols) > 0)
+            success = fwrite(symbols, sizeof(SymbolDbSymbol), buf_len(symbols), fp) == buf_len(symbols);
+        if (success && buf_len(strings) > 0)
+            success = fwrite(strings, 1, buf_len(strings), fp) == buf_len(strings);
+        success = (fclose(fp) == 0) && success;
+    }
+    if (success) {
+#ifdef _WIN32
+        remove(path); // rename doesn't replace existing files on Windows
+#endif
+        success = rename(tempPath, path) == 0;
+    }
+    if (!success)
+        remove(tempPath);
+
+    buf_free(path);
+    buf_free(tempPath);
+    return success;
+}
+
+// Creates or updates the symbol database for the directory, and then loads it.
+// filesParsed is set to how many files had to be parsed again, filesTotal to how many files are in the database.
+bool symbolDb_index(const char *directory, int *filesParsed, int *filesTotal) {
+    IndexJob *jobs = NULL;
+    collectSourceFiles(directory, "", &jobs);
+
+    // Match the files with the ones in the old database by path
+    SymbolDb old;
+    bool hasOld = openDb(directory, &old);
+    Map oldFiles = {0};
+    if (hasOld) {
+        for (int i = 0; i < old.header->fileCount; i++) {
+            SymbolDbFile *file = &old.files[i];
+            if ((uint64_t) file->pathOffset + file->pathLength > old.header->stringsSize) continue;
+            uint64_t key = hash_bytes(old.strings + file->pathOffset, file->pathLength) | 1;
+            map_put_uint64_from_uint64(&oldFiles, key, (uint64_t) i + 1);
+        }
+    }
+    int parseCount = 0;
+    for (int i = 0; i < buf_len(jobs); i++) {
+        IndexJob *job = &jobs[i];
+        int pathLength = (int) strlen(job->path);
+        job->parse = true;
+        if (hasOld) {
+            int oldFile = (int) map_get_uint64_from_uint64(&oldFiles, hash_bytes(job->path, pathLength) | 1) - 1;
+            if (oldFile != -1 && old.files[oldFile].pathLength == pathLength
+                && memcmp(old.strings + old.files[oldFile].pathOffset, job->path, pathLength) == 0) {
+                job->oldFile = oldFile;
+                if (old.files[oldFile].mtime == job->mtime && old.files[oldFile].size == job->size) {
+                    job->parse = false;
+                    job->reuse = true;
+                    job->hash = old.files[oldFile].hash;
+                }
+            }
+        }
+        if (job->parse) ++parseCount;
+    }
+    xfree(oldFiles.keys);
+    xfree(oldFiles.vals);
+
+    // Parse the changed files
+    IndexWork work = {0};
+    work.directory = directory;
+    work.old = &old;
+    work.jobs = jobs;
+    work.next = 0;
+#ifdef _WIN32
+    indexWorker(&work);
+#else
+    int threadCount = (int) sysconf(_SC_NPROCESSORS_ONLN);
+    threadCount = CLAMP_MAX(CLAMP_MIN(threadCount, 1), SYMBOLDB_MAX_THREADS);
+    threadCount = CLAMP_MIN(CLAMP_MAX(threadCount, parseCount), 1);
+    pthread_t threads[SYMBOLDB_MAX_THREADS];
+    pthread_mutex_init(&work.lock, NULL);
+    int started = 0;
+    for (; started < threadCount - 1; started++) {
+        if (pthread_create(&threads[started], NULL, indexWorker, &work) != 0)
+            break;
+    }
+    indexWorker(&work); // This thread helps too
+    for (int i = 0; i < started; i++)
+        pthread_join(threads[i], NULL);
+    pthread_mutex_destroy(&work.lock);
+#endif
+
+    // Put the new database together
+    SymbolDbFile *files = NULL;
+    SymbolDbSymbol *symbols = NULL;
+    char *strings = NULL;
+
+    // The old symbols are sorted by name hash, so group them by file first
+    int *oldFileStart = NULL;
+    int *oldSymbolsByFile = NULL;
+    if (hasOld) {
+        buf_add(oldFileStart, old.header->fileCount + 1);
+        memset(oldFileStart, 0, sizeof(int) * (old.header->fileCount + 1));
+        for (int i = 0; i < old.header->symbolCount; i++) {
+            if (old.symbols[i].file < old.header->fileCount)
+                ++oldFileStart[old.symbols[i].file + 1];
+        }
+        for (int i = 0; i < old.header->fileCount; i++)
+            oldFileStart[i + 1] += oldFileStart[i];
+        if (old.header->symbolCount > 0)
+            buf_add(oldSymbolsByFile, old.header->symbolCount);
+        int *fill = NULL;
+        buf_add(fill, old.header->fileCount + 1);
+        memcpy(fill, oldFileStart, sizeof(int) * (old.header->fileCount + 1));
+        for (int i = 0; i < old.header->symbolCount; i++) {
+            if (old.symbols[i].file < old.header->fileCount)
+                oldSymbolsByFile[fill[old.symbols[i].file]++] = i;
+        }
+        buf_free(fill);
+    }
+
+    for (int i = 0; i < buf_len(jobs); i++) {
+        IndexJob *job = &jobs[i];
+        if (job->failed) continue;
+
+        SymbolDbFile file = {0};
+        file.mtime = job->mtime;
+        file.size = job->size;
+        file.hash = job->hash;
+        file.pathOffset = buf_len(strings);
+        file.pathLength = (uint32_t) strlen(job->path);
+        // The string table gets big, so it grows a page at a time instead of a string at a time
+        buf_reserve(strings, file.pathLength, BUF_GROW_PAGES);
+        memcpy(buf_add(strings, file.pathLength), job->path, file.pathLength);
+        uint32_t fileIndex = buf_len(files);
+        buf_push(files, file);
+
+        if (job->reuse) {
+            for (int s = oldFileStart[job->oldFile]; s < oldFileStart[job->oldFile + 1]; s++) {
+                SymbolDbSymbol symbol = old.symbols[oldSymbolsByFile[s]];
+                if ((uint64_t) symbol.nameOffset + symbol.nameLength > old.header->stringsSize) continue;
+                const char *name = old.strings + symbol.nameOffset;
+                symbol.nameOffset = buf_len(strings);
+                symbol.file = fileIndex;
+                buf_reserve(strings, symbol.nameLength, BUF_GROW_PAGES);
+                memcpy(buf_add(strings, symbol.nameLength), name, symbol.nameLength);
+                buf_push(symbols, symbol);
+            }
+        } else {
+            for (int s = 0; s < buf_len(job->symbols); s++) {
+                SymbolDbSymbol symbol = job->symbols[s];
+                symbol.nameOffset = buf_len(strings);
+                symbol.file = fileIndex;
+                buf_reserve(strings, symbol.nameLength, BUF_GROW_PAGES);
+                memcpy(buf_add(strings, symbol.nameLength), job->names + job->symbols[s].nameOffset, symbol.nameLength);
+                buf_push(symbols, symbol);
+            }
+        }
+    }
+    if (buf_len(symbols) > 1)
+        qsort(symbols, buf_len(symbols), sizeof(SymbolDbSymbol), compareSymbols);
+
+    bool success = writeDb(directory, files, symbols, strings);
+
+    if (filesParsed) {
+        // Files that only had their mtime change don't count
+        *filesParsed = 0;
+        for (int i = 0; i < buf_len(jobs); i++) {
+            if (jobs[i].parse && !jobs[i].reuse && !jobs[i].failed)
+                ++*filesParsed;
+        }
+    }
+    if (filesTotal) *filesTotal = buf_len(files);
+
+    buf_free(oldFileStart);
+    buf_free(oldSymbolsByFile);
+    if (hasOld)
+        closeDb(&old);
+    for (int i = 0; i < buf_len(jobs); i++) {
+        buf_free(jobs[i].path);
+        buf_free(jobs[i].symbols);
+        buf_free(jobs[i].names);
+    }
+    buf_free(jobs);
+    buf_free(files);
+    buf_free(symbols);
+    buf_free(strings);
+
+    if (!success)
+        return false;
+    return symbolDb_load(directory);
+}
@@ -0,0 +1,445 @@
+#include "edimcoder.h"
+
+// Persistent undo history. Each buffer that's from a file appends what happens to its undo history to
+// .<filename>.edimundo next to the file, so undo still works after the file is closed and opened again.
+// Nothing is ever rewritten while editing, an entry is appended (and flushed) for each change, undo, redo, and save.
+// The log is only created once the file is changed or saved, so just looking at a file doesn't leave one behind.
+//
+// The file is laid out as:
+//   UndoLogHeader
+//   Entries, each one an UndoLogEntry followed by size bytes of payload:
+//   - UNDOLOG_RECORD: a change was pushed onto the history. The payload has the deleted lines for
+//     UNDO_DELETE_LINES, and the removed bytes followed by the inserted bytes for UNDO_CHANGE_LINE.
+//   - UNDOLOG_UNDO: the last applied change was undone. The payload has the lines that were taken back out of
+//     the buffer for UNDO_INSERT_LINES (the text of inserted lines is only needed once they're undone).
+//   - UNDOLOG_REDO: the last undone change was redone.
+//   - UNDOLOG_SAVE: the buffer was saved. The payload is the hash of the buffer's contents (buffer_contentHash).
+// Lines in payloads are a uint32_t length followed by the chars.
+//
+// The history is keyed by the content hash: when a file is opened, the log is replayed up to the last save whose
+// hash matches the file's contents, and whatever came after it (changes that were never saved) is dropped.
+// If no save matches, the file was changed by something else, and the log is started over.
+
+#define UNDOLOG_VERSION 2
+#define UNDOLOG_SUFFIX ".edimundo"
+
+typedef enum UndoLogEntryType {
+    UNDOLOG_RECORD, UNDOLOG_UNDO, UNDOLOG_REDO, UNDOLOG_SAVE
+} UndoLogEntryType;
+
+typedef struct UndoLogHeader {
+    char magic[8]; // "EDIMUNDO"
+    uint32_t version;
+    uint32_t reserved;
+} UndoLogHeader;
+
+typedef struct UndoLogEntry {
+    uint32_t size; // Bytes of payload after the entry
+    uint8_t type;
+    uint8_t kind; // UndoKind of the record
+    uint16_t reserved;
+    int32_t index;
+    int32_t count;
+    int32_t start;
+    int32_t removedLength;
+    int32_t insertedLength;
+    uint32_t padding;
+    uint64_t charsSize;
+} UndoLogEntry;
+
+// A record while the log is being replayed
+typedef struct LoggedRecord {
+    size_t entryOffset;
+    size_t undoOffset; // Last UNDOLOG_UNDO entry of an UNDO_INSERT_LINES record, 0 for none
+} LoggedRecord;
+
+// Returns a zero-terminated char stretchy buffer, or NULL if the buffer doesn't have a filename
+internal char *undoLogPath(Buffer *buffer) {
+    int length = buf_len(buffer->openedFilename);
+    if (length <= 1 || buffer->openedFilename[length - 1] != '\0')
+        return NULL;
+
+    char *filename = buffer->openedFilename;
+    char *base = filename;
+    for (char *c = filename; *c != '\0'; c++) {
+        if (*c == '/' || *c == '\\')
+            base = c + 1;
+    }
+
+    char *path = NULL;
+    if (base > filename)
+        memcpy(buf_add(path, base - filename), filename, base - filename);
+    buf_push(path, '.');
+    int baseLength = (int) strlen(base);
+    memcpy(buf_add(path, baseLength), base, baseLength);
+    memcpy(buf_add(path, sizeof(UNDOLOG_SUFFIX)), UNDOLOG_SUFFIX, sizeof(UNDOLOG_SUFFIX)); // Includes the '\0'
+    return path;
+}
+
+internal size_t linesPayloadSize(Line *lines, int count) {
+    size_t size = 0;
+    for (int i = 0; i < count; i++) {
+        size += sizeof(uint32_t) + line_length(&(lines[i]));
+    }
+    return size;
+}
+
+internal void writeLines(FILE *fp, Line *lines, int count) {
+    for (int i = 0; i < count; i++) {
+        uint32_t length = line_length(&(lines[i]));
+        fwrite(&length, sizeof(length), 1, fp);
+        if (length > 0)
+            fwrite(line_chars(&(lines[i])), 1, length, fp);
+    }
+}
+
+internal UndoLogEntry entryForRecord(UndoLogEntryType type, UndoRecord *record) {
+    UndoLogEntry entry = {0};
+    entry.type = type;
+    entry.kind = record->kind;
+    entry.index = record->index;
+    entry.count = record->count;
+    entry.start = record->start;
+    entry.removedLength = record->removedLength;
+    entry.insertedLength = record->insertedLength;
+    entry.charsSize = record->charsSize;
+    return entry;
+}
+
+internal void writeRecordEntry(FILE *fp, UndoRecord *record) {
+    UndoLogEntry entry = entryForRecord(UNDOLOG_RECORD, record);
+    if (record->kind == UNDO_DELETE_LINES)
+        entry.size = (uint32_t) linesPayloadSize(record->lines, buf_len(record->lines));
+    else if (record->kind == UNDO_CHANGE_LINE)
+        entry.size = record->removedLength + record->insertedLength;
+
+    fwrite(&entry, sizeof(entry), 1, fp);
+    if (record->kind == UNDO_DELETE_LINES)
+        writeLines(fp, record->lines, buf_len(record->lines));
+    else if (entry.size > 0)
+        fwrite(record->bytes, 1, entry.size, fp);
+}
+
+internal void writeSaveEntry(FILE *fp, uint64_t hash) {
+    UndoLogEntry entry = {0};
+    entry.type = UNDOLOG_SAVE;
+    entry.size = sizeof(hash);
+    fwrite(&entry, sizeof(entry), 1, fp);
+    fwrite(&hash, sizeof(hash), 1, fp);
+}
+
+internal bool replaceFile(const char *tempPath, const char *path) {
+#ifdef _WIN32
+    remove(path); // rename doesn't replace existing files on Windows
+#endif
+    if (rename(tempPath, path) == 0)
+        return true;
+    remove(tempPath);
+    return false;
+}
+
+// Writes a new log with the first recordCount records of the history, followed by a save with the given hash.
+// Only applied records can be written, since the text of the lines an undone record would put back isn't known anymore.
+internal bool writeLog(Buffer *buffer, const char *path, int recordCount, uint64_t hash) {
+    char *tempPath = NULL;
+    int pathLength = (int) strlen(path);
+    memcpy(buf_add(tempPath, pathLength), path, pathLength);
+    memcpy(buf_add(tempPath, sizeof(".tmp")), ".tmp", sizeof(".tmp"));
+
+    FILE *fp = fopen(tempPath, "wb");
+    bool success = fp != NULL;
+    if (success) {
+        UndoLogHeader header = {0};
+        memcpy(header.magic, "EDIMUNDO", 8);
+        header.version = UNDOLOG_VERSION;
+        fwrite(&header, sizeof(header), 1, fp);
+        for (int i = 0; i < recordCount; i++) {
+            writeRecordEntry(fp, &(buffer->undoHistory[i]));
+        }
+        writeSaveEntry(fp, hash);
+        success = !ferror(fp);
+        success = (fclose(fp) == 0) && success;
+    }
+    if (success)
+        success = replaceFile(tempPath, path);
+    else if (fp != NULL)
+        remove(tempPath);
+
+    buf_free(tempPath);
+    return success;
+}
+
+// Writes the first size bytes of data as the new log. Used to drop changes at the end that were never saved.
+internal bool writeLogPrefix(const char *path, char *data, size_t size) {
+    char *tempPath = NULL;
+    int pathLength = (int) strlen(path);
+    memcpy(buf_add(tempPath, pathLength), path, pathLength);
+    memcpy(buf_add(tempPath, sizeof(".tmp")), ".tmp", sizeof(".tmp"));
+
+    FILE *fp = fopen(tempPath, "wb");
+    bool success = fp != NULL;
+    if (success) {
+        success = fwrite(data, 1, size, fp) == size;
+        success = (fclose(fp) == 0) && success;
+    }
+    if (success)
+        success = replaceFile(tempPath, path);
+    else if (fp != NULL)
+        remove(tempPath);
+
+    buf_free(tempPath);
+    return success;
+}
+
+// Reads the entry at offset. Returns false if the data ends before the entry and its payload do.
+internal bool readEntry(char *data, size_t size, size_t offset, UndoLogEntry *entry) {
+    if (offset + sizeof(UndoLogEntry) > size)
+        return false;
+    memcpy(entry, data + offset, sizeof(UndoLogEntry));
+    return offset + sizeof(UndoLogEntry) + entry->size <= size;
+}
+
+internal bool readLogLines(char *payload, size_t payloadSize, int count, Line **lines) {
+    size_t offset = 0;
+    for (int i = 0; i < count; i++) {
+        uint32_t length;
+        if (offset + sizeof(length) > payloadSize)
+            return false;
+        memcpy(&length, payload + offset, sizeof(length));
+        offset += sizeof(length);
+        if (offset + length > payloadSize)
+            return false;
+
+        char *chars = NULL;
+        if (length > 0)
+            memcpy(buf_add(chars, length), payload + offset, length);
+        offset += length;
+        buf_push(*lines, ((Line) { .text.chars = chars }));
+    }
+    return true;
+}
+
+internal void freeLoadedRecords(UndoRecord *records) {
+    for (int i = 0; i < buf_len(records); i++) {
+        for (int j = 0; j < buf_len(records[i].lines); j++) {
+            buf_free(records[i].lines[j].text.chars);
+        }
+        buf_free(records[i].lines);
+        xfree(records[i].bytes);
+    }
+    buf_free(records);
+}
+
+// Replays the log up to end (the end of the save that matched) and gives the resulting history to the buffer.
+// Returns false if the log doesn't make sense.
+internal bool loadHistory(Buffer *buffer, char *data, size_t end, int *loggedCount) {
+    LoggedRecord *logged = NULL;
+    int position = 0;
+
+    size_t offset = sizeof(UndoLogHeader);
+    UndoLogEntry entry;
+    while (offset < end && readEntry(data, end, offset, &entry)) {
+        switch (entry.type) {
+            case UNDOLOG_RECORD:
+            if (logged)
+                buf__hdr(logged)->len = position;
+            buf_push(logged, ((LoggedRecord) { offset, 0 }));
+            position = buf_len(logged);
+            break;
+            case UNDOLOG_UNDO:
+            if (position > 0) {
+                --position;
+                if (entry.kind == UNDO_INSERT_LINES)
+                    logged[position].undoOffset = offset;
+            }
+            break;
+            case UNDOLOG_REDO:
+            if (position < buf_len(logged))
+                ++position;
+            break;
+        }
+        offset += sizeof(UndoLogEntry) + entry.size;
+    }
+
+    // Build the records. Only the lines that aren't in the buffer right now are kept in them.
+    UndoRecord *records = NULL;
+    bool success = true;
+    for (int i = 0; i < buf_len(logged) && success; i++) {
+        readEntry(data, end, logged[i].entryOffset, &entry);
+        char *payload = data + logged[i].entryOffset + sizeof(UndoLogEntry);
+        bool applied = i < position;
+
+        UndoRecord record = {0};
+        record.kind = entry.kind;
+        record.index = entry.index;
+        record.count = entry.count;
+        record.start = entry.start;
+        record.removedLength = entry.removedLength;
+        record.insertedLength = entry.insertedLength;
+        record.charsSize = entry.charsSize;
+
+        if (entry.kind == UNDO_CHANGE_LINE) {
+            success = entry.removedLength >= 0 && entry.insertedLength >= 0
+                && (size_t) entry.removedLength + entry.insertedLength == entry.size;
+            if (success && entry.size > 0) {
+                record.bytes = xmalloc(entry.size);
+                memcpy(record.bytes, payload, entry.size);
+            }
+        } else if (entry.kind == UNDO_DELETE_LINES && applied) {
+            success = readLogLines(payload, entry.size, entry.count, &record.lines);
+        } else if (entry.kind == UNDO_INSERT_LINES && !applied) {
+            UndoLogEntry undoEntry;
+            success = logged[i].undoOffset != 0 && readEntry(data, end, logged[i].undoOffset, &undoEntry);
+            if (success)
+                success = readLogLines(data + logged[i].undoOffset + sizeof(UndoLogEntry), undoEntry.size, entry.count, &record.lines);
+        } else if (entry.kind > UNDO_SWAP_LINES) {
+            success = false;
+        }
+
+        if (record.lines)
+            buffer_assignLineIds(buffer, record.lines, buf_len(record.lines));
+        buf_push(records, record);
+    }
+
+    *loggedCount = buf_len(logged);
+    buf_free(logged);
+    if (!success) {
+        freeLoadedRecords(records);
+        return false;
+    }
+    buffer_setUndoHistory(buffer, records, position);
+    return true;
+}
+
+// Loads the undo history of the file the buffer was just opened from, and starts appending to its log.
+void undoLog_open(Buffer *buffer) {
+    char *path = undoLogPath(buffer);
+    if (path == NULL)
+        return;
+    uint64_t hash = buffer_contentHash(buffer);
+
+    char *data = NULL;
+    size_t size = 0;
+    FILE *fp = fopen(path, "rb");
+    if (fp != NULL) {
+        fseek(fp, 0, SEEK_END);
+        long fileSize = ftell(fp);
+        fseek(fp, 0, SEEK_SET);
+        if (fileSize >= (long) sizeof(UndoLogHeader)) {
+            size = (size_t) fileSize;
+            data = xmalloc(size);
+            if (fread(data, 1, size, fp) != size) {
+                xfree(data);
+                data = NULL;
+            }
+        }
+        fclose(fp);
+    }
+
+    // Find the last save of the contents the file has now
+    size_t matchEnd = 0;
+    if (data != NULL) {
+        UndoLogHeader header;
+        memcpy(&header, data, sizeof(header));
+        if (memcmp(header.magic, "EDIMUNDO", 8) == 0 && header.version == UNDOLOG_VERSION) {
+            size_t offset = sizeof(UndoLogHeader);
+            UndoLogEntry entry;
+            while (readEntry(data, size, offset, &entry)) {
+                offset += sizeof(UndoLogEntry) + entry.size;
+                uint64_t savedHash;
+                if (entry.type == UNDOLOG_SAVE && entry.size == sizeof(savedHash)) {
+                    memcpy(&savedHash, data + offset - sizeof(savedHash), sizeof(savedHash));
+                    if (savedHash == hash)
+                        matchEnd = offset;
+                }
+            }
+        }
+    }
+
+    int loggedCount = 0;
+    bool ready = false;
+    if (matchEnd == 0 || !loadHistory(buffer, data, matchEnd, &loggedCount)) {
+        // No history for these contents. The log is started over on the first change.
+        buffer->undoLogPending = true;
+        buffer->undoLogHash = hash;
+    } else if (buf_len(buffer->undoHistory) * 2 < loggedCount) {
+        // Most of the log was forgotten because of the budget, so write out what's left
+        buffer_discardRedo(buffer);
+        ready = writeLog(buffer, path, buffer->undoPosition, hash);
+    } else if (matchEnd < size) {
+        ready = writeLogPrefix(path, data, matchEnd);
+    } else ready = true;
+    xfree(data);
+
+    if (ready)
+        buffer->undoLog = fopen(path, "ab");
+    buf_free(path);
+}
+
+void undoLog_close(Buffer *buffer) {
+    if (buffer->undoLog != NULL)
+        fclose(buffer->undoLog);
+    buffer->undoLog = NULL;
+}
+
+// The record was just pushed onto the buffer's history
+void undoLog_recordPushed(Buffer *buffer, UndoRecord *record) {
+    if (buffer->undoLog == NULL && buffer->undoLogPending) {
+        // First change since the file was opened, start the log with the contents it was opened with
+        buffer->undoLogPending = false;
+        char *path = undoLogPath(buffer);
+        if (path != NULL && writeLog(buffer, path, buffer->undoPosition - 1, buffer->undoLogHash))
+            buffer->undoLog = fopen(path, "ab");
+        buf_free(path);
+    }
+    if (buffer->undoLog == NULL)
+        return;
+    writeRecordEntry(buffer->undoLog, record);
+    fflush(buffer->undoLog);
+}
+
+// The record was just undone
+void undoLog_undone(Buffer *buffer, UndoRecord *record) {
+    if (buffer->undoLog == NULL)
+        return;
+    UndoLogEntry entry = entryForRecord(UNDOLOG_UNDO, record);
+    if (record->kind == UNDO_INSERT_LINES)
+        entry.size = (uint32_t) linesPayloadSize(record->lines, buf_len(record->lines));
+    fwrite(&entry, sizeof(entry), 1, buffer->undoLog);
+    if (record->kind == UNDO_INSERT_LINES)
+        writeLines(buffer->undoLog, record->lines, buf_len(record->lines));
+    fflush(buffer->undoLog);
+}
+
+void undoLog_redone(Buffer *buffer) {
+    if (buffer->undoLog == NULL)
+        return;
+    UndoLogEntry entry = {0};
+    entry.type = UNDOLOG_REDO;
+    fwrite(&entry, sizeof(entry), 1, buffer->undoLog);
+    fflush(buffer->undoLog);
+}
+
+// The buffer was just saved. Starts the log if the buffer has changes but no log yet (like a new file).
+void undoLog_saved(Buffer *buffer) {
+    uint64_t hash = buffer_contentHash(buffer);
+    if (buffer->undoLog != NULL) {
+        writeSaveEntry(buffer->undoLog, hash);
+        fflush(buffer->undoLog);
+        return;
+    }
+    if (buf_len(buffer->undoHistory) == 0) {
+        buffer->undoLogPending = true;
+        buffer->undoLogHash = hash;
+        return;
+    }
+
+    char *path = undoLogPath(buffer);
+    if (path == NULL)
+        return;
+    buffer_discardRedo(buffer);
+    if (writeLog(buffer, path, buffer->undoPosition, hash))
+        buffer->undoLog = fopen(path, "ab");
+    buffer->undoLogPending = false;
+    buf_free(path);
+}